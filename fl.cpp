@@ -1,43 +1,279 @@
+#include <cstdlib>
 #include "fl.hpp"
 
-fl::print_map& fl::instance()
+fl::detail::symbol_table& fl::detail::symbol_table::instance()
 {
-    static print_map pm;
-    return pm;
+    static symbol_table st;
+    return st;
 }
 
-thread_local worker_context* g_current_worker=nullptr;
+thread_local size_t g_local_scope_depth=0;
 
-fl::worker* fl::worker_context::get_current_worker(){ return g_current_worker; }
-void fl::worker_context::set_current_worker(worker* w){ g_current_worker = w; }
+size_t& fl::detail::local_scope_depth(){ return g_local_scope_depth; }
 
-bool in_worker(){ return g_current_worker ? true : false; }
-fl::worker current_worker(){ return *g_current_worker; }
+thread_local fl::detail::arena_state* g_current_arena=nullptr;
 
-bool in_workerpool(){ return in_worker() && current_worker().in_workerpool(); }
-fl::workerpool current_workerpool(){ return current_worker().get_workerpool(); }
+fl::detail::arena_state*& fl::detail::current_arena(){ return g_current_arena; }
+
+std::atomic<size_t> g_run_invalidations(0);
+
+std::atomic<size_t>& fl::detail::run_invalidations(){ return g_run_invalidations; }
+
+struct context_pool_orphans
+{
+    std::mutex mtx;
+    void* head=nullptr;
+    size_t count=0;
+};
+
+context_pool_orphans g_context_pool_orphans[3];
+
+std::atomic<size_t> g_context_pool_slabs(0);
+
+// trivially destructible, so the pools stay usable while other thread_locals 
+// holding atoms are destroyed
+thread_local fl::detail::context_pool g_context_pools[3] = { 
+    fl::detail::context_pool(0), 
+    fl::detail::context_pool(1),
+    fl::detail::context_pool(2) 
+};
+
+struct context_pool_guard
+{
+    ~context_pool_guard()
+    {
+        g_context_pools[0].orphan();
+        g_context_pools[1].orphan();
+        g_context_pools[2].orphan();
+    }
+};
+
+thread_local fl::detail::reclaimer g_reclaimer;
+
+// frees the garbage still queued when the thread exits
+struct reclaimer_guard
+{
+    ~reclaimer_guard()
+    {
+        g_reclaimer.mode = fl::reclaim_mode::immediate;
+        g_reclaimer.draining = true;
+        while(g_reclaimer.size()){ g_reclaimer.destroy(g_reclaimer.pop()); }
+        g_reclaimer.draining = false;
+        g_reclaimer.release_storage();
+    }
+};
+
+fl::detail::reclaimer& fl::detail::reclaimer::local()
+{
+    thread_local reclaimer_guard guard;
+    (void)guard;
+    return g_reclaimer;
+}
+
+void fl::detail::reclaimer::release_storage()
+{
+    std::free(items_);
+    items_ = nullptr;
+    capacity_ = 0;
+}
+
+bool fl::detail::reclaimer::grow()
+{
+    size_t cap = capacity_ ? capacity_*2 : 256;
+    void** p = static_cast<void**>(std::realloc(items_, cap*sizeof(void*)));
+    if(!p){ return false; }
+    items_ = p;
+    capacity_ = cap;
+    return true;
+}
+
+// Single thread destroying the contexts handed over by threads in 
+// reclaim_mode::background. It is started by the first hand off. Garbage left
+// when the program exits is not freed.
+struct background_reclaimer
+{
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::vector<void*> items;
+    void(*destroy)(void*)=nullptr;
+    bool stop=false;
+    std::thread thd;
+
+    ~background_reclaimer()
+    {
+        if(thd.joinable())
+        {
+            {
+                std::unique_lock<std::mutex> lk(mtx);
+                stop = true;
+            }
+            cv.notify_one();
+            thd.join();
+        }
+    }
+
+    void run()
+    {
+        std::vector<void*> batch;
+        fl::detail::reclaimer& r = fl::detail::reclaimer::local();
+
+        while(true)
+        {
+            {
+                std::unique_lock<std::mutex> lk(mtx);
+                cv.wait(lk, [&]{ return stop || !items.empty(); });
+                if(stop){ return; }
+                batch.swap(items);
+            }
+
+            // the reclaimer of this thread is always immediate, so each 
+            // context is freed along with everything it held
+            for(void* c : batch)
+            {
+                r.draining = true;
+                destroy(c);
+                while(r.size()){ r.destroy(r.pop()); }
+                r.draining = false;
+            }
+            batch.clear();
+        }
+    }
+};
+
+background_reclaimer g_background_reclaimer;
+
+void fl::detail::reclaimer::hand_off(bool(*keep)(void*))
+{
+    size_t kept = 0;
+
+    {
+        std::unique_lock<std::mutex> lk(g_background_reclaimer.mtx);
+        if(g_background_reclaimer.stop){ return; }
+        g_background_reclaimer.destroy = destroy;
+
+        // keep everything queued rather than throw from a release
+        try{ g_background_reclaimer.items.reserve(g_background_reclaimer.items.size() + size_); }
+        catch(...){ return; }
+
+        for(size_t i = 0; i < size_; ++i)
+        {
+            if(keep(items_[i])){ items_[kept++] = items_[i]; }
+            else{ g_background_reclaimer.items.push_back(items_[i]); }
+        }
+
+        if(!g_background_reclaimer.thd.joinable())
+        {
+            g_background_reclaimer.thd = std::thread([]{ g_background_reclaimer.run(); });
+        }
+    }
+
+    size_ = kept;
+    g_background_reclaimer.cv.notify_one();
+}
+
+fl::detail::context_pool& fl::detail::context_pool::local(size_t size_class)
+{
+    thread_local context_pool_guard guard;
+    (void)guard;
+    return g_context_pools[size_class];
+}
+
+void fl::detail::context_pool::orphan(){ release(0); }
+
+void fl::detail::context_pool::release(size_t keep)
+{
+    if(count_ <= keep){ return; }
+
+    // the first keep blocks stay, the rest is spliced onto the global list
+    free_block* last_kept = nullptr;
+    free_block* first = free_;
+    for(size_t i = 0; i < keep; ++i)
+    {
+        last_kept = first;
+        first = first->next;
+    }
+
+    free_block* tail = first;
+    while(tail->next){ tail = tail->next; }
+
+    if(last_kept){ last_kept->next = nullptr; }
+    else{ free_ = nullptr; }
+    size_t n = count_ - keep;
+    count_ = keep;
+
+    std::unique_lock<std::mutex> lk(g_context_pool_orphans[cls_].mtx);
+    tail->next = static_cast<free_block*>(g_context_pool_orphans[cls_].head);
+    g_context_pool_orphans[cls_].head = first;
+    g_context_pool_orphans[cls_].count += n;
+}
+
+size_t fl::detail::context_pool::slabs()
+{ 
+    return g_context_pool_slabs.load(std::memory_order_relaxed); 
+}
+
+void fl::detail::context_pool::refill(size_t block_sz)
+{
+    {
+        std::unique_lock<std::mutex> lk(g_context_pool_orphans[cls_].mtx);
+        free_ = static_cast<free_block*>(g_context_pool_orphans[cls_].head);
+        count_ = g_context_pool_orphans[cls_].count;
+        g_context_pool_orphans[cls_].head = nullptr;
+        g_context_pool_orphans[cls_].count = 0;
+    }
+
+    if(!free_)
+    {
+        g_context_pool_slabs.fetch_add(1, std::memory_order_relaxed);
+        char* slab = static_cast<char*>(::operator new(slab_size));
+        for(size_t off = slab_size - slab_size % block_sz; off; )
+        {
+            off -= block_sz;
+            deallocate(slab + off);
+        }
+    }
+}
+
+std::weak_ptr<fl::worker::worker_context>& fl::worker::worker_context::current()
+{
+    thread_local std::weak_ptr<worker_context> w;
+    return w;
+}
+
+bool fl::in_worker(){ return !worker::worker_context::current().expired(); }
+fl::worker fl::current_worker(){ return worker(worker::worker_context::current().lock()); }
+
+std::weak_ptr<fl::workerpool::workerpool_context>& fl::workerpool::workerpool_context::current()
+{
+    thread_local std::weak_ptr<workerpool_context> tp;
+    return tp;
+}
+
+bool fl::in_workerpool(){ return !workerpool::workerpool_context::current().expired(); }
+fl::workerpool fl::current_workerpool(){ return workerpool(workerpool::workerpool_context::current().lock()); }
 
 std::mutex g_default_workerpool_mtx;
-workerpool g_default_workerpool;
+fl::workerpool g_default_workerpool;
 size_t g_default_workerpool_worker_count=0;
 
-void set_default_workerpool_worker_count(size_t cnt)
+void fl::set_default_workerpool_worker_count(size_t cnt)
 {
-    std::unique_lock<std::mutex> lk(mtx);
+    std::unique_lock<std::mutex> lk(g_default_workerpool_mtx);
     g_default_workerpool_worker_count = cnt;
 }
 
-fl::workerpool default_workerpool()
+fl::workerpool fl::default_workerpool()
 { 
+    std::unique_lock<std::mutex> lk(g_default_workerpool_mtx);
     if(!g_default_workerpool)
     { 
-        if(g_default_workerpool_worker_count){ g_default_workerpool.start(cnt); }
+        if(g_default_workerpool_worker_count){ g_default_workerpool.start(g_default_workerpool_worker_count); }
         else{ g_default_workerpool.start(); }
     }
     return g_default_workerpool;
 }
 
-atom fl::schedule(atom a)
+bool fl::schedule(atom a)
 {
     if(in_workerpool()){ return current_workerpool().schedule(a); }
     else if(in_worker()){ return current_worker().schedule(a); }
@@ -3,34 +3,59 @@
 
 // c++
 #include <memory>
-#include <any>
+#include <new>
+#include <cstddef>
+#include <cstdint>
 #include <typeinfo>
 #include <type_traits>
+#include <functional>
 #include <iostream>
 #include <ostream>
 #include <mutex>
+#include <atomic>
 #include <condition_variable>
 #include <string>
-#include <stringstream>
+#include <sstream>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <list>
 #include <exception>
+#include <stdexcept>
 #include <thread>
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include <functional>
+#include <charconv>
+#include <cstring>
+#include <cstdlib>
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#endif
 
 namespace fl { 
 
 //-----------------------------------------------------------------------------
 // generic templates
+class atom; // forward declaration
+
 namespace detail {
 template <typename T>
-using unqualified = typename std::decay<T>::value;
+using unqualified = typename std::decay<T>::type;
+
+// enables the forwarding overloads of atom for anything but atoms
+template <typename T>
+using not_atom = typename std::enable_if<!std::is_same<unqualified<T>,atom>::value>::type;
+
+template <typename F>
+struct function_traits;
 
 template <typename R, typename... As>
 struct function_traits<R(As...)>
 {
     typedef R return_type;
-    constexpr size_t arity = sizeof...(As);
+    static constexpr size_t arity = sizeof...(As);
     template <size_t i>
     using arg = typename std::tuple_element<i, std::tuple<As...>>::type;
 };
@@ -42,1128 +67,6086 @@ struct function_traits<R(As...)>
 // fl::function
 
 class atom; // forward declaration
+class arg_span;
+
+// The inline buffer capacity of fl::function. Callables no larger than this 
+// are stored inside the function object instead of a separate heap 
+// allocation, the default holds a lambda capturing 7 atoms. An fl::function 
+// with the default capacity is itself stored inline in an atom's context.
+#ifndef FL_FUNCTION_INLINE_CAPACITY
+#define FL_FUNCTION_INLINE_CAPACITY (7*sizeof(void*))
+#endif
 
-// fl::function definition, an std::function that takes 1 atom as an 
-// argument and returns an atom
-typedef std::function<atom(atom)> function;
+// unique_function is a move only std::function with a configurable inline 
+// buffer. Like std::function its call operator is const. Copying the stored 
+// callable is only possible explicitly with clone(), which throws 
+// std::logic_error if the callable cannot be copied.
+template <typename SIG, size_t CAPACITY=FL_FUNCTION_INLINE_CAPACITY>
+class unique_function;
 
-template <typename R, typename... As>
-const std::function<R(As...)>& to_std_function(const std::function<R(As...)>& f){ return f; }
+template <typename R, typename... As, size_t CAPACITY>
+class unique_function<R(As...),CAPACITY>
+{
+public:
+    static constexpr size_t inline_capacity = CAPACITY;
 
-template <typename R, typename... As>
-std::function<R(As...)> to_std_function(std::function<R(As...)>&& f){ return std::move(f); }
+    unique_function() noexcept : ops_(nullptr) {}
+    unique_function(std::nullptr_t) noexcept : ops_(nullptr) {}
 
-template <typename F>
-std::function<decltype(F)> to_std_function(F&& f)
-{ 
-    std::function<decltype(F)> std_f = f;
-    return std_f;
-}
+    template <typename F,
+              typename = typename std::enable_if<
+                  !std::is_same<typename std::decay<F>::type,unique_function>::value>::type>
+    unique_function(F&& f) : ops_(nullptr)
+    {
+        typedef typename std::decay<F>::type T;
+        target<T,fits<T>()>::construct(buf_, std::forward<F>(f));
+        ops_ = &target<T,fits<T>()>::ops;
+    }
 
-// curry 
-// transform any std::function into one that accepts its arguments as atoms one 
-// at a time
-namespace detail {
-template <typename FUNCTION> struct
-curry;
+    unique_function(unique_function&& rhs) noexcept : ops_(rhs.ops_)
+    {
+        if(ops_)
+        {
+            ops_->move(buf_, rhs.buf_);
+            rhs.ops_ = nullptr;
+        }
+    }
 
-// final specialization
-template <> struct
-curry<function> 
-{
-    using
-    type = function;
+    unique_function(const unique_function&) = delete;
+    unique_function& operator=(const unique_function&) = delete;
 
-    const type
-    result;
+    unique_function& operator=(unique_function&& rhs) noexcept
+    {
+        if(this != &rhs)
+        {
+            reset();
+            if(rhs.ops_)
+            {
+                rhs.ops_->move(buf_, rhs.buf_);
+                ops_ = rhs.ops_;
+                rhs.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
 
-    curry(type fun) : result(fun) {}
-};
+    ~unique_function(){ reset(); }
 
-// specialization for void return type
-template <> struct
-curry<std::function<void(atom)>> 
-{
-    using
-    type = std::function<R(T)>;
+    inline R operator()(As... as) const
+    {
+        if(!ops_){ throw std::bad_function_call(); }
+        return ops_->invoke(const_cast<unsigned char*>(buf_), std::forward<As>(as)...);
+    }
 
-    const type
-    result;
+    inline explicit operator bool() const { return ops_ != nullptr; }
 
-    curry(std::function<R(atom)> fun) : 
-    result(
-        [=](atom a){
-            return curry<function>(
-                [=](){
-                    fun(a);
-                    return atom(); // return nil
-                }
-            ).result;
+    // a copy of this function and its callable
+    unique_function clone() const
+    {
+        unique_function f;
+        if(ops_)
+        {
+            ops_->clone(f.buf_, buf_);
+            f.ops_ = ops_;
         }
-    ) 
-    {}
-};
+        return f;
+    }
 
-// specialization for no argument and no return value
-template <> struct
-curry<std::function<void()>> 
-{
-    using
-    type = std::function<void()>;
+private:
+    struct operations
+    {
+        R (*invoke)(void* storage, As&&... as);
+        void (*move)(void* dst, void* src) noexcept;
+        void (*clone)(void* dst, const void* src);
+        void (*destroy)(void* storage);
+    };
 
-    const type
-    result;
+    template <typename T>
+    static constexpr bool fits()
+    {
+        return sizeof(T) <= CAPACITY && 
+               alignof(T) <= alignof(void*) && 
+               std::is_nothrow_move_constructible<T>::value;
+    }
 
-    curry(std::function<void()> fun) : 
-    result(
-        [=](atom a){
-            return curry<function>(
-                [=](){
-                    fun();
-                    return atom();
-                }
-            ).result;
-        }
-    ) 
-    {}
-};
+    template <typename T>
+    static void copy(void* dst, const T& t, std::true_type){ new(dst) T(t); }
 
-// specialization for no argument
-template <typename R> struct
-curry<std::function<R()>> 
-{
-    using
-    type = std::function<R()>;
+    template <typename T>
+    static void copy(void*, const T&, std::false_type)
+    { 
+        throw std::logic_error("fl::unique_function::clone() of a move only callable"); 
+    }
 
-    const type
-    result;
+    template <typename T, bool INLINE>
+    struct target;
 
-    curry(std::function<R()> fun) : 
-    result(
-        [=](atom a){
-            return curry<function>(
-                [=](){
-                    return atom(fun());
-                }
-            ).result;
-        }
-    ) 
-    {}
-};
+    // callable stored in the buffer
+    template <typename T>
+    struct target<T,true>
+    {
+        template <typename F>
+        static void construct(void* storage, F&& f){ new(storage) T(std::forward<F>(f)); }
 
-// specialization for non-atom return type
-template <typename R> struct
-curry<std::function<R(atom)>> 
-{
-    using
-    type = std::function<R(atom)>;
+        static T& get(void* storage){ return *static_cast<T*>(storage); }
 
-    const type
-    result;
+        static R invoke(void* storage, As&&... as){ return get(storage)(std::forward<As>(as)...); }
 
-    curry(std::function<R(atom)> fun) : 
-    result(
-        [=](atom a){
-            return curry<function>(
-                [=](){
-                    return atom(fun(a));
-                }
-            ).result;
+        static void move(void* dst, void* src) noexcept
+        { 
+            new(dst) T(std::move(get(src)));
+            get(src).~T();
         }
-    ) 
-    {}
-};
 
-// specialization for functions with a single argument
-template <typename R, typename T> struct
-curry<std::function<R(T)>> 
-{
-    using
-    type = std::function<R(T)>;
+        static void clone(void* dst, const void* src)
+        {
+            copy(dst, *static_cast<const T*>(src), std::is_copy_constructible<T>());
+        }
 
-    const type
-    result;
+        static void destroy(void* storage){ get(storage).~T(); }
 
-    // all other argument types
-    curry(std::function<R(T)> fun) : 
-    result (
-        [=](atom a) {
-            return curry<std::function<R(atom)>>(
-                [=](Ts&&...ts){
-                    return fun(atom_cast<T>(a));
-                }
-            ).result;
-        }
-    ) 
-    {}
-};
+        static constexpr operations ops = { invoke, move, clone, destroy };
+    };
 
-// recursive atom specialization for functions with more arguments
-template <typename R, typename...Ts> struct
-curry<std::function<R(atom,Ts...)>> 
-{
-    using
-    remaining_type = typename curry<std::function<R(Ts...)> >::type;
+    // callable boxed on the heap, the buffer holds the pointer
+    template <typename T>
+    struct target<T,false>
+    {
+        template <typename F>
+        static void construct(void* storage, F&& f){ *static_cast<T**>(storage) = new T(std::forward<F>(f)); }
 
-    using
-    type = std::function<remaining_type(atom)>;
+        static T& get(void* storage){ return **static_cast<T**>(storage); }
 
-    const type
-    result;
+        static R invoke(void* storage, As&&... as){ return get(storage)(std::forward<As>(as)...); }
 
-    // atom accepting variant
-    curry(std::function<R(atom,Ts...)> fun) : 
-    result(
-        [=](atom a){
-            return curry<std::function<R(Ts...)>>(
-                [=](Ts&&...ts){ return fun(a, ts...); }
-            ).result;
+        static void move(void* dst, void* src) noexcept
+        { 
+            *static_cast<T**>(dst) = *static_cast<T**>(src); 
         }
-    ) 
-    {}
-};
 
-// recursive specialization for functions with more arguments
-template <typename R, typename T,typename...Ts> struct
-curry<std::function<R(T,Ts...)>> 
-{
-    using
-    remaining_type = typename curry<std::function<R(Ts...)> >::type;
+        static void clone(void* dst, const void* src)
+        {
+            const T& t = **static_cast<T* const*>(src);
+            T* p = static_cast<T*>(::operator new(sizeof(T)));
+            try{ copy(p, t, std::is_copy_constructible<T>()); }
+            catch(...)
+            {
+                ::operator delete(p);
+                throw;
+            }
+            *static_cast<T**>(dst) = p;
+        }
 
-    using
-    type = std::function<remaining_type(atom)>;
+        static void destroy(void* storage){ delete &get(storage); }
 
-    const type
-    result;
+        static constexpr operations ops = { invoke, move, clone, destroy };
+    };
 
-    curry(std::function<R(T,Ts...)> fun) : 
-    result(
-        [=](a){
-            return curry<std::function<R(Ts...)>>(
-                [=](Ts&&...ts){ return fun(atom_cast<T>(a), ts...); }
-            ).result;
+    inline void reset()
+    {
+        if(ops_)
+        {
+            ops_->destroy(buf_);
+            ops_ = nullptr;
         }
-    ) 
-    {}
-};
-}
-
-// curry takes any std::function or function pointer and returns a 
-// std::function<atom(atom)>
-template <typename R, typename... Ts> 
-auto
-curry(const std::function<R(Ts...)>& f)
--> typename detail::curry<std::function<R(Ts...)>>::type
-{
-    return detail::curry<std::function<R(Ts...)>>(f).result;
-}
+    }
 
-template <typename R, typename... Ts> 
-auto
-curry(R(* const f)(Ts...))
--> typename detail::curry<std::function<R(Ts...)>>::type
-{
-    return detail::curry<std::function<R(Ts...)>>(f).result;
-}
+    const operations* ops_;
+    alignas(void*) unsigned char buf_[CAPACITY < sizeof(void*) ? sizeof(void*) : CAPACITY];
+};
 
+// fl::function definition, a unique_function that takes the arguments of a 
+// call as an arg_span and returns an atom. An arg_span converts to the list 
+// of its arguments, so any callable taking a single atom is an fl::function.
+typedef unique_function<atom(arg_span)> function;
 
 namespace detail {
-// final variations
-atom eval_curried_function(const function& f, atom a){ return f(a); }
-atom eval_curried_function(function&& f, atom a){ return f(a); }
-
-// recursive variation
-template <typename F>
-atom eval_curried_function(F&& f, atom a)
-{ 
-    if(is_nil(a)){ return eval_curried_function(f(a),a); }
-    else{ return eval_curried_function(f(car(a)),cdr(a)); }
-}
-}
-
-// atomize_function converts any callable to an fl::function
-template <typename R, typename... As>
-function to_fl_function(std::function<R()> std_f)
-{
-    function final_f = [=](atom a) -> atom
-    {
-        return atom(std_f());
-    };
-    return final_f;
-}
+// the value an atom copies its value from. fl::functions are move only, 
+// copying an atom holding one is an explicit request to clone() it.
+template <typename T>
+const T& copy_of(const T& v){ return v; }
 
-template <typename R, typename... As>
-function to_fl_function(std::function<R(As...)> std_f)
-{
-    function final_f = [=](atom a) -> atom
-    {
-        auto curried_f = curry(std_f);
-        return detail::eval_curried_function(curried_f,a); 
-    };
-    return final_f;
+template <typename SIG, size_t CAPACITY>
+unique_function<SIG,CAPACITY> copy_of(const unique_function<SIG,CAPACITY>& f){ return f.clone(); }
 }
 
-template <typename F>
-function to_fl_function(F&& f)
-{
-    function final_f = [=](atom a) -> atom
-    {
-        auto std_f = to_std_function(std::forward<F>(f));
-        auto curried_f = curry(std_f);
-        return detail::eval_curried_function(curried_f,a); 
-    };
-    return final_f;
-}
+namespace detail {
+// the call signature of a function, function pointer, std::function or 
+// function object with a single operator()
+template <typename F> 
+struct signature_of : signature_of<decltype(&F::operator())> {};
 
+template <typename R, typename... As> 
+struct signature_of<R(As...)> { using type = R(As...); };
 
+template <typename R, typename... As> 
+struct signature_of<R(*)(As...)> : signature_of<R(As...)> {};
 
-//-----------------------------------------------------------------------------
-// atom  
+template <typename C, typename R, typename... As> 
+struct signature_of<R(C::*)(As...)> : signature_of<R(As...)> {};
 
-class atom;
-class print_map;
+template <typename C, typename R, typename... As> 
+struct signature_of<R(C::*)(As...) const> : signature_of<R(As...)> {};
 
-namespace detail {
-template <typename T> class register_type; 
+template <typename R, typename... As> 
+struct signature_of<std::function<R(As...)>> : signature_of<R(As...)> {};
 
-typedef bool(*compare_atom_function)(atom,atom)>;
+// Unpack an argument atom into a parameter of type T. Atom parameters receive
+// the argument itself and mutable references are taken with atom_cast(), 
+// every other parameter reads the value without detaching copy-on-write 
+// contexts. A is always atom, it is a template parameter because atom is 
+// incomplete here.
+template <typename T>
+struct param
+{
+    static constexpr bool writes = false;
 
-template <>
-bool compare_atom_function__(const atom& a, const atom& b){ return false; }
+    template <typename A>
+    static const unqualified<T>& get(A& a){ return a.template value<unqualified<T>>(); }
+};
 
 template <typename T>
-bool compare_atom_function__(const atom& a, const atom& b)
+struct param<T&>
 {
-    // a is guaranteed to be type T because this is used by the T templated 
-    // atom constructor
-    if(b.is<T>()){ return a.value<T>() == b.value<T>(): }
-    else{ return false; }
-}
-}
+    static constexpr bool writes = true; // through the argument's handle
 
-#define REGISTER_TYPE__(T) detail::register_type<T>(#T)
+    template <typename A>
+    static T& get(A& a){ return a.template atom_cast<T&>(); }
+};
 
+template <typename T>
+struct param<const T&> : param<T> {};
 
-class atom 
+template <typename T>
+struct param<T&&>
 {
-public:
-    atom(){}
-    atom(const atom& rhs) : a(rhs.ctx) {}
-    atom(atom&& rhs) : a(std::move(rhs.ctx)) {}
+    static constexpr bool writes = false;
 
-    template <typename T>
-    atom(T&& t){ set(std::forward<T>(t)); }
+    template <typename A>
+    static T get(A& a){ return a.template value<T>(); }
+};
 
-    // compare atom's real typed T values with the == operator 
-    inline bool equalv(atom b) const { return caf(*this,b); }
+template <> struct param<atom> 
+{ 
+    static constexpr bool writes = false;
 
-    // allows direct value comparison such as:
-    // a.equalv(3);
-    // a.equalv("hello world");
-    template <typename T>
-    inline bool equalv(T&& t) const { return caf(*this,atom(std::forward<T>(t))); }
+    template <typename A> static A& get(A& a){ return a; } 
+};
 
-    bool operator==(const atom& rhs){ return equalv(rhs); }
-    bool operator==(atom&& rhs){ return equalv(rhs); }
-    template <typename T> bool operator==(T&& rhs){ return equalv(atom(std::forward<T>(rhs))); }
+template <> struct param<const atom&> : param<atom> {};
+template <> struct param<atom&> : param<atom> {};
 
-    inline bool equalp(atom b) const { return ctx.get() == b.ctx.get() }
+// the argument array may be read again by the caller, such as specialize(), 
+// so rvalue parameters receive a copy
+template <> struct param<atom&&> 
+{ 
+    static constexpr bool writes = false;
 
-    // atom_cast(), set() and extract() allow modification of the underlying 
-    // std::any context. Modifying this will modify *ALL* atoms that have 
-    // copies of the shared_ptr<context> 
+    template <typename A> static A get(A& a){ return a; } 
+};
 
-    // any cast the atom's value. This is the most flexible and most dangerous 
-    // way to get the value from an atom. Since this is a direct forward of 
-    // std::any_cast it allows returning mutable references of the stored 
-    // value.
-    template <typename T>
-    T atom_cast(){ return std::any_cast<T>(ctx->value); }
+// the handle a parameter writing to the car of the list cell lst is given, 
+// see the definition
+inline atom& write_handle(const atom& lst, atom& tmp);
 
-    // get atom's value as a const reference to the specified type
-    template <typename T> 
-    const unqualified<T>& 
-    value() const { return std::any_cast<const unqualified<T>&>(ctx->value); }
+// calls a callable of signature R(As...) with the arguments of an arg_span,
+// wrapping its result in an atom. Arguments passed as an array are read in 
+// place, arguments passed as a list are gathered in a single walk, and 
+// parameters writing to their argument write through the list's own handle 
+// instead of a copy, which would detach a copy-on-write argument. S is always
+// arg_span, it is a template parameter because arg_span is incomplete here.
+template <typename R, typename... As>
+struct invoker
+{
+    template <typename F, typename S>
+    static typename S::value_type call(F& f, const S& args)
+    {
+        typedef typename S::value_type A;
 
-    // set() is capable of changing the underlying stored type, not just the 
-    // stored value.
-    
-    // c-string variant to ensure we can compare with std::string
-    void set(const char* t) 
-    { 
-        static REGISTER_TYPE__(std::string);
-        std::string s(t);
-        if(ctx){ *ctx = *(make_atom_context(std::move(s), std::false_type())); }
-        else{ ctx = make_atom_context(std::move(s), std::false_type()); }
+        if(A* first = args.data())
+        {
+            if(args.size() < sizeof...(As)){ too_few_arguments(); }
+            return result<A>(f, first, std::index_sequence_for<As...>(), std::is_void<R>());
+        }
+        else
+        {
+            constexpr bool writes[] = { param<As>::writes..., false };
+            A argv[sizeof...(As) ? sizeof...(As) : 1];
+            A* handles[sizeof...(As) ? sizeof...(As) : 1];
+            A head = args.to_list(); // keeps the cells of the handles alive
+            A lst = head;
+            for(size_t i = 0; i < sizeof...(As); ++i)
+            {
+                if(!is_cons(lst)){ too_few_arguments(); }
+                if(writes[i]){ handles[i] = &write_handle(lst, argv[i]); }
+                else
+                {
+                    argv[i] = car(lst);
+                    handles[i] = &argv[i];
+                }
+                lst = cdr(lst);
+            }
+            return result<A>(f, handles, std::index_sequence_for<As...>(), std::is_void<R>());
+        }
     }
 
-    template <typename T> 
-    void set(T&& t) 
-    { 
-        static REGISTER_TYPE__(T);
-        if(ctx){ *ctx = *(make_atom_context(std::move(s), std::false_type())); }
-        else{ ctx = make_atom_context(std::move(s), std::false_type()); }
+    static void too_few_arguments()
+    {
+        throw std::invalid_argument("fl::function called with too few arguments");
     }
 
-    atom& operator=(const atom& rhs)
+    // the argument i of an array of arguments or of argument handles
+    template <typename A> static A& at(A* argv, size_t i){ return argv[i]; }
+    template <typename A> static A& at(A** argv, size_t i){ return *argv[i]; }
+
+    template <typename A, typename F, typename P, size_t... Is>
+    static A result(F& f, P argv, std::index_sequence<Is...>, std::false_type)
     {
-        ctx = rhs.ctx;
-        return *this; 
+        (void)argv;
+        return A(f(param<As>::get(at(argv, Is))...));
     }
 
-    atom& operator=(atom&& rhs)
+    template <typename A, typename F, typename P, size_t... Is>
+    static A result(F& f, P argv, std::index_sequence<Is...>, std::true_type)
     {
-        ctx = std::move(rhs.ctx);
-        return *this; 
+        (void)argv;
+        f(param<As>::get(at(argv, Is))...);
+        return A(); // nil
     }
+};
 
-    template <typename T>
-    atom& operator=(T&& rhs)
+// calls a callable of signature R(P), P being atom, with the list of all the
+// arguments of an arg_span, the same as an fl::function constructed from the 
+// callable directly
+template <typename R, typename P>
+struct list_invoker
+{
+    template <typename F, typename S>
+    static typename S::value_type call(F& f, const S& args)
     {
-        set(std::forward<T>(rhs));
-        return *this; 
+        typename S::value_type lst = args.to_list();
+        return result(f, lst, std::is_void<R>());
     }
 
-    // Returns an rvalue reference allowing code to use move semantics to 
-    // extract data from the internal context. This means that the data stored 
-    // in the context will be in a valid but unknown state.
-    template <typename T>
-    unqualified<T>&& extract(){ return std::any_cast<unqualified<T>&&>(ctx->value); }
+    template <typename F, typename A>
+    static A result(F& f, A& lst, std::false_type){ return A(f(param<P>::get(lst))); }
 
-    // Make a deep copy of the current atom
-    inline atom copy() const
+    template <typename F, typename A>
+    static A result(F& f, A& lst, std::true_type)
     {
-        atom b;
-        *(b.ctx) = *(a.ctx);
-        return b;
+        f(param<P>::get(lst));
+        return A(); // nil
     }
+};
 
-    inline bool is_nil() const { return ctx ? false : true; }
+// the invoker of a callable of signature R(As...)
+template <typename R, typename... As>
+struct invoker_of { typedef invoker<R,As...> type; };
 
-    template <typename T>
-    bool is() const
-    {
-        if(is_nil()){ return false; }
-        else
-        {
-            try 
-            {
-                const auto& ref = value<T>(ctx->value);
-                return true;
-            }
-            catch(...){ return false; }
-        } 
-    };
+template <typename R> struct invoker_of<R,atom> { typedef list_invoker<R,atom> type; };
+template <typename R> struct invoker_of<R,const atom&> { typedef list_invoker<R,const atom&> type; };
+template <typename R> struct invoker_of<R,atom&> { typedef list_invoker<R,atom&> type; };
+template <typename R> struct invoker_of<R,atom&&> { typedef list_invoker<R,atom&&> type; };
 
-    // returns true if atom has a value, else false
-    inline bool operator bool() const { return !is_nil(); }
+template <typename F, typename R, typename... As>
+function make_invoker(F&& f, R(*)(As...))
+{
+    // the argument type is deduced as atom is incomplete here
+    return [f = std::forward<F>(f)](auto args) mutable 
+    { 
+        return invoker_of<R,As...>::type::call(f, std::move(args)); 
+    };
+}
 
-private:
-    struct atom_context 
-    {
-        context(const context& rhs) : a(rhs.a), caf(rhs.caf) { }
-        context(context&& rhs) : a(std::move(rhs.a)), caf(std::move(rhs.caf)) { }
+// callables which take the whole arg_span are stored as they are
+template <typename F>
+function make_invoker(F&& f, atom(*)(const arg_span&)){ return function(std::forward<F>(f)); }
 
-        template <typename T>
-        context(T&& t, detail::compare_any_function in_caf) : a(t), caf(in_caf) { }
+template <typename F>
+function make_invoker(F&& f, atom(*)(arg_span)){ return function(std::forward<F>(f)); }
+}
 
-        context& operator=(const context& rhs)
-        {
-            value = rhs.value;
-            caf = rhs.caf;
-            return *this;
-        }
+// to_fl_function converts any callable to an fl::function. The callable's 
+// signature is resolved once, here, and every call unpacks the argument list
+// straight into its typed parameters, without building intermediate 
+// functions. A callable taking a single atom receives the whole argument 
+// list, the same as an fl::function, which is returned as is and clone()d if 
+// it is not an rvalue. Use curry() for partial application.
+inline function to_fl_function(const function& f){ return f.clone(); }
+inline function to_fl_function(function& f){ return f.clone(); }
 
-        context& operator=(context&& rhs)
-        {
-            value = std::move(rhs.value);
-            caf = std::move(rhs.caf);
-            return *this;
-        }
+inline function to_fl_function(function&& f){ return std::move(f); }
 
-        std::any value;
+namespace detail {
+// true for the callables an atom stores as an fl::function: functions, 
+// function pointers and function objects with a single operator()
+template <typename T, typename = void>
+struct is_callable : std::is_function<typename std::remove_pointer<T>::type> {};
 
-        // the function pointer stored here knows what the stored type of value 
-        // is, allowing sane/correct comparison
-        detail::compare_atom_function caf;
-    };
+template <typename T>
+struct is_callable<T, decltype((void)&T::operator())> : std::true_type {};
 
-    mutable std::shared_ptr<atom_context> ctx;
+// true for the atom_cast() targets through which the value may be modified
+template <typename T>
+struct is_writing_cast : 
+    std::integral_constant<bool, 
+                           std::is_reference<T>::value && 
+                           !std::is_const<typename std::remove_reference<T>::type>::value> {};
 
-    std::shared_ptr<atom_context> make_atom_context(T&& t, std::true_type) const
-    {
-        auto f = to_fl_function(std::forward<T>(t));
-        return std::make_shared<context>(std::move(f),compare_atom_function__<>);
-    }
+// the type an atom stores a T as
+template <typename T>
+using stored_type = typename std::conditional<is_callable<unqualified<T>>::value,
+                                              function,
+                                              unqualified<T>>::type;
+}
 
-    std::shared_ptr<atom_context> make_atom_context(T&& t, std::false_type) const
-    {
-        return std::make_shared<context>(std::forward<T>(t),compare_any_function__<T>);
-    }
+template <typename F>
+function to_fl_function(F&& f)
+{
+    using fn = detail::unqualified<F>;
+    using sig = typename detail::signature_of<
+        typename std::remove_pointer<fn>::type>::type;
+    return detail::make_invoker(fn(std::forward<F>(f)), static_cast<sig*>(nullptr));
+}
 
-    friend class print_map;
-};
+namespace detail {
+// true if a callable modifies a typed argument through a mutable reference, 
+// which throws fl::frozen_error when the argument is frozen. fl::functions 
+// are opaque and assumed not to.
+template <typename F>
+struct writes_arguments : 
+    writes_arguments<typename signature_of<typename std::remove_pointer<F>::type>::type> {};
 
-inline atom nil(){ return atom(); }
-inline bool is_nil(atom a){ return a.is_nil(); }
-template <typename T> bool is(atom a){ return a.is<T>(); }
-template <typename T> T atom_cast(){ return a.atom_cast<T>(); }
-template <typename T> const T& value(atom a){ return a.value<T>(); }
+template <typename R, typename... As>
+struct writes_arguments<R(As...)> : 
+    std::disjunction<std::integral_constant<bool, param<As>::writes>...> {};
 
-inline bool equalv(atom lhs, atom rhs){ return lhs.equalv(rhs); }
-template <typename T> bool equalv(atom lhs, T&& rhs){ return equalv(lhs, atom(std::forward<T>(rhs))); }
-template <typename T> bool equalv(T&& lhs, atom rhs){ return equalv(atom(std::forward<T>(lhs),rhs)); }
-template <typename T, typename T2> bool equalv(T&& lhs, T2&& rhs)
-{ 
-    return equalv(atom(std::forward<T>(lhs)),atom(std::forward<T2>(rhs))); 
+template <> struct writes_arguments<function> : std::false_type {};
 }
 
-inline bool equalp(atom lhs, atom rhs){ return lhs.equalp(rhs); }
-inline atom copy(atom a){ return a.copy(); }
-template <typename T> inline atom copy(T&& t){ return atom(std::forward<T>(t)); }
-template <typename T> void set(atom a, T&& t){ a.set(std::forward<T>(t)); }
-template <typename T> T&& extract(atom a){ return a.extract<T>(); }
+
 
 
 //-----------------------------------------------------------------------------
-// cons_cell 
+// symbol
+//
+// A symbol is a name interned in a global, concurrent symbol table. All 
+// symbols constructed from the same name refer to the same table entry, so 
+// comparing two symbols is a single pointer compare regardless of the length 
+// of the name. Symbols are ideal keys for association lists and for naming 
+// values in expression trees.
 
 namespace detail {
-class cons_cell 
+class symbol_table
 {
+public:
+    static symbol_table& instance();
+
+    // returns the unique, never freed, table entry for name
+    inline const std::string* intern(const std::string& name)
+    {
+        shard& sh = shards_[std::hash<std::string>()(name) % shard_count];
+        std::unique_lock<std::mutex> lk(sh.mtx);
+        return &(*(sh.names.insert(name).first));
+    }
+
 private:
-    const atom car;
-    const atom cdr;
+    // the table is split into independently locked shards so concurrent 
+    // interning of unrelated names rarely contends
+    static constexpr size_t shard_count = 16;
+
+    struct shard
+    {
+        std::mutex mtx;
+        std::unordered_set<std::string> names; // node based, entries never move
+    };
+
+    shard shards_[shard_count];
+};
+}
 
+class symbol
+{
 public:
-    cons_cell(){}
-    cons_cell(const atom& a) : car(a) {}
-    cons_cell(const atom& a, const atom& b) : car(a), cdr(b) {}
-    cons_cell(atom&& a) : car(std::move(a)) {}
-    cons_cell(atom&& a, atom&& b) : car(std::move(a)), cdr(std::move(b)) {}
-    cons_cell(const atom& a, atom&& b) : car(a), cdr(std::move(b)) {}
-    cons_cell(atom&& a, const atom& b) : car(std::move(a)), cdr(b) {}
+    inline symbol() : name_(detail::symbol_table::instance().intern(std::string())) {}
+    inline symbol(const char* name) : name_(detail::symbol_table::instance().intern(name)) {}
+    inline symbol(const std::string& name) : name_(detail::symbol_table::instance().intern(name)) {}
+    inline symbol(const symbol& rhs) : name_(rhs.name_) {}
 
-    // Return a copy of internal car/cdr. 
-    atom car() const { return atom(car); }
-    atom cdr() const { return atom(cdr); }
+    inline symbol& operator=(const symbol& rhs)
+    {
+        name_ = rhs.name_;
+        return *this;
+    }
 
-    // returns true if cons_cell is nil, else false
-    bool operator bool() const { return a.car || a.cdr; }
-    bool operator==(const cons_cell& rhs) const { return equalv(car,rhs.car) && equalv(cdr,rhs.cdr); }
-    bool operator==(cons_cell&& rhs) const { return equalv(car,rhs.car) && equalv(cdr,rhs.cdr); };
-}
+    inline const std::string& name() const { return *name_; }
 
-template <typename A, typename B>
-inline atom cons(A&& a, B&& b)
-{ 
-    return atom(detail::cons_cell(atom(std::forward<A>(a)), 
-                                  atom(std::forward<B>(b)))); 
+    inline bool operator==(const symbol& rhs) const { return name_ == rhs.name_; }
+    inline bool operator!=(const symbol& rhs) const { return name_ != rhs.name_; }
+
+private:
+    const std::string* name_;
+
+    friend struct std::hash<symbol>;
+};
+} // end fl
+
+namespace std {
+template <>
+struct hash<fl::symbol>
+{
+    size_t operator()(const fl::symbol& s) const { return std::hash<const std::string*>()(s.name_); }
+};
 }
 
-inline bool is_cons(atom a){ return is<detail::cons_cell>(a); }
-inline atom car(atom a){ return value<detail::cons_cell>(a).car(); }
-inline atom cdr(atom a){ return value<detail::cons_cell>(a).cdr(); }
+namespace fl {
 
 
 
 //-----------------------------------------------------------------------------
-// list  
-namespace detail {
-template <typename A>
-atom list_(A&& a){ return cons(std::forward<A>(a),nil()); }
+// atom  
 
-template <typename A, typename... As>
-atom list_(A&& a, As&&... as)
-{
-    return cons(std::forward<A>(a), list_(std::forward<As>(as)...));
-}
-} // end detail
+class atom;
+class pvector;
+class pmap;
 
-template <typename T, typename... Ts>
-atom list(T&& t, Ts&&... Ts)
+// how a thread frees atoms whose last reference it dropped, see 
+// set_reclaim_mode()
+enum class reclaim_mode
 {
-    return detail::list_(std::forward<T>(t),std::forward<Ts>(ts)...);
-}
+    immediate, // free everything before returning
+    sliced, // free at most a slice of contexts per release, queue the rest
+    background // free a slice, hand the rest to the background reclaimer
+};
 
-struct list_info
+namespace detail {
+class print_map;
+template <typename T> class register_type; 
+template <typename T> class intern_table;
+inline size_t hash_leaf(atom a);
+inline bool equal_cons(atom a, atom b);
+class cons_cell;
+class run_builder;
+struct run_cells;
+class tree_copier;
+inline atom cow_share(atom a);
+
+// atom_context state flags
+enum context_flag : unsigned char
 {
-    bool is_list;
-    size_t length;
-    list_info(){}
-    list_info(bool in_is_list, size_t in_length) : 
-        is_list(in_is_list), 
-        length(in_length)
-    {}
+    interned_flag = 1, // context is shared through an intern table
+    local_flag = 2, // context is confined to its thread, see local_scope
+    arena_flag = 4, // context is allocated in an arena, see fl::arena
+    cow_flag = 8, // context is shared copy-on-write, see cow_copy()
+    frozen_flag = 16, // context is immutable, see freeze()
+    run_flag = 32, // context is a cell of a list_run
+    pure_flag = 64, // context holds a pure function, see pure()
+    shared_flag = 128 // context and all reachable from it are shared, see share()
 };
 
-inline list_info inspect_list(atom a)
+// count of local_scopes alive on the current thread
+size_t& local_scope_depth();
+
+// count of list_runs invalidated so far, see list_run::length()
+std::atomic<size_t>& run_invalidations();
+
+// Bump allocator backing fl::arena. Memory is carved from large blocks aligned 
+// to their own size so the owning arena_state of any allocation is found by 
+// masking its address. The state counts live allocations plus one reference 
+// held by the open arena, whoever drops the count to zero frees every block at
+// once.
+class arena_state
 {
-    size_t sz=0;
-   
-    while(true)
+public:
+    static constexpr size_t block_size = 64*1024;
+    static constexpr size_t alignment = alignof(std::max_align_t);
+
+    inline arena_state() : live_(1), head_(nullptr), cur_(nullptr), end_(nullptr) {}
+
+    inline ~arena_state()
     {
-        if(is_cons(a))
+        while(head_)
         {
-            detail::cons_cell& p = value<detail::cons_cell>(a);
-            if(p)
-            { 
-                ++sz;
-                a = a.cdr; 
-            }
-            else{ return list_info(true,sz); } // is list
+            block_header* next = head_->next;
+            ::operator delete(head_, std::align_val_t(block_size));
+            head_ = next;
         }
-        else{ return list_info(false,sz); }
     }
-}
-
-inline bool is_list(atom a){ return inspect_list(a).is_list; }
-inline size_t length(atom a){ return inspect_list(a).length; }
 
-// cons access 
-inline atom head_cons(atom lst){ return lst }
-inline atom tail_cons(atom lst)
-{
-    atom ret = lst;
-    while(lst)
-    { 
-        ret = lst;
-        lst = cdr(lst):
+    // only called by the thread which owns the open arena
+    inline void* allocate(size_t sz)
+    {
+        sz = (sz + alignment - 1) & ~(alignment - 1);
+        if(size_t(end_ - cur_) < sz){ new_block(); }
+        void* p = cur_;
+        cur_ += sz;
+        live_.fetch_add(1, std::memory_order_relaxed);
+        return p;
     }
-    return ret;
-}
 
-// return the cons cell in a list at index position n
-inline atom nth_cons(atom lst, size_t n)
-{ 
-    while(n)
+    // may be called from any thread 
+    inline void release()
     {
-        --n;
-        lst = cdr(lst);
+        if(live_.fetch_sub(1, std::memory_order_acq_rel) == 1){ delete this; }
     }
-    return lst;
-}
-
-// element access
-inline atom head(atom lst){ return car(lst); }
-inline atom tail(atom lst){ return car(tail_cons(lst)); }
 
-// return the element in a list at index n
-inline atom nth(atom lst, size_t n){ return car(nth_cons(lst,n)); }
+    inline size_t live() const { return live_.load(std::memory_order_relaxed) - 1; }
 
-// given a list, return a list in reverse order
-inline atom reverse(atom lst)
-{
-    if(is_nil(lst)){ return lst; }
-    else 
+    static inline arena_state* owner(const void* p)
     {
-        atom ret = cons(car(lst),nil());
-        lst = cdr(lst);
-        while(!is_nil(lst))
-        {
-            ret = cons(car(lst),ret); // build ret in reverse
-            lst = cdr(lst);
-        }
-        return ret;
+        std::uintptr_t b = reinterpret_cast<std::uintptr_t>(p) & ~(block_size - 1);
+        return reinterpret_cast<block_header*>(b)->owner;
     }
-}
 
-/*
-// return a value copy of a list
-inline atom copy_list(atom lst)
-{
-    atom ret; // nil
-    atom cur = ret;
-    if(is_nil(lst)){ return meta_list(ret,cur,0); } 
-    else 
+private:
+    struct block_header
     {
-        atom ret = cons(copy(car(lst)), copy(cdr(lst)));
-        atom cur = cdr(ret);
-        lst = cdr(lst);
-        while(!is_nil(lst))
-        {
-            cur = cons(copy(car(lst)), copy(cdr(lst)));
-            cur = cdr(cur);
-            lst = cdr(lst);
-        }
-        copy(cdr(cur),nil());
-        return ret;
-    }
-}
-*/
+        arena_state* owner;
+        block_header* next;
+    };
 
-// copies any structure composed of cons_cells and any other atom 
-namespace detail {
-inline atom copy_tree(atom& ret, atom lst)
-{
-    if(is_cons(lst))
+    inline void new_block()
     {
-        ret = cons(copy(car(lst)),copy(cdr(lst)));
-        copy_tree(car(ret),car(lst));
-        copy_tree(cdr(ret),cdr(lst));
+        void* mem = ::operator new(block_size, std::align_val_t(block_size));
+        block_header* b = static_cast<block_header*>(mem);
+        b->owner = this;
+        b->next = head_;
+        head_ = b;
+        size_t header_sz = (sizeof(block_header) + alignment - 1) & ~(alignment - 1);
+        cur_ = static_cast<char*>(mem) + header_sz;
+        end_ = static_cast<char*>(mem) + block_size;
     }
-    else{ ret = copy(lst); }
-}
-}
 
-inline atom copy_tree(atom lst)
-{
-    atom ret;
-    detail::copy_tree(ret,lst)
-    return ret;
-}
+    std::atomic<size_t> live_;
+    block_header* head_;
+    char* cur_;
+    char* end_;
+};
 
+// the innermost open arena on the current thread, or nullptr
+arena_state*& current_arena();
 
-namespace detail {
-atom append_(atom lst1, atom lst2)
+// suspends the current arena so that allocations go to the heap
+class arena_suspend
 {
-    atom meta_lst = detail::copy_tree(lst1);
-    *(meta_lst.tail.a) = lst2; // do not make a copy of tail
-    return meta_lst.head;
+public:
+    inline arena_suspend() : prev_(current_arena()) { current_arena() = nullptr; }
+    inline ~arena_suspend(){ current_arena() = prev_; }
 
-}
+private:
+    arena_state* prev_;
+};
 
-template <typename... As>
-atom append_(atom lst1, atom lst2, As&&... as)
+// Fixed size block allocator backing every atom_context allocated outside of 
+// an arena. Each thread keeps one free list per context size class and carves
+// new blocks from 64KB slabs, so allocating or freeing a list node is a couple
+// of pointer operations and neighbouring nodes share cache lines. A block may 
+// be freed by any thread, it simply joins the freeing thread's list. A thread
+// which frees more than max_free blocks, such as the consumer of a producer 
+// consumer pair, hands the surplus over to a global list, as do exiting 
+// threads with their whole list. The global list is drained before any new 
+// slab is allocated, so blocks flow back to the threads allocating them. 
+// Slabs are never returned to the system.
+class context_pool
 {
-    atom meta_lst = detail::copy_tree(lst1);
-    *(meta_lst.tail.a) = append_(lst2, as...);
-    return meta_lst.head;
-}
-}
+public:
+    static constexpr size_t slab_size = 64*1024;
 
-template <typename... As>
-atom append(atom a, atom b, As&&... as)
-{
-    return detail::append_(a,b,as);
-}
+    // blocks a thread keeps on its free list, half of them are handed to the 
+    // global list when it grows past this
+    static constexpr size_t max_free = 4096;
 
+    constexpr context_pool(size_t size_class) : free_(nullptr), count_(0), cls_(size_class) {}
 
-//TODO: need to implement the following list functions 
-/*
- list_with_tail: list* in racket
- build_list
- */
+    // the current thread's pool for blocks of the given size class
+    static context_pool& local(size_t size_class);
 
+    // block_sz must be the same for every call on a given pool
+    inline void* allocate(size_t block_sz)
+    {
+        if(!free_){ refill(block_sz); }
+        free_block* b = free_;
+        free_ = b->next;
+        --count_;
+        return b;
+    }
 
+    inline void deallocate(void* p)
+    {
+        free_block* b = static_cast<free_block*>(p);
+        b->next = free_;
+        free_ = b;
+        if(++count_ > max_free){ release(max_free / 2); }
+    }
 
-//-----------------------------------------------------------------------------
-// quote
-namespace detail {
-class quote{};
-}
+    // count of blocks on this thread's free list
+    inline size_t size() const { return count_; }
 
-inline atom quote(atom a){ return cons(atom(detail::quote()),a); }
-inline bool is_quote(atom a){ return is<detail::quote>(a); }
+    // hand the free list to the global list of this size class
+    void orphan();
 
-inline atom unquote(atom a)
-{
-    if(is_quote(car(a))
-    {
-        do{ a = cdr(a); } while(is_quote(car(a)));
-        return a;
-    }
-    else{ return a; }
-}
+    // count of slabs allocated by all pools
+    static size_t slabs();
 
+private:
+    struct free_block { free_block* next; };
 
+    void refill(size_t block_sz);
 
-//-----------------------------------------------------------------------------
-// eval 
+    // hand all but the first keep blocks to the global list
+    void release(size_t keep);
 
-// eval allows data to be treated as code, assuming that the given atom is a
-// fl::function to be executed. 
-inline atom eval(atom a)
-{ 
-    if(a && is<const function&>(a))
+    free_block* free_;
+    size_t count_;
+    size_t cls_;
+};
+
+// Per thread queue of atom_contexts whose last reference has been dropped but 
+// which are not destroyed yet. Destroying a context releases the atoms held 
+// by its value, and contexts reaching zero while another one is destroyed are
+// pushed here rather than destroyed recursively, so freeing a list of any 
+// length takes constant stack space. The outermost release drains the queue 
+// according to the thread's reclaim_mode. Like context_pool it is trivially 
+// destructible and stays usable while other thread_locals are destroyed.
+class reclaimer
+{
+public:
+    static constexpr size_t default_slice = 4096;
+
+    constexpr reclaimer() : 
+        draining(false), 
+        mode(reclaim_mode::immediate), 
+        slice(default_slice), 
+        destroy(nullptr),
+        items_(nullptr), 
+        size_(0), 
+        capacity_(0) 
+    {}
+
+    // the current thread's reclaimer
+    static reclaimer& local();
+
+    // false if the queue could not grow, the caller must then destroy c 
+    // itself
+    inline bool push(void* c)
     {
-        return value<const function&>(car(a))(cdr(a)); 
+        if(size_ == capacity_ && !grow()){ return false; }
+        items_[size_++] = c;
+        return true;
     }
-    else{ return a; }
-}
 
+    inline void* pop(){ return items_[--size_]; }
+    inline size_t size() const { return size_; }
 
-template <typename F, typename... Ts>
-inline atom eval(F&& f, Ts&&... ts)
-{ 
-    return eval(list(std::forward<F>(f),std::forward<Ts>(ts)...));
-}
+    // hand the queued contexts to the background reclaimer thread, keeping 
+    // those for which keep() is true
+    void hand_off(bool(*keep)(void*));
 
+    // free the queue's buffer, the queue must be empty
+    void release_storage();
 
+    bool draining; // true while a release on this thread is destroying
+    reclaim_mode mode;
+    size_t slice;
+    void(*destroy)(void*); // destroys a context, set by the first push
 
-//-----------------------------------------------------------------------------
-// atom printing 
+private:
+    bool grow();
 
+    void** items_;
+    size_t size_;
+    size_t capacity_;
+};
 
-namespace detail {
-class print_map
+// A list_run is a single allocation holding a header followed by consecutive 
+// cons cell contexts, the cdr of each cell being the next cell of the run. 
+// Lists built by list(), atomize_container() and the list algorithms are made 
+// of runs, which makes sequential scans cache friendly and lets length(), 
+// nth() and tail() skip over a run in constant time instead of following 
+// every cdr. Each cell records its index in the run, so the run of any cell 
+// is found from its address. Modifying a cell in place marks its run stale, 
+// which drops the cached information of that run and of every list flowing 
+// into it. Like arena_state the run counts its live cells 
+// plus one reference held by its builder, and frees itself when both are gone.
+class list_run
 {
 public:
-    print_map& instance();
-    
-    inline std::pair<std::string,std::string> get_value_info(atom a)
-    {
-        std::unique_lock<std::mutex> lk(mtx_);
-        auto& vi = type_map_[get_std_type_name(a)];
-        return std::pair<std::string,std::string>(vi.name,vi.pr(a));
-    }
+    static constexpr size_t max_cells = 0xFFFF; // cell indexes are 16 bit
+    static constexpr size_t npos = size_t(-1);
 
-    inline std::string get_type(atom a)
+    static inline list_run* make(size_t capacity, size_t stride, size_t offset)
     {
-        std::unique_lock<std::mutex> lk(mtx_);
-        return type_map_[get_std_type_name(a)].name;
+        void* mem = ::operator new(header_size() + capacity*stride);
+        return new(mem) list_run(capacity, stride, offset);
     }
 
-    inline std::string get_value(atom a)
+    static constexpr size_t header_size()
     {
-        std::unique_lock<std::mutex> lk(mtx_);
-        return type_map_[get_std_type_name(a)].pr(a_ref);
+        return (sizeof(list_run) + alignof(std::max_align_t) - 1) & 
+               ~(alignof(std::max_align_t) - 1);
     }
 
-private:
-    typedef std::function<std::string(std::any&)> value_printer;
-
-    std::mutex mtx_;
-    std::unordered_map<std::string,value_info> type_map_;
-
-    struct value_info
-    {
-        std::string name;
-        value_printer vp;
-    };
-
-    std::string get_std_type_name(atom a){ return a.ctx->value.type().name(); }
-   
-    //integral to_string conversion
-    template <typename T,
-              typename = std::enable_if_t<std::is_integral<T>::value>>
-    value_printer make_value_printer(T& t)
+    static inline list_run* owner(const void* cell, size_t index, size_t stride)
     {
-        value_printer vp = [](std::any& a) -> std::string 
-        {
-            const auto& v = std::static_cast<const T&>(a);
-            return std::to_string(v);
-        };
-        return vp;
+        return reinterpret_cast<list_run*>(
+            const_cast<char*>(static_cast<const char*>(cell)) - index*stride - header_size());
     }
-   
-    //float to_string conversion
-    template <typename T,
-              typename = std::enable_if_t<std::is_floating_point<T>::value>>
-    value_printer make_value_printer(T& t)
+
+    inline void* cell(size_t index)
     {
-        value_printer vp = [](std::any& a) -> std::string 
-        {
-            const auto& v = std::static_cast<const T&>(a);
-            return std::to_string(v);
-        };
-        return vp;
+        return reinterpret_cast<char*>(this) + header_size() + index*stride_;
     }
 
-    //direct string conversion
-    value_printer make_value_printer(const std::string& t)
+    inline void retain(){ live_.fetch_add(1, std::memory_order_relaxed); }
+
+    inline void release()
     {
-        value_printer vp = [](std::any& a) -> std::string 
+        if(live_.fetch_sub(1, std::memory_order_acq_rel) == 1)
         {
-            const auto& v = std::static_cast<const std::string&>(a);
-            return std::string("\"")+std::string(v)+std::string("\"");
-        };
-        return vp;
+            this->~list_run();
+            ::operator delete(this);
+        }
     }
 
-    value_printer make_value_printer(const char* t)
-    {
-        value_printer vp = [](std::any& a) -> std::string 
+    // true if the cached size and positions of this run are valid
+    inline bool current() const { return current_.load(std::memory_order_acquire); }
+
+    // called before a cell of this run is modified in place
+    inline void invalidate()
+    { 
+        if(current() && current_.exchange(false, std::memory_order_acq_rel))
         {
-            const auto& v = std::static_cast<const char*>(a);
-            return std::string("\"")+std::string(v)+std::string("\"");
-        };
-        return vp;
+            run_invalidations().fetch_add(1, std::memory_order_release);
+        }
     }
 
-    // address only
-    template <typename T>
-    value_printer make_value_printer(T& t)
-    {
-        value_printer vp = [](std::any& a) -> std::string 
+    // count of cells constructed in this run
+    inline size_t size() const { return size_; }
+    inline size_t capacity() const { return capacity_; }
+
+    // count of cells before this run in the list it was built for
+    inline size_t offset() const { return offset_; }
+
+    // length of the list starting at the first cell of this run, npos if the 
+    // list is not nil terminated or a run it flows into is no longer current.
+    // The runs the list flows through are only checked again after some run 
+    // was invalidated, otherwise this is constant time.
+    inline size_t length() const 
+    { 
+        size_t epoch = run_invalidations().load(std::memory_order_acquire);
+        if(checked_.load(std::memory_order_relaxed) != epoch)
         {
-            size_t p = (void*)&(std::any_cast<const T&>(a));
-            std::stringstream ss;
-            ss << std::hex << p;
-            return std::string(ss.str());
-        };
-        return vp;
+            for(const list_run* r = this; r; r = r->successor_)
+            {
+                if(!r->current()){ return npos; }
+            }
+            checked_.store(epoch, std::memory_order_relaxed);
+        }
+        return length_; 
     }
 
-    template <typename T> 
-    void register_type(const char* name)
-    { 
-        unqualified<T> t;
-        std::any a(t);
-        std::string std_type_name = a.type().name();
+private:
+    inline list_run(size_t capacity, size_t stride, size_t offset) : 
+        live_(1), 
+        current_(false), 
+        capacity_(capacity), 
+        size_(0),
+        stride_(stride),
+        offset_(offset),
+        length_(npos),
+        checked_(npos),
+        successor_(nullptr),
+        next_(nullptr)
+    { }
+
+    std::atomic<size_t> live_;
+    std::atomic<bool> current_;
+    size_t capacity_;
+    size_t size_;
+    size_t stride_;
+    size_t offset_;
+    size_t length_;
+    // run_invalidations() when the runs the list flows through were last 
+    // found current
+    mutable std::atomic<size_t> checked_;
+    // the run the list continues in after the last cell of this run, kept 
+    // alive by the cdr of that cell while this run is current
+    list_run* successor_;
+    list_run* next_; // next run of the same builder, only used while building
+
+    friend class run_builder;
+};
 
-        std::unique_lock<std::mutex> lk(mtx_); 
+// compile-time type ids
+//
+// Every type storable in an atom is identified by the address of a per-type 
+// static tag. The address is fixed at link time, so a type test is a single
+// integer compare and never requires RTTI or exceptions.
+typedef const void* type_id;
 
-        // don't modify an already registered type
-        auto it = type_map_.find(std_type_name);
-        if(it == type_map_.end())
-        {
-            value_info vi;
-            vi.name = std::string(name);
-            vi.pr = make_value_printer(t);
-            type_map_[std_type_name] = std::move(vi);
+template <typename T>
+struct type_tag { static const char id; };
+
+template <typename T>
+const char type_tag<T>::id = 0;
+
+template <typename T>
+constexpr type_id get_type_id(){ return &type_tag<unqualified<T>>::id; }
+
+// value comparison, types without an operator== are only equal to themselves
+template <typename T>
+auto compare_value(const T& a, const T& b, int) -> decltype(bool(a == b)) 
+{ 
+    return a == b; 
+}
+
+template <typename T>
+bool compare_value(const T& a, const T& b, long){ return &a == &b; }
+
+// value hashing, consistent with compare_value(): std::hash when available, a 
+// constant for types that are only comparable with ==, and the address for 
+// types compared by identity
+template <typename T>
+auto hash_value(const T& v, int, int) -> decltype(size_t(std::hash<T>()(v)))
+{
+    return std::hash<T>()(v);
+}
+
+template <typename T>
+auto hash_value(const T& v, int, long) -> decltype(bool(v == v), size_t())
+{
+    return 0;
+}
+
+template <typename T>
+size_t hash_value(const T& v, long, long){ return std::hash<const void*>()(&v); }
+
+// integral and float formatting with std::to_chars into [first,last), 
+// returns the end of the formatted value, nullptr if it does not fit
+template <typename T>
+char* format_value(const T& v, char* first, char* last, std::true_type)
+{
+    // integers are widened, std::to_chars only accepts the standard integer 
+    // types
+    typedef typename std::conditional<
+        std::is_floating_point<T>::value,
+        T,
+        typename std::conditional<std::is_signed<T>::value, 
+                                  long long, 
+                                  unsigned long long>::type>::type F;
+    std::to_chars_result r = std::to_chars(first, last, F(v));
+    return r.ec == std::errc() ? r.ptr : nullptr;
+}
+
+// as std::to_string()
+inline char* format_value(const bool& v, char* first, char* last, std::true_type)
+{
+    if(first == last){ return nullptr; }
+    *first = v ? '1' : '0';
+    return first + 1;
+}
+
+// everything else is printed with print_value()
+template <typename T>
+char* format_value(const T&, char*, char*, std::false_type){ return nullptr; }
+
+//integral and float to_string conversion
+template <typename T>
+std::string print_value(const T& v, std::true_type)
+{
+    char buf[64];
+    char* end = format_value(v, buf, buf + sizeof(buf), std::true_type());
+    return end ? std::string(buf, end) : std::to_string(v);
+}
+
+//direct string conversion
+inline std::string print_value(const std::string& v, std::false_type)
+{
+    return std::string("\"")+v+std::string("\"");
+}
+
+inline std::string print_value(const char* const& v, std::false_type)
+{
+    return std::string("\"")+std::string(v)+std::string("\"");
+}
+
+// symbols print as their bare name
+inline std::string print_value(const symbol& v, std::false_type){ return v.name(); }
+
+// pvectors and pmaps print their elements, defined with the types
+inline std::string print_value(const pvector& v, std::false_type);
+inline std::string print_value(const pmap& m, std::false_type);
+
+// address only
+template <typename T>
+std::string print_value(const T& v, std::false_type)
+{
+    std::stringstream ss;
+    ss << std::hex << (size_t)&v;
+    return std::string(ss.str());
+}
+
+// small value storage
+//
+// An atom_context stores its value in an inline buffer instead of an std::any. 
+// Any value that fits the buffer (scalars, short std::strings, cons_cells, 
+// quote tags) is constructed in place, and because the reference count is 
+// stored in the atom_context itself the count, the context and the value share
+// a single allocation. Values that do not fit are boxed in a separate heap 
+// allocation.
+//
+// Contexts come in three size classes. The buffer of the smaller cell class is
+// exactly large enough for a cons_cell, making a list node a 32 byte block 
+// holding its header, car and cdr. Scalars use the same class. Larger values 
+// such as std::strings use the small value class, and values up to the size 
+// of an fl::function with the default inline capacity use the large value 
+// class. Anything larger is boxed in a small value context.
+constexpr size_t small_value_capacity = 4*sizeof(void*);
+constexpr size_t large_value_capacity = 8*sizeof(void*);
+
+#ifdef FL_CONS_HASH_CACHE
+constexpr size_t cell_value_capacity = 4*sizeof(void*); // room for the cached hash
+#else
+constexpr size_t cell_value_capacity = 2*sizeof(void*);
+#endif
+
+template <typename T, size_t CAPACITY=small_value_capacity>
+struct is_small_value :
+    std::integral_constant<bool,
+                           sizeof(T) <= CAPACITY &&
+                           alignof(T) <= alignof(std::max_align_t) &&
+                           std::is_nothrow_move_constructible<T>::value>
+{ };
+
+// the buffer capacity of the context class a new value of type T is stored in
+template <typename T>
+constexpr size_t value_capacity()
+{
+    return is_small_value<T,cell_value_capacity>::value 
+           ? cell_value_capacity 
+           : (!is_small_value<T>::value && is_small_value<T,large_value_capacity>::value 
+              ? large_value_capacity 
+              : small_value_capacity);
+}
+
+// the name a type was registered with, see register_type. Each type has its 
+// own slot, written once by the first registration and read without locking.
+template <typename T>
+struct type_name { static std::atomic<const std::string*> value; };
+
+template <typename T>
+std::atomic<const std::string*> type_name<T>::value(nullptr);
+
+// the name a type is registered under when it is first stored in an atom: 
+// the type as spelled in C++ for the fundamental types, std::string and 
+// fl::function, otherwise the demangled typeid name where the compiler can 
+// demangle it
+template <typename T>
+struct default_type_name 
+{ 
+    static std::string get()
+    {
+        const char* mangled = typeid(T).name();
+#if defined(__GNUG__)
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(mangled, nullptr, nullptr, &status);
+        if(status == 0 && demangled)
+        {
+            std::string n(demangled);
+            std::free(demangled);
+            return n;
+        }
+#endif
+        return mangled;
+    }
+};
+
+#define FL_DEFAULT_TYPE_NAME__(T) \
+    template <> struct default_type_name<T> { static std::string get(){ return #T; } }
+
+FL_DEFAULT_TYPE_NAME__(bool);
+FL_DEFAULT_TYPE_NAME__(char);
+FL_DEFAULT_TYPE_NAME__(signed char);
+FL_DEFAULT_TYPE_NAME__(unsigned char);
+FL_DEFAULT_TYPE_NAME__(short);
+FL_DEFAULT_TYPE_NAME__(unsigned short);
+FL_DEFAULT_TYPE_NAME__(int);
+FL_DEFAULT_TYPE_NAME__(unsigned int);
+FL_DEFAULT_TYPE_NAME__(long);
+FL_DEFAULT_TYPE_NAME__(unsigned long);
+FL_DEFAULT_TYPE_NAME__(long long);
+FL_DEFAULT_TYPE_NAME__(unsigned long long);
+FL_DEFAULT_TYPE_NAME__(float);
+FL_DEFAULT_TYPE_NAME__(double);
+FL_DEFAULT_TYPE_NAME__(long double);
+FL_DEFAULT_TYPE_NAME__(std::string);
+FL_DEFAULT_TYPE_NAME__(fl::function);
+
+#undef FL_DEFAULT_TYPE_NAME__
+
+// per-type table of the operations an atom needs on its stored value. Each 
+// atom_context points to the table of its current type, so type tests, value
+// access, comparison, printing and the type's name are all reached without 
+// RTTI or a lookup. Every type has two tables sharing one id and name, for 
+// values stored inline and boxed.
+struct type_vtable
+{
+    type_id id;
+    bool boxed;
+    void (*copy)(void* dst, const void* src);
+    void (*destroy)(void* storage);
+    bool (*compare)(const void* lhs, const void* rhs);
+    size_t (*hash)(const void* value);
+    atom (*intern)(const void* value); // nil when T has no intern_table
+    std::string (*print)(const void* value);
+    char* (*format)(const void* value, char* first, char* last); // see format_value()
+    std::atomic<const std::string*>* name;
+};
+
+template <typename T, bool INLINE>
+struct value_storage;
+
+// value constructed directly in the inline buffer
+template <typename T>
+struct value_storage<T,true>
+{
+    template <typename... As>
+    static void construct(void* storage, As&&... as)
+    {
+        new(storage) T(std::forward<As>(as)...);
+    }
+
+    static void copy(void* dst, const void* src)
+    {
+        new(dst) T(copy_of(*static_cast<const T*>(src)));
+    }
+
+    static void destroy(void* storage){ static_cast<T*>(storage)->~T(); }
+};
+
+// value boxed on the heap, the inline buffer holds the pointer
+template <typename T>
+struct value_storage<T,false>
+{
+    template <typename... As>
+    static void construct(void* storage, As&&... as)
+    {
+        *static_cast<T**>(storage) = new T(std::forward<As>(as)...);
+    }
+
+    // store a value which was already allocated
+    static void adopt(void* storage, T* p){ *static_cast<T**>(storage) = p; }
+
+    static void copy(void* dst, const void* src)
+    {
+        *static_cast<T**>(dst) = new T(copy_of(**static_cast<T* const*>(src)));
+    }
+
+    static void destroy(void* storage){ delete *static_cast<T**>(storage); }
+};
+
+template <typename T>
+struct type_functions
+{
+    static bool compare(const void* lhs, const void* rhs)
+    {
+        return compare_value(*static_cast<const T*>(lhs), 
+                             *static_cast<const T*>(rhs), 
+                             0);
+    }
+
+    static size_t hash(const void* value)
+    {
+        return hash_value(*static_cast<const T*>(value), 0, 0);
+    }
+
+    static atom intern(const void* value); // defined with intern_table
+
+    static std::string print(const void* value)
+    {
+        return print_value(*static_cast<const T*>(value), 
+                           std::is_arithmetic<T>());
+    }
+
+    static char* format(const void* value, char* first, char* last)
+    {
+        return format_value(*static_cast<const T*>(value), 
+                            first, 
+                            last, 
+                            std::is_arithmetic<T>());
+    }
+};
+
+// the vtable is constant initialized, so fetching it never needs a guard
+template <typename T, bool INLINE>
+struct vtable_for { static const type_vtable value; };
+
+template <typename T, bool INLINE>
+const type_vtable vtable_for<T,INLINE>::value = {
+    get_type_id<T>(),
+    !INLINE,
+    value_storage<T,INLINE>::copy,
+    value_storage<T,INLINE>::destroy,
+    type_functions<T>::compare,
+    type_functions<T>::hash,
+    type_functions<T>::intern,
+    type_functions<T>::print,
+    type_functions<T>::format,
+    &type_name<T>::value
+};
+}
+
+// registers T under its spelling in the source, the first registration of a 
+// type wins, so this must run before a T is first stored to take effect
+#define REGISTER_TYPE__(T) detail::register_type<T>(#T)
+
+// thrown when a frozen atom is modified, see freeze()
+class frozen_error : public std::logic_error
+{
+public:
+    frozen_error() : std::logic_error("fl::atom is frozen") {}
+};
+
+
+class atom 
+{
+public:
+    atom(){}
+    atom(const atom& rhs) : ctx(rhs.ctx) {}
+    atom(atom&& rhs) noexcept : ctx(std::move(rhs.ctx)) {}
+
+    // the list of the arguments, see arg_span
+    atom(const arg_span& args);
+    atom(arg_span& args);
+    atom(arg_span&& args);
+
+    // atoms of any qualification are copied or moved, never wrapped
+    template <typename T, typename = detail::not_atom<T>>
+    atom(T&& t){ set(std::forward<T>(t)); }
+
+    // compare atom's real typed T values with the == operator, dispatched 
+    // through the stored type's vtable. cons structures are compared 
+    // iteratively, see hash().
+    inline bool equalv(atom b) const 
+    { 
+        if(equalp(b)){ return true; } // includes nil and shared interned values
+        else if(is_nil() || b.is_nil()){ return false; }
+        else if(ctx->id() != b.ctx->id()){ return false; }
+        // equal interned values always share a context
+        else if(ctx->has(detail::interned_flag) && b.ctx->has(detail::interned_flag)){ return false; }
+        else if(is<detail::cons_cell>()){ return detail::equal_cons(*this, b); }
+        else{ return ctx->vt->compare(ctx->data(), b.ctx->data()); }
+    }
+
+    // allows direct value comparison such as:
+    // a.equalv(3);
+    // a.equalv("hello world");
+    template <typename T>
+    inline bool equalv(T&& t) const { return equalv(atom(std::forward<T>(t))); }
+
+    bool operator==(const atom& rhs) const { return equalv(rhs); }
+    template <typename T> bool operator==(T&& rhs) const { return equalv(atom(std::forward<T>(rhs))); }
+
+    inline bool equalp(const atom& b) const { return ctx.get() == b.ctx.get(); }
+
+    // atom_cast(), set() and extract() allow modification of the underlying 
+    // value context. Modifying this will modify *ALL* atoms that have 
+    // copies of the context. They throw fl::frozen_error if the atom has been 
+    // freeze()d.
+
+    // cast the atom's value. This is the most flexible and most dangerous 
+    // way to get the value from an atom. Like std::any_cast it allows 
+    // returning mutable references of the stored value, and throws 
+    // std::bad_cast if the stored type does not match. Only casts to a 
+    // mutable reference are writes, casts to a value or a const reference 
+    // neither detach copy-on-write contexts nor throw fl::frozen_error.
+    template <typename T>
+    T atom_cast()
+    { 
+        if(detail::is_writing_cast<T>::value){ prepare_write(true); }
+        return static_cast<T>(*(ctx->template get<detail::unqualified<T>>())); 
+    }
+
+    // get atom's value as a const reference to the specified type
+    template <typename T> 
+    const detail::unqualified<T>& 
+    value() const { return *(ctx->template get<detail::unqualified<T>>()); }
+
+    // set() is capable of changing the underlying stored type, not just the 
+    // stored value.
+    
+    // c-string variant to ensure we can compare with std::string
+    void set(const char* t){ set(std::string(t)); }
+
+    // the new value is constructed in place in the existing context, no 
+    // allocation occurs unless the value is too large for small value storage
+    // callables are stored as an fl::function. Storing a type for the first 
+    // time registers its name, see detail::default_type_name.
+    template <typename T> 
+    void set(T&& t) 
+    { 
+        typedef detail::stored_type<T> S;
+        static const detail::register_type<S> registered(
+            detail::default_type_name<S>::get().c_str());
+        (void)registered;
+        prepare_write(false);
+        bool shared = has_flag(detail::shared_flag);
+        if(!ctx){ ctx = context_ptr(atom_context::make(detail::value_capacity<S>())); }
+        emplace_value(std::forward<T>(t), detail::is_callable<detail::unqualified<T>>());
+
+        // atoms stored into a shared context are shared with it
+        if(shared)
+        {
+            ctx->clear(detail::shared_flag);
+            share(*this);
+        }
+    }
+
+    atom& operator=(const atom& rhs)
+    {
+        ctx = rhs.ctx;
+        return *this; 
+    }
+
+    atom& operator=(atom&& rhs)
+    {
+        ctx = std::move(rhs.ctx);
+        return *this; 
+    }
+
+    template <typename T, typename = detail::not_atom<T>>
+    atom& operator=(T&& rhs)
+    {
+        set(std::forward<T>(rhs));
+        return *this; 
+    }
+
+    // Returns an rvalue reference allowing code to use move semantics to 
+    // extract data from the internal context. This means that the data stored 
+    // in the context will be in a valid but unknown state.
+    template <typename T>
+    detail::unqualified<T>&& extract()
+    { 
+        prepare_write(true);
+        return std::move(*(ctx->template get<detail::unqualified<T>>())); 
+    }
+
+    // Make a deep copy of the current atom. A stored fl::function is clone()d,
+    // so copying an atom holding a move only callable throws std::logic_error.
+    inline atom copy() const
+    {
+        atom b;
+        if(ctx)
+        { 
+            b.ctx = context_ptr(atom_context::make(*ctx)); 
+            if(ctx->has(detail::pure_flag)){ b.ctx->set(detail::pure_flag); } // the same function
+        }
+        return b;
+    }
+
+    // Make a copy-on-write copy of the current atom in O(1). The returned atom 
+    // shares this atom's context until either is modified with set(), 
+    // extract() or a writing atom_cast(), at which point the modifying atom 
+    // receives its own context. 
+    //
+    // The copy-on-write mark belongs to the shared context, so it is only 
+    // set while this atom is the context's sole owner. A context already 
+    // shared with plain copies of this atom is copied instead, as marking it
+    // would change what modifying those copies does.
+    inline atom cow_copy() const
+    {
+        if(!ctx || ctx->has(detail::frozen_flag) || ctx->has(detail::cow_flag)){ return *this; }
+        if(ctx->refs.load(std::memory_order_acquire) > 1){ return copy(); }
+        ctx->set(detail::cow_flag);
+        return *this;
+    }
+
+    inline bool is_nil() const { return ctx ? false : true; }
+
+    // constant time type test, never throws
+    template <typename T>
+    bool is() const 
+    { 
+        return ctx && ctx->id() == detail::get_type_id<T>(); 
+    }
+
+    // returns true if atom has a value, else false
+    inline explicit operator bool() const { return !is_nil(); }
+
+private:
+    // A 16 byte header followed by the inline value buffer, whose capacity is
+    // one of the size classes described at detail::small_value_capacity. 
+    // Contexts are only created by make() and freed by destroy().
+    struct alignas(std::max_align_t) atom_context 
+    {
+        explicit atom_context(unsigned char c) : vt(nullptr), refs(1), flags(0), cap(c), run_index(0) { }
+        atom_context(const atom_context& rhs) = delete;
+        atom_context& operator=(const atom_context& rhs) = delete;
+        ~atom_context(){ reset(); }
+
+        static constexpr size_t block_size(size_t capacity)
+        {
+            return (sizeof(atom_context) + capacity + alignof(std::max_align_t) - 1) & 
+                   ~(alignof(std::max_align_t) - 1);
+        }
+
+        static inline size_t size_class(size_t capacity)
+        {
+            return capacity == detail::cell_value_capacity 
+                   ? 0 
+                   : (capacity == detail::small_value_capacity ? 1 : 2);
+        }
+
+        // allocate a new empty context, confined to the current thread if a 
+        // local_scope is alive. Inside an arena the context is bump allocated 
+        // from the arena, and is thread local as the arena is. Otherwise it is
+        // taken from the current thread's context_pool.
+        static atom_context* make(size_t capacity)
+        {
+            atom_context* c;
+            detail::arena_state* ar = detail::current_arena();
+            if(ar)
+            {
+                void* mem = ar->allocate(block_size(capacity));
+                c = new(mem) atom_context((unsigned char)capacity);
+                c->set(detail::arena_flag);
+                c->set(detail::local_flag);
+            }
+            else 
+            {
+                detail::context_pool& pool = detail::context_pool::local(size_class(capacity));
+                void* mem = pool.allocate(block_size(capacity));
+                c = new(mem) atom_context((unsigned char)capacity);
+                if(detail::local_scope_depth()){ c->set(detail::local_flag); }
+            }
+            return c;
+        }
+
+        // allocate a context of equal capacity holding a copy of rhs's value
+        static atom_context* make(const atom_context& rhs)
+        {
+            atom_context* c = make(rhs.cap);
+            if(rhs.vt)
+            {
+                try{ rhs.vt->copy(c->storage(), rhs.storage()); }
+                catch(...)
+                {
+                    destroy(c);
+                    throw;
+                }
+                c->vt = rhs.vt;
+            }
+            return c;
+        }
+
+        // arena memory is not freed per context, only returned to its arena,
+        // the same goes for the cells of a list_run
+        static inline void destroy(atom_context* c)
+        {
+            if(c->has(detail::arena_flag))
+            {
+                detail::arena_state* ar = detail::arena_state::owner(c);
+                c->~atom_context();
+                ar->release();
+            }
+            else if(c->has(detail::run_flag))
+            {
+                detail::list_run* r = c->run();
+                c->~atom_context();
+                r->release();
+            }
+            else
+            { 
+                size_t cls = size_class(c->cap);
+                c->~atom_context();
+                detail::context_pool::local(cls).deallocate(c);
+            }
+        }
+
+        // Reference counting. Thread local contexts are only ever touched by 
+        // their owning thread and use plain loads and stores, all other 
+        // contexts use atomic read-modify-write operations.
+        inline void retain()
+        {
+            if(has(detail::local_flag))
+            { 
+                refs.store(refs.load(std::memory_order_relaxed) + 1, 
+                           std::memory_order_relaxed); 
+            }
+            else{ refs.fetch_add(1, std::memory_order_relaxed); }
+        }
+
+        static inline void release(atom_context* c)
+        {
+            bool last;
+            if(c->has(detail::local_flag))
+            {
+                unsigned int r = c->refs.load(std::memory_order_relaxed) - 1;
+                c->refs.store(r, std::memory_order_relaxed);
+                last = r == 0;
+            }
+            else{ last = c->refs.fetch_sub(1, std::memory_order_acq_rel) == 1; }
+
+            if(last){ reclaim(c); }
+        }
+
+        // destroy c and everything only it referenced without recursing
+        static inline void reclaim(atom_context* c)
+        {
+            detail::reclaimer& r = detail::reclaimer::local();
+            if(r.draining)
+            {
+                r.destroy = &destroy_erased;
+                if(!r.push(c)){ destroy(c); }
+            }
+            else
+            {
+                r.draining = true;
+                destroy(c);
+                drain(r, r.mode == reclaim_mode::immediate ? size_t(-1) : r.slice);
+                r.draining = false;
+            }
+        }
+
+        // destroy up to n queued contexts, then hand the rest to the 
+        // background reclaimer if the thread's mode asks for it
+        static inline void drain(detail::reclaimer& r, size_t n)
+        {
+            for(; n && r.size(); --n){ destroy(static_cast<atom_context*>(r.pop())); }
+            if(r.size() && r.mode == reclaim_mode::background){ r.hand_off(&is_local_erased); }
+        }
+
+        static void destroy_erased(void* c){ destroy(static_cast<atom_context*>(c)); }
+
+        // contexts confined to their thread are never handed to another
+        static bool is_local_erased(void* c)
+        { 
+            return static_cast<atom_context*>(c)->has(detail::local_flag); 
+        }
+
+        inline bool has(detail::context_flag f) const 
+        { 
+            return flags.load(std::memory_order_relaxed) & f; 
+        }
+
+        inline void set(detail::context_flag f)
+        { 
+            flags.fetch_or(f, std::memory_order_relaxed); 
+        }
+
+        inline void clear(detail::context_flag f)
+        { 
+            flags.fetch_and((unsigned char)~f, std::memory_order_relaxed); 
+        }
+
+        // replace any current value with a new one of type T constructed in 
+        // place, boxing it if it does not fit this context's buffer. The 
+        // arguments may refer to the current value, as in a.set(a.value<T>()),
+        // so it is only destroyed once the new value has been constructed.
+        template <typename T, typename... As>
+        void emplace(As&&... as)
+        {
+            if(fits<T>())
+            {
+                if(vt)
+                {
+                    T t(std::forward<As>(as)...);
+                    reset();
+                    detail::value_storage<T,true>::construct(storage(), std::move(t));
+                }
+                else{ detail::value_storage<T,true>::construct(storage(), std::forward<As>(as)...); }
+                vt = &detail::vtable_for<T,true>::value;
+            }
+            else
+            {
+                T* p = new T(std::forward<As>(as)...);
+                reset();
+                detail::value_storage<T,false>::adopt(storage(), p);
+                vt = &detail::vtable_for<T,false>::value;
+            }
+        }
+
+        template <typename T>
+        inline bool fits() const
+        {
+            return cap == detail::cell_value_capacity 
+                   ? detail::is_small_value<T,detail::cell_value_capacity>::value
+                   : (cap == detail::small_value_capacity 
+                      ? detail::is_small_value<T>::value
+                      : detail::is_small_value<T,detail::large_value_capacity>::value);
+        }
+
+        inline void reset()
+        {
+            if(vt)
+            {
+                vt->destroy(storage());
+                vt = nullptr;
+            }
+        }
+
+        inline detail::type_id id() const { return vt ? vt->id : nullptr; }
+
+        // only valid if run_flag is set
+        inline detail::list_run* run() const
+        {
+            return detail::list_run::owner(this, run_index, block_size(cap));
+        }
+
+        inline unsigned char* storage() const 
+        { 
+            return reinterpret_cast<unsigned char*>(const_cast<atom_context*>(this + 1)); 
+        }
+
+        inline void* data() const 
+        { 
+            return vt->boxed ? *reinterpret_cast<void**>(storage()) : storage(); 
+        }
+
+        template <typename T>
+        T* get() const
+        {
+            if(id() == detail::get_type_id<T>())
+            { 
+                // values which fit the cell class, cons_cells included, are 
+                // never boxed and are read straight from the buffer
+                if(detail::is_small_value<T,detail::cell_value_capacity>::value)
+                {
+                    return reinterpret_cast<T*>(storage()); 
+                }
+                else{ return static_cast<T*>(data()); }
+            }
+            else{ throw std::bad_cast(); }
+        }
+
+        // the vtable stored here knows the stored type of the value, allowing 
+        // sane/correct comparison, access and printing
+        const detail::type_vtable* vt;
+
+        std::atomic<unsigned int> refs;
+
+        // detail::context_flag bits, not transferred by copy except pure_flag
+        std::atomic<unsigned char> flags;
+
+        // capacity of the value buffer following this header
+        const unsigned char cap;
+
+        // index of this cell in its list_run
+        unsigned short run_index;
+    };
+
+    // intrusive reference counted pointer to an atom_context, the count is 
+    // stored in the context itself so an atom is a single pointer
+    class context_ptr
+    {
+    public:
+        context_ptr() : p_(nullptr) {}
+        explicit context_ptr(atom_context* p) : p_(p) {} // adopts p's reference
+        context_ptr(const context_ptr& rhs) : p_(rhs.p_) { if(p_){ p_->retain(); } }
+        context_ptr(context_ptr&& rhs) noexcept : p_(rhs.p_) { rhs.p_ = nullptr; }
+        ~context_ptr(){ if(p_){ atom_context::release(p_); } }
+
+        context_ptr& operator=(const context_ptr& rhs)
+        {
+            context_ptr(rhs).swap(*this);
+            return *this;
+        }
+
+        context_ptr& operator=(context_ptr&& rhs)
+        {
+            context_ptr(std::move(rhs)).swap(*this);
+            return *this;
+        }
+
+        inline void swap(context_ptr& rhs){ std::swap(p_, rhs.p_); }
+        inline atom_context* get() const { return p_; }
+        inline atom_context* operator->() const { return p_; }
+        inline atom_context& operator*() const { return *p_; }
+        inline explicit operator bool() const { return p_ != nullptr; }
+
+    private:
+        atom_context* p_;
+    };
+
+    mutable context_ptr ctx;
+
+    template <typename T>
+    void emplace_value(T&& t, std::true_type)
+    {
+        ctx->template emplace<function>(to_fl_function(std::forward<T>(t)));
+    }
+
+    template <typename T>
+    void emplace_value(T&& t, std::false_type)
+    {
+        ctx->template emplace<detail::unqualified<T>>(std::forward<T>(t));
+    }
+
+    // copy-on-write contexts shared with other atoms are detached before being
+    // modified. preserve determines if the value is copied to the new context.
+    inline void prepare_write(bool preserve)
+    {
+        if(ctx && ctx->has(detail::frozen_flag)){ throw frozen_error(); }
+
+        if(ctx && ctx->has(detail::cow_flag))
+        {
+            if(ctx->refs.load(std::memory_order_acquire) > 1)
+            {
+                if(preserve){ ctx = context_ptr(atom_context::make(*ctx)); }
+                else{ ctx = context_ptr(); } // set() allocates a fitting context
+            }
+            else{ ctx->clear(detail::cow_flag); } // sole owner
+        }
+
+        // changing a cell of a list_run in place may change the shape of 
+        // the lists flowing through it, invalidating what its run knows. A 
+        // detached copy is not a cell of any run.
+        if(ctx && ctx->has(detail::run_flag)){ ctx->run()->invalidate(); }
+
+        // the function may be replaced or modified
+        if(ctx && ctx->has(detail::pure_flag)){ ctx->clear(detail::pure_flag); }
+    }
+
+    inline bool has_flag(detail::context_flag f) const { return ctx && ctx->has(f); }
+    inline void set_flag(detail::context_flag f){ ctx->set(f); }
+    inline void clear_flag(detail::context_flag f){ ctx->clear(f); }
+
+    friend class detail::print_map;
+    template <typename T> friend class detail::intern_table;
+    friend bool is_interned(atom a);
+    friend size_t detail::hash_leaf(atom a);
+    friend size_t hash(atom a);
+    friend bool detail::equal_cons(atom a, atom b);
+    friend atom& detail::write_handle(const atom& lst, atom& tmp);
+    friend atom share(atom a);
+    friend bool is_local(atom a);
+    friend bool is_arena_allocated(atom a);
+    friend atom cow_copy_tree(atom a);
+    friend atom detail::cow_share(atom a);
+    friend bool is_cow(atom a);
+    friend atom freeze(atom a);
+    friend bool is_frozen(atom a);
+    friend atom pure(atom f);
+    friend bool is_pure(atom a);
+    friend class detail::run_builder;
+    friend struct detail::run_cells;
+    friend class detail::tree_copier;
+    friend size_t reclaim(size_t n);
+};
+
+inline atom nil(){ return atom(); }
+inline bool is_nil(atom a){ return a.is_nil(); }
+template <typename T> bool is(atom a){ return a.is<T>(); }
+template <typename T> T atom_cast(atom& a){ return a.atom_cast<T>(); }
+template <typename T> const T& value(atom a){ return a.value<T>(); }
+
+inline bool equalv(atom lhs, atom rhs){ return lhs.equalv(rhs); }
+template <typename T> bool equalv(atom lhs, T&& rhs){ return equalv(lhs, atom(std::forward<T>(rhs))); }
+template <typename T> bool equalv(T&& lhs, atom rhs){ return equalv(atom(std::forward<T>(lhs)),rhs); }
+template <typename T, typename T2> bool equalv(T&& lhs, T2&& rhs)
+{ 
+    return equalv(atom(std::forward<T>(lhs)),atom(std::forward<T2>(rhs))); 
+}
+
+inline bool equalp(atom lhs, atom rhs){ return lhs.equalp(rhs); }
+inline atom copy(atom a){ return a.copy(); }
+inline atom cow_copy(const atom& a){ return a.cow_copy(); }
+template <typename T> inline atom copy(T&& t){ return atom(std::forward<T>(t)); }
+
+// writes through the caller's atom, a copy of it would detach a 
+// copy-on-write context and leave the caller's atom unchanged
+template <typename T> void set(atom& a, T&& t){ a.set(std::forward<T>(t)); }
+template <typename T> T&& extract(atom& a){ return a.extract<T>(); }
+
+
+
+//-----------------------------------------------------------------------------
+// intern
+//
+// intern() returns an atom from a concurrent, per-type intern table. Every call 
+// with an equal value returns an atom sharing the same context, saving memory 
+// in large collections of repeated values and allowing equalv() to compare 
+// interned atoms with a single pointer compare (see equalp()). 
+//
+// Interned contexts are shared by every holder of an equal value, they are 
+// freeze()d so they cannot be modified with set() or extract(). 
+
+inline atom freeze(atom a); // forward declaration
+
+namespace detail {
+template <typename T>
+class intern_table
+{
+public:
+    static intern_table& instance()
+    {
+        static intern_table it;
+        return it;
+    }
+
+    template <typename V>
+    atom intern(V&& v)
+    {
+        const T& key = v;
+        shard& sh = shards_[std::hash<T>()(key) % shard_count];
+        std::unique_lock<std::mutex> lk(sh.mtx);
+        auto it = sh.values.find(&key);
+        if(it == sh.values.end())
+        {
+            arena_suspend as; // interned values live forever
+            atom a(T(std::forward<V>(v)));
+            a.set_flag(interned_flag);
+            freeze(a); // interned values are visible to every thread
+            // the key points into the interned context, which never moves
+            it = sh.values.emplace(&(a.value<T>()), a).first;
+        }
+        return it->second;
+    }
+
+private:
+    static constexpr size_t shard_count = 16;
+
+    struct value_hash
+    {
+        size_t operator()(const T* t) const { return std::hash<T>()(*t); }
+    };
+
+    struct value_equal
+    {
+        bool operator()(const T* lhs, const T* rhs) const { return *lhs == *rhs; }
+    };
+
+    struct shard
+    {
+        std::mutex mtx;
+        std::unordered_map<const T*,atom,value_hash,value_equal> values;
+    };
+
+    shard shards_[shard_count];
+};
+
+// interning in the per-type intern_table, for copyable types hashable with 
+// std::hash and comparable with ==. Other types return nil and are interned 
+// by value in the atom table, see intern(atom).
+template <typename T>
+auto intern_value(const T& v, int) 
+    -> decltype(size_t(std::hash<T>()(v)), 
+                bool(v == v), 
+                typename std::enable_if<std::is_copy_constructible<T>::value,atom>::type())
+{
+    return intern_table<T>::instance().intern(v);
+}
+
+template <typename T>
+atom intern_value(const T&, long){ return atom(); }
+
+template <typename T>
+atom type_functions<T>::intern(const void* value)
+{
+    return intern_value(*static_cast<const T*>(value), 0);
+}
+}
+
+// T must be hashable with std::hash and comparable with ==
+template <typename T>
+atom intern(T&& t)
+{
+    typedef detail::unqualified<T> UT;
+    return detail::intern_table<UT>::instance().intern(std::forward<T>(t));
+}
+
+// c-string variant to ensure we intern std::strings
+inline atom intern(const char* s){ return intern(std::string(s)); }
+
+inline bool is_interned(atom a){ return a.has_flag(detail::interned_flag); }
+
+// returns the interned atom for the symbol with the given name
+inline atom make_symbol(const std::string& name){ return intern(symbol(name)); }
+inline bool is_symbol(atom a){ return is<symbol>(a); }
+
+
+//-----------------------------------------------------------------------------
+// cons_cell 
+
+namespace detail {
+class cons_cell 
+{
+private:
+    // never modified after construction
+    atom car_;
+    atom cdr_;
+
+    friend atom& write_handle(const atom& lst, atom& tmp);
+
+public:
+    cons_cell(){}
+    cons_cell(const atom& a) : car_(a) {}
+    cons_cell(const atom& a, const atom& b) : car_(a), cdr_(b) {}
+    cons_cell(atom&& a) : car_(std::move(a)) {}
+    cons_cell(atom&& a, atom&& b) : car_(std::move(a)), cdr_(std::move(b)) {}
+    cons_cell(const atom& a, atom&& b) : car_(a), cdr_(std::move(b)) {}
+    cons_cell(atom&& a, const atom& b) : car_(std::move(a)), cdr_(b) {}
+
+    // Return a copy of internal car/cdr. 
+    atom car() const { return car_; }
+    atom cdr() const { return cdr_; }
+
+    // returns true if cons_cell is nil, else false
+    explicit operator bool() const { return car_ || cdr_; }
+    bool operator==(const cons_cell& rhs) const { return car_.equalv(rhs.car_) && cdr_.equalv(rhs.cdr_); }
+
+#ifdef FL_CONS_HASH_CACHE
+    // Structural hash of the tree rooted at this cell as computed by 
+    // fl::hash(), 0 when not yet computed. Only enable this if the elements 
+    // of hashed trees are not modified with set() or extract() afterwards.
+    cons_cell(const cons_cell& rhs) : car_(rhs.car_), cdr_(rhs.cdr_), hash_cache_(0) {}
+    cons_cell(cons_cell&& rhs) noexcept : car_(std::move(rhs.car_)), cdr_(std::move(rhs.cdr_)), hash_cache_(0) {}
+
+    cons_cell& operator=(const cons_cell& rhs)
+    {
+        car_ = rhs.car_;
+        cdr_ = rhs.cdr_;
+        hash_cache_.store(0, std::memory_order_relaxed);
+        return *this;
+    }
+
+    cons_cell& operator=(cons_cell&& rhs) noexcept
+    {
+        car_ = std::move(rhs.car_);
+        cdr_ = std::move(rhs.cdr_);
+        hash_cache_.store(0, std::memory_order_relaxed);
+        return *this;
+    }
+
+    mutable std::atomic<size_t> hash_cache_{0};
+#endif
+};
+}
+
+// list nodes must be stored inline in the pooled cell contexts
+static_assert(detail::is_small_value<detail::cons_cell,detail::cell_value_capacity>::value,
+              "cons_cell does not fit the cell context class");
+
+template <typename A, typename B>
+inline atom cons(A&& a, B&& b)
+{ 
+    return atom(detail::cons_cell(atom(std::forward<A>(a)), 
+                                  atom(std::forward<B>(b)))); 
+}
+
+inline bool is_cons(atom a){ return is<detail::cons_cell>(a); }
+inline atom car(atom a){ return value<detail::cons_cell>(a).car(); }
+inline atom cdr(atom a){ return value<detail::cons_cell>(a).cdr(); }
+
+
+
+//-----------------------------------------------------------------------------
+// thread local atoms
+//
+// Atoms are reference counted with atomic operations so that they can be 
+// shared between threads. Atoms created while a local_scope is alive on the 
+// current thread are instead confined to that thread and reference counted 
+// with plain loads and stores, which makes copying them (for instance every 
+// atom returned by car() and cdr()) considerably cheaper.
+//
+// A thread local atom is promoted to atomic reference counting by share(), 
+// which is called automatically on atoms handed to channel::send() (and 
+// therefore worker::schedule(), workerpool::schedule() and schedule()) and 
+// continuation::send()/recv(). share() walks cons structures but cannot see 
+// atoms stored inside other values (for example atoms captured by a lambda or 
+// held in a user struct), such atoms must be share()d before the value 
+// containing them is made visible to another thread. A lambda handed to 
+// another thread should therefore only capture atoms share()d beforehand.
+//
+// Example:
+/*
+atom sum_squares(atom lst)
+{
+    fl::local_scope ls; // all atoms created below are thread local
+    atom squares = fl::map([](int i){ return i*i; }, lst);
+    return fl::share(fl::foldlv([](int a, int b){ return a+b; }, 0, squares));
+}
+ */
+class local_scope
+{
+public:
+    inline local_scope(){ ++detail::local_scope_depth(); }
+    inline ~local_scope(){ --detail::local_scope_depth(); }
+
+private:
+    local_scope(const local_scope&) = delete;
+    local_scope& operator=(const local_scope&) = delete;
+};
+
+inline bool is_local(atom a){ return a.has_flag(detail::local_flag); }
+
+// promote a and every atom reachable from it through cons cells to atomic 
+// reference counting, returns a. Contexts are marked shared as they are 
+// visited and the walk stops at marked and frozen contexts, as everything 
+// reachable from them is shared already: sharing a tree again is O(1), and 
+// cycles and subtrees reached twice are walked once. set() of a shared atom
+// shares the new value. Values stored in a shared atom through atom_cast() 
+// are not seen and must be share()d by the caller.
+inline atom share(atom a)
+{
+    std::vector<atom> todo;
+    todo.push_back(a);
+
+    while(!todo.empty())
+    {
+        atom cur = std::move(todo.back());
+        todo.pop_back();
+
+        if(cur && !cur.has_flag(detail::shared_flag) && !cur.has_flag(detail::frozen_flag))
+        {
+            cur.set_flag(detail::shared_flag);
+            cur.clear_flag(detail::local_flag);
+
+            if(is_cons(cur))
+            {
+                const detail::cons_cell& c = value<detail::cons_cell>(cur);
+                todo.push_back(c.cdr());
+                todo.push_back(c.car());
+            }
+        }
+    }
+
+    return a;
+}
+
+
+
+//-----------------------------------------------------------------------------
+// arena
+//
+// An arena is a scope in which every new atom context (including every 
+// cons_cell) is bump allocated from large blocks owned by the arena instead of
+// being individually heap allocated. Building temporary lists inside an arena 
+// therefore costs a pointer increment per node, and the arena's memory is 
+// released all at once: when the arena goes out of scope and its last atom has
+// been released, every block is freed in one pass regardless of how many atoms 
+// were allocated. Like a local_scope an arena is confined to the thread which 
+// created it, and its atoms are thread local until share()d.
+//
+// Atoms which outlive the arena do not dangle, they keep the arena's memory 
+// alive until they are released. To avoid retaining the whole arena for a 
+// small result, escape() the result to copy it out of the arena. channel 
+// sends and intern() always copy out of the current arena.
+//
+// Example:
+/*
+atom total(std::vector<int>& v)
+{
+    fl::arena ar; // all scratch lists below are allocated in ar
+    atom squares = fl::map([](int i){ return i*i; }, fl::atomize_container(v));
+    return fl::escape(fl::foldlv([](int a, int b){ return a+b; }, 0, squares));
+}
+ */
+class arena
+{
+public:
+    inline arena() : 
+        state_(new detail::arena_state), 
+        prev_(detail::current_arena())
+    { 
+        detail::current_arena() = state_; 
+    }
+
+    inline ~arena()
+    {
+        detail::current_arena() = prev_;
+        state_->release(); 
+    }
+
+    // count of atom contexts allocated in the arena that are still alive
+    inline size_t live() const { return state_->live(); }
+
+private:
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+
+    detail::arena_state* state_;
+    detail::arena_state* prev_;
+};
+
+inline bool is_arena_allocated(atom a){ return a.has_flag(detail::arena_flag); }
+
+inline atom copy_tree(atom lst); // forward declaration
+
+// return a heap allocated copy_tree() of a, which is safe to keep after the 
+// current arena is released
+inline atom escape(atom a)
+{
+    detail::arena_suspend as;
+    return copy_tree(a);
+}
+
+
+
+//-----------------------------------------------------------------------------
+// copy-on-write
+//
+// cow_copy() and cow_copy_tree() are opt-in O(1)/allocation free alternatives
+// to copy() and copy_tree(). Instead of duplicating contexts they mark them 
+// copy-on-write and share them, a marked context is only duplicated when it 
+// is modified through set(), extract() or a writing atom_cast() while 
+// shared. Read mostly values handed between threads are thereby never copied.
+// cow_copy() of an atom whose context already has plain copies returns a 
+// plain copy(), the plain copies keep sharing their writes.
+//
+// Because cons_cells are immutable, a copy-on-write tree can only be modified 
+// by modifying one of its elements, which detaches the element from the tree:
+/*
+atom a = fl::list(1,2,3);
+atom b = fl::cow_copy_tree(a);
+atom e = fl::car(b);
+e.set(4); // e receives its own context, a and b are still (1 2 3)
+ */
+
+inline bool is_cow(atom a){ return a.has_flag(detail::cow_flag); }
+
+// mark every context reachable from a through cons cells copy-on-write and 
+// return a. Marking stops at contexts which are already copy-on-write, as 
+// their subtrees are already marked, so repeatedly copying the same tree is 
+// O(1).
+inline atom cow_copy_tree(atom a)
+{
+    std::vector<atom> todo;
+    todo.push_back(a);
+
+    while(!todo.empty())
+    {
+        atom cur = std::move(todo.back());
+        todo.pop_back();
+
+        if(cur && !is_cow(cur))
+        {
+            cur.ctx->set(detail::cow_flag);
+
+            if(is_cons(cur))
+            {
+                const detail::cons_cell& c = value<detail::cons_cell>(cur);
+                todo.push_back(c.cdr());
+                todo.push_back(c.car());
+            }
+        }
+    }
+
+    return a;
+}
+
+// the copy function used by channels and continuations for values passed 
+// between threads
+enum class copy_policy
+{
+    deep, // copy_tree(), fl::functions are passed by reference
+    copy_on_write // cow_copy_tree()
+};
+
+
+
+
+//-----------------------------------------------------------------------------
+// freeze
+//
+// freeze() makes an atom and every atom reachable from it through cons cells 
+// immutable in a single pass: set(), extract() and atom_cast() on any of them 
+// throw fl::frozen_error. A frozen tree can therefore be shared between 
+// threads without copying, channels, continuations and schedule() pass frozen
+// atoms by reference instead of copying them. copy() and copy_tree() of a 
+// frozen atom return mutable copies, which is what a worker whose function 
+// takes a mutable reference receives.
+//
+// Example:
+/*
+atom config = fl::freeze(fl::list("host", "port", 8080));
+w.schedule(handle_request, config); // config is not copied
+ */
+
+inline bool is_frozen(atom a){ return a.has_flag(detail::frozen_flag); }
+
+namespace detail {
+// The handle through which the invoker gives a parameter writing to its 
+// argument the car of the list cell lst: the cell's own car, so writes reach
+// the caller, unless that would detach a shared copy-on-write context or 
+// frozen_error is thrown anyway. Then tmp receives a copy and is returned, 
+// as cons cells are never modified after construction.
+inline atom& write_handle(const atom& lst, atom& tmp)
+{
+    atom& car = const_cast<atom&>(lst.value<cons_cell>().car_);
+    if(car.ctx && 
+       (car.ctx->has(frozen_flag) || 
+        (car.ctx->has(cow_flag) && car.ctx->refs.load(std::memory_order_acquire) > 1)))
+    {
+        tmp = car;
+        return tmp;
+    }
+    return car;
+}
+}
+
+// freeze a and every atom reachable from it through cons cells and return a. 
+// Frozen atoms are also share()d. Marking stops at atoms which are already 
+// frozen, as everything reachable from them is frozen too.
+inline atom freeze(atom a)
+{
+    std::vector<atom> todo;
+    todo.push_back(a);
+
+    while(!todo.empty())
+    {
+        atom cur = std::move(todo.back());
+        todo.pop_back();
+
+        if(cur && !is_frozen(cur))
+        {
+            cur.ctx->clear(detail::local_flag);
+            cur.ctx->set(detail::frozen_flag);
+
+            if(is_cons(cur))
+            {
+                const detail::cons_cell& c = value<detail::cons_cell>(cur);
+                todo.push_back(c.cdr());
+                todo.push_back(c.car());
+            }
+        }
+    }
+
+    return a;
+}
+
+namespace detail {
+// share(cow_copy_tree(a)) in a single walk, which stops at contexts that are
+// already both copy-on-write and shared, or frozen. Sending the same tree 
+// again is therefore O(1).
+inline atom cow_share(atom a)
+{
+    std::vector<atom> todo;
+    todo.push_back(a);
+
+    while(!todo.empty())
+    {
+        atom cur = std::move(todo.back());
+        todo.pop_back();
+
+        if(cur && 
+           !(cur.has_flag(cow_flag) && cur.has_flag(shared_flag)) && 
+           !cur.has_flag(frozen_flag))
+        {
+            cur.set_flag(cow_flag);
+            cur.set_flag(shared_flag);
+            cur.clear_flag(local_flag);
+
+            if(is_cons(cur))
+            {
+                const cons_cell& c = value<cons_cell>(cur);
+                todo.push_back(c.cdr());
+                todo.push_back(c.car());
+            }
+        }
+    }
+
+    return a;
+}
+}
+
+
+
+//-----------------------------------------------------------------------------
+// reclamation
+//
+// Dropping the last reference to an atom frees it along with every atom only 
+// it referenced. Nothing is freed recursively, a list of a million cells is 
+// torn down in a loop in constant stack space. 
+//
+// By default everything is freed before the release returns, so dropping a 
+// big tree may stall the thread for a while. A thread which must stay 
+// responsive, such as a worker serving requests, can select another 
+// reclaim_mode:
+// - reclaim_mode::sliced frees at most a slice of contexts per release and 
+//   keeps the rest queued. Each later release frees another slice, and 
+//   reclaim() frees queued garbage explicitly, for instance between messages.
+// - reclaim_mode::background frees a slice and hands the rest to a single 
+//   background thread. Thread local atoms, see local_scope, are never handed
+//   over and stay queued as in sliced mode.
+// 
+// Garbage still queued when a thread exits is freed by that thread.
+//
+// Example:
+/*
+fl::set_reclaim_mode(fl::reclaim_mode::background);
+atom big = build_index(); 
+big = atom(); // returns after freeing at most 4096 contexts
+ */
+
+// set the reclaim_mode of the current thread and the count of contexts freed
+// per release in the sliced and background modes 
+inline void set_reclaim_mode(reclaim_mode m, size_t slice=detail::reclaimer::default_slice)
+{
+    detail::reclaimer& r = detail::reclaimer::local();
+    r.mode = m;
+    r.slice = slice ? slice : 1;
+}
+
+inline reclaim_mode get_reclaim_mode(){ return detail::reclaimer::local().mode; }
+
+// count of contexts queued for destruction on the current thread
+inline size_t pending_reclaim(){ return detail::reclaimer::local().size(); }
+
+// free up to n queued contexts on the current thread, returns the count still 
+// queued
+inline size_t reclaim(size_t n=size_t(-1))
+{
+    detail::reclaimer& r = detail::reclaimer::local();
+    if(!r.draining)
+    {
+        r.draining = true;
+        atom::atom_context::drain(r, n);
+        r.draining = false;
+    }
+    return r.size();
+}
+
+
+
+//-----------------------------------------------------------------------------
+// list  
+//
+// Lists built by list(), atomize_container() and the list algorithms are 
+// stored in list_runs, contiguous blocks of cons cells which still behave as 
+// ordinary cons cells through car() and cdr(). For such lists length() is 
+// constant time, and nth() and tail() skip over whole runs, making them 
+// O(log n). Runs grow geometrically while building when the final length is 
+// not known in advance.
+//
+// Modifying a cell of a run in place with set(), extract() or atom_cast() 
+// may change the shape of any list containing it, so it disables these 
+// shortcuts for that run and for the lists flowing into it. They then fall 
+// back to following each cdr. Other runs, and copy-on-write cells detached 
+// before the modification, are unaffected.
+
+namespace detail {
+// access to the runs of list cells
+struct run_cells
+{
+    // find the run and index of a, false if a is not a cell of a list_run or 
+    // the run's information may be stale
+    static inline bool locate(const atom& a, list_run*& r, size_t& index)
+    {
+        if(a.ctx && a.ctx->has(run_flag))
+        {
+            r = a.ctx->run();
+            index = a.ctx->run_index;
+            return r->current();
+        }
+        else{ return false; }
+    }
+
+    // return the cell at index of run r 
+    static inline atom at(list_run* r, size_t index)
+    {
+        atom a;
+        atom::atom_context* c = static_cast<atom::atom_context*>(r->cell(index));
+        c->retain();
+        a.ctx = atom::context_ptr(c);
+        return a;
+    }
+
+    // the length of the list starting at a, if known in constant time
+    static inline bool length(const atom& a, size_t& len)
+    {
+        list_run* r;
+        size_t i;
+        if(locate(a,r,i) && r->length() != list_run::npos)
+        {
+            len = r->length() - i;
+            return true;
+        }
+        else{ return false; }
+    }
+
+    // advance a by up to n cells without leaving its run, n is decremented 
+    // by the count of cells skipped
+    static inline void advance(atom& a, size_t& n)
+    {
+        list_run* r;
+        size_t i;
+        if(n && locate(a,r,i))
+        {
+            size_t step = std::min(n, r->size() - 1 - i);
+            if(step)
+            {
+                a = at(r, i + step);
+                n -= step;
+            }
+        }
+    }
+};
+}
+
+struct list_info
+{
+    bool is_list;
+    size_t length;
+    list_info(){}
+    list_info(bool in_is_list, size_t in_length) : 
+        is_list(in_is_list), 
+        length(in_length)
+    {}
+};
+
+inline list_info inspect_list(atom a)
+{
+    size_t sz=0;
+   
+    while(true)
+    {
+        size_t rest;
+        if(detail::run_cells::length(a,rest)){ return list_info(true,sz+rest); }
+        else if(is_nil(a)){ return list_info(true,sz); } 
+        else if(is_cons(a))
+        {
+            // skip to the last cell of the run when the list's length is 
+            // not known
+            size_t n = size_t(-1);
+            detail::run_cells::advance(a,n);
+            sz += size_t(-1) - n + 1;
+            a = cdr(a);
+        }
+        else{ return list_info(false,sz); }
+    }
+}
+
+inline bool is_list(atom a){ return inspect_list(a).is_list; }
+inline size_t length(atom a){ return inspect_list(a).length; }
+
+// cons access 
+inline atom head_cons(atom lst){ return lst; }
+inline atom tail_cons(atom lst)
+{
+    atom ret = lst;
+    while(is_cons(lst))
+    { 
+        size_t n = size_t(-1);
+        detail::run_cells::advance(lst,n); // to the last cell of a run
+        ret = lst;
+        lst = cdr(lst);
+    }
+    return ret;
+}
+
+// return the cons cell in a list at index position n
+inline atom nth_cons(atom lst, size_t n)
+{ 
+    while(n)
+    {
+        detail::run_cells::advance(lst,n);
+        if(n)
+        {
+            --n;
+            lst = cdr(lst);
+        }
+    }
+    return lst;
+}
+
+namespace detail {
+// convert a value to an atom, atoms are returned as themselves instead of 
+// being wrapped in another atom
+inline atom to_atom(const atom& a){ return a; }
+inline atom to_atom(atom& a){ return a; }
+inline atom to_atom(atom&& a){ return std::move(a); }
+template <typename T> atom to_atom(T&& t){ return atom(std::forward<T>(t)); }
+
+// Builds a list front to back in list_runs. A cell is only constructed once 
+// the location of its successor is known: the cdr of every constructed cell, 
+// or the head for the first one, refers to a reserved slot which is 
+// constructed by the next push() or by finish(). Inside an arena the cells 
+// are allocated from the arena instead.
+class run_builder
+{
+public:
+    // hint is the expected count of elements, 0 when unknown
+    explicit run_builder(size_t hint=0) : 
+        hint_(hint), 
+        count_(0), 
+        used_(0), 
+        first_(nullptr), 
+        last_(nullptr)
+    { }
+
+    run_builder(const run_builder&) = delete;
+    run_builder& operator=(const run_builder&) = delete;
+
+    // an unfinished list is terminated with nil and dropped
+    ~run_builder(){ finish(); }
+
+    inline size_t size() const { return count_; }
+
+    template <typename T>
+    void push(T&& t)
+    {
+        atom v = to_atom(std::forward<T>(t));
+        slot next = reserve();
+
+        if(pending_.mem){ construct(pending_, std::move(value_), adopt(next)); }
+        else{ head_ = adopt(next); }
+
+        value_ = std::move(v);
+        pending_ = next;
+        ++count_;
+    }
+
+    // terminate the list with tail and return it, the builder is empty 
+    // afterwards
+    inline atom finish(atom tail=nil())
+    {
+        if(pending_.mem)
+        {
+            size_t tail_len;
+            list_run* tail_run = nullptr;
+            size_t tail_index;
+            if(is_nil(tail)){ tail_len = 0; }
+            else if(!run_cells::length(tail,tail_len)){ tail_len = list_run::npos; }
+            else{ run_cells::locate(tail,tail_run,tail_index); }
+
+            construct(pending_, std::move(value_), std::move(tail));
+            pending_ = slot();
+
+            while(first_)
+            {
+                list_run* r = first_;
+                first_ = r->next_;
+                r->next_ = nullptr;
+                r->successor_ = first_ ? first_ : tail_run;
+                r->length_ = tail_len == list_run::npos 
+                             ? list_run::npos 
+                             : count_ - r->offset_ + tail_len;
+                r->current_.store(true, std::memory_order_release);
+                r->release(); // the builder's reference
+            }
+        }
+        else{ head_ = std::move(tail); } // nothing was pushed
+
+        last_ = nullptr;
+        used_ = 0;
+        count_ = 0;
+        atom ret = std::move(head_);
+        head_ = nil();
+        return ret;
+    }
+
+private:
+    struct slot
+    {
+        void* mem = nullptr;
+        list_run* run = nullptr; // nullptr for arena allocated slots
+        size_t index = 0;
+    };
+
+    static constexpr size_t stride()
+    {
+        return atom::atom_context::block_size(cell_value_capacity);
+    }
+
+    inline slot reserve()
+    {
+        slot s;
+        arena_state* ar = current_arena();
+
+        if(ar){ s.mem = ar->allocate(stride()); }
+        else
+        {
+            if(!last_ || used_ == last_->capacity_)
+            {
+                size_t cap = hint_ > count_ 
+                             ? hint_ - count_ 
+                             : (last_ ? last_->capacity_*2 : 8);
+                if(cap > list_run::max_cells){ cap = list_run::max_cells; }
+
+                list_run* r = list_run::make(cap, stride(), count_);
+                if(last_){ last_->next_ = r; }
+                else{ first_ = r; }
+                last_ = r;
+                used_ = 0;
+            }
+
+            s.mem = last_->cell(used_);
+            s.run = last_;
+            s.index = used_;
+            ++used_;
+        }
+
+        return s;
+    }
+
+    // an atom owning the not yet constructed context in s
+    static inline atom adopt(const slot& s)
+    {
+        atom a;
+        a.ctx = atom::context_ptr(static_cast<atom::atom_context*>(s.mem));
+        return a;
+    }
+
+    static inline void construct(const slot& s, atom&& car, atom&& cdr)
+    {
+        atom::atom_context* c = new(s.mem) atom::atom_context(
+            (unsigned char)cell_value_capacity);
+
+        if(s.run)
+        {
+            c->run_index = (unsigned short)s.index;
+            c->set(run_flag);
+            if(local_scope_depth()){ c->set(local_flag); }
+            s.run->retain();
+            ++s.run->size_;
+        }
+        else
+        {
+            c->set(arena_flag);
+            c->set(local_flag);
+        }
+
+        c->emplace<cons_cell>(std::move(car), std::move(cdr));
+    }
+
+    size_t hint_;
+    size_t count_;
+    size_t used_; // slots reserved in last_
+    list_run* first_;
+    list_run* last_;
+    slot pending_;
+    atom value_; // car of the pending slot
+    atom head_;
+};
+}
+
+// list_builder builds a list front to back in a single pass: push_back() 
+// appends an element at the end of the list in O(1) and finish() terminates 
+// the list and returns it. Every function returning a new list uses it, so 
+// the lists it builds are made of list_runs. Passing the expected count of 
+// elements, when known, sizes the first run exactly.
+//
+// Example:
+/*
+fl::list_builder b;
+for(int i = 0; i < 5; ++i){ b.push_back(i*i); }
+atom squares = b.finish(); // (0 1 4 9 16)
+ */
+class list_builder
+{
+public:
+    // hint is the expected count of elements, 0 when unknown
+    explicit list_builder(size_t hint=0) : b_(hint) {}
+
+    template <typename T>
+    list_builder& push_back(T&& t)
+    {
+        b_.push(std::forward<T>(t));
+        return *this;
+    }
+
+    // count of elements pushed since construction or the last finish()
+    inline size_t size() const { return b_.size(); }
+
+    // terminate the list with tail and return it, the builder is empty and 
+    // may be reused afterwards
+    inline atom finish(atom tail=nil()){ return b_.finish(std::move(tail)); }
+
+private:
+    detail::run_builder b_;
+};
+
+template <typename T, typename... Ts>
+atom list(T&& t, Ts&&... ts)
+{
+    list_builder b(1 + sizeof...(Ts));
+    b.push_back(std::forward<T>(t));
+    int expand[] = { 0, (b.push_back(std::forward<Ts>(ts)), 0)... };
+    (void)expand;
+    return b.finish();
+}
+
+// element access
+inline atom head(atom lst){ return car(lst); }
+inline atom tail(atom lst){ return car(tail_cons(lst)); }
+
+// return the element in a list at index n
+inline atom nth(atom lst, size_t n){ return car(nth_cons(lst,n)); }
+
+// given a list, return a list in reverse order
+inline atom reverse(atom lst)
+{
+    std::vector<atom> elems;
+    size_t len;
+    if(detail::run_cells::length(lst,len)){ elems.reserve(len); }
+
+    for(; is_cons(lst); lst = cdr(lst)){ elems.push_back(car(lst)); }
+
+    list_builder b(elems.size()); // the result is a single run
+    for(auto it = elems.rbegin(); it != elems.rend(); ++it){ b.push_back(std::move(*it)); }
+    return b.finish();
+}
+
+// thrown by copy_tree(), copy_list() and hash() when given a cyclic structure
+class cycle_error : public std::logic_error
+{
+public:
+    cycle_error() : std::logic_error("fl: cyclic structure") {}
+};
+
+namespace detail {
+// Iterative deep copy of structures composed of cons_cells and any other atom.
+// Contexts reachable more than once are copied once and the copy is shared 
+// the same way, so a DAG is copied as a DAG. A context reached again while its
+// own copy is still being built is part of a cycle and throws cycle_error.
+//
+// Only contexts whose reference count shows them to be referenced from more 
+// than one place are recorded in the visited map, every cycle has at least 
+// one such context. This keeps the common case, trees without any sharing, 
+// free of map lookups.
+class tree_copier
+{
+public:
+    // fl::functions are referenced by the copy instead of clone()d if 
+    // functions_by_reference is true, which copies move only functions too
+    explicit tree_copier(bool functions_by_reference=false) : 
+        functions_by_reference_(functions_by_reference) 
+    { }
+
+    // copy the structure rooted at a, a is also referenced by exactly one 
+    // structure already being copied unless is_root is true
+    atom copy(atom a, bool is_root=true)
+    {
+        if(!is_cons(a)){ return is_root ? copy_value(a) : copy_leaf(a, shared(a)); } 
+
+        todo_.push_back(frame{ a, false, is_root || shared(a) });
+
+        while(!todo_.empty())
+        {
+            frame f = std::move(todo_.back());
+            todo_.pop_back();
+
+            if(f.expanded)
+            {
+                atom cdr_c = std::move(results_.back());
+                results_.pop_back();
+                atom car_c = std::move(results_.back());
+                results_.pop_back();
+
+                atom c = cons(std::move(car_c), std::move(cdr_c));
+                if(f.shared){ visited_[f.src.ctx.get()] = c; }
+                results_.push_back(std::move(c));
+            }
+            else if(!is_cons(f.src)){ results_.push_back(copy_leaf(f.src, f.shared)); }
+            else
+            {
+                if(f.shared)
+                {
+                    auto it = visited_.find(f.src.ctx.get());
+                    if(it != visited_.end())
+                    {
+                        if(is_nil(it->second)){ throw cycle_error(); } // in progress
+                        results_.push_back(it->second);
+                        continue;
+                    }
+                    visited_[f.src.ctx.get()] = nil();
+                }
+
+                const cons_cell& c = value<cons_cell>(f.src);
+                atom car_s = c.car();
+                atom cdr_s = c.cdr();
+                bool cdr_shared = shared(cdr_s);
+                bool car_shared = shared(car_s);
+
+                todo_.push_back(frame{ std::move(f.src), true, f.shared });
+                todo_.push_back(frame{ std::move(cdr_s), false, cdr_shared });
+                todo_.push_back(frame{ std::move(car_s), false, car_shared });
+            }
+        }
+
+        atom ret = std::move(results_.back());
+        results_.pop_back();
+        return ret;
+    }
+
+private:
+    struct frame
+    {
+        atom src;
+        bool expanded; // children have been copied
+        bool shared; // src is recorded in visited_
+    };
+
+    // a is a local copy, so one reference is ours and one the structure's
+    static inline bool shared(const atom& a)
+    {
+        return a.ctx && a.ctx->refs.load(std::memory_order_relaxed) > 2;
+    }
+
+    inline atom copy_value(const atom& a)
+    {
+        if(functions_by_reference_ && is<function>(a)){ return a; }
+        else{ return a.copy(); }
+    }
+
+    inline atom copy_leaf(const atom& a, bool is_shared)
+    {
+        if(is_nil(a)){ return a; }
+        else if(!is_shared){ return copy_value(a); }
+
+        auto it = visited_.find(a.ctx.get());
+        if(it != visited_.end()){ return it->second; }
+
+        atom c = copy_value(a);
+        visited_[a.ctx.get()] = c;
+        return c;
+    }
+
+    bool functions_by_reference_;
+    std::vector<frame> todo_;
+    std::vector<atom> results_;
+    std::unordered_map<const void*, atom> visited_;
+};
+
+// the length of the list spine starting at lst, found with Floyd's cycle 
+// detection so a spine which loops back on itself throws cycle_error
+inline size_t spine_length(atom lst)
+{
+    size_t n = 0;
+    atom slow = lst;
+
+    while(is_cons(lst))
+    {
+        lst = cdr(lst);
+        if(++n % 2 == 0)
+        {
+            slow = cdr(slow);
+            if(equalp(slow, lst)){ throw cycle_error(); }
+        }
+    }
+
+    return n;
+}
+}
+
+// Copies any structure composed of cons_cells and any other atom without 
+// recursion, preserving shared substructure. Throws fl::cycle_error if the 
+// structure is cyclic and std::logic_error if it holds an fl::function 
+// wrapping a move only callable, which cannot be cloned.
+inline atom copy_tree(atom lst){ return detail::tree_copier().copy(lst); }
+
+namespace detail {
+// the copy of a handed to another thread, shared
+inline atom copy_with_policy(atom a, copy_policy p)
+{
+    if(p == copy_policy::copy_on_write){ return cow_share(a); }
+    else{ return share(tree_copier(true).copy(a)); }
+}
+}
+
+// Bulk variant of copy_tree() for lists: the cells of the list itself are 
+// copied into a single contiguous list_run, its elements are copied with 
+// copy_tree(). Substructure shared between elements stays shared. Throws 
+// fl::cycle_error if the list or its elements are cyclic.
+inline atom copy_list(atom lst)
+{
+    if(!is_cons(lst)){ return copy_tree(lst); }
+
+    detail::tree_copier tc;
+    list_builder b(detail::spine_length(lst));
+
+    while(is_cons(lst))
+    {
+        const detail::cons_cell& c = value<detail::cons_cell>(lst);
+        b.push_back(tc.copy(c.car(), false));
+        lst = c.cdr();
+    }
+
+    return b.finish(tc.copy(lst, false));
+}
+
+
+namespace detail {
+inline atom append_(list_builder& b, atom last){ return b.finish(std::move(last)); }
+
+template <typename... As>
+atom append_(list_builder& b, atom lst, atom next, As&&... as)
+{
+    for(; is_cons(lst); lst = cdr(lst)){ b.push_back(car(lst)); }
+    return append_(b, std::move(next), std::forward<As>(as)...);
+}
+}
+
+// return a list of the elements of every argument list in order. The cells of
+// every list but the last are copied in a single pass, the last list is shared
+// as the tail of the result. 
+template <typename... As>
+atom append(atom a, atom b, As&&... as)
+{
+    list_builder lb;
+    return detail::append_(lb, std::move(a), std::move(b), std::forward<As>(as)...);
+}
+
+
+//TODO: need to implement the following list functions 
+/*
+ list_with_tail: list* in racket
+ build_list
+ */
+
+
+
+//-----------------------------------------------------------------------------
+// hash
+//
+// hash() computes a structural hash of an atom consistent with equalv(): atoms 
+// which are equalv() always have the same hash. Leaf values are hashed through 
+// their type's vtable, cons structures are hashed iteratively so arbitrarily 
+// long lists and deep trees can be hashed without exhausting the stack. 
+//
+// Like copy_tree(), hash() records the cells referenced from more than one 
+// place, so a shared subtree is hashed once and a cyclic structure throws 
+// fl::cycle_error instead of looping forever.
+//
+// When compiled with FL_CONS_HASH_CACHE each cons_cell caches the hash of its 
+// tree, making repeated hashing of the same structure O(1).
+
+namespace detail {
+inline size_t hash_combine(size_t seed, size_t h)
+{
+    return seed ^ (h + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
+constexpr size_t nil_hash = 0x5bd1e995;
+constexpr size_t cons_hash_seed = 0x27d4eb2f;
+
+inline size_t hash_leaf(atom a)
+{
+    if(is_nil(a)){ return nil_hash; }
+    else 
+    { 
+        return hash_combine(std::hash<type_id>()(a.ctx->id()), 
+                            a.ctx->vt->hash(a.ctx->data())); 
+    }
+}
+}
+
+inline size_t hash(atom a)
+{
+    if(!is_cons(a)){ return detail::hash_leaf(a); }
+    else
+    {
+        // post-order traversal with an explicit stack. A cell is pushed once 
+        // to schedule its children and again (expanded=true) to combine their 
+        // hashes, which are accumulated in hashes as car then cdr.
+        struct pending 
+        {
+            atom a;
+            bool expanded;
+            bool shared; // a is recorded in visited
+        };
+
+        // a shared cell's hash, or done=false while its children are hashed
+        struct visit
+        {
+            bool done;
+            size_t h;
+        };
+
+        // a is a local copy, so one reference is ours and one the structure's
+        auto shared = [](const atom& a)
+        { 
+            return a.ctx->refs.load(std::memory_order_relaxed) > 2; 
+        };
+
+        std::vector<pending> todo;
+        std::vector<size_t> hashes;
+        std::unordered_map<const void*, visit> visited;
+        todo.push_back(pending{a,false,shared(a)});
+
+        while(!todo.empty())
+        {
+            pending cur = std::move(todo.back());
+            todo.pop_back();
+
+            if(!is_cons(cur.a)){ hashes.push_back(detail::hash_leaf(cur.a)); }
+            else 
+            {
+                const detail::cons_cell& c = value<detail::cons_cell>(cur.a);
+
+                if(cur.expanded)
+                {
+                    size_t cdr_h = hashes.back();
+                    hashes.pop_back();
+                    size_t car_h = hashes.back();
+                    hashes.pop_back();
+                    size_t h = detail::hash_combine(
+                        detail::hash_combine(detail::cons_hash_seed, car_h), 
+                        cdr_h);
+#ifdef FL_CONS_HASH_CACHE
+                    c.hash_cache_.store(h ? h : 1, std::memory_order_relaxed);
+#endif
+                    if(cur.shared){ visited[cur.a.ctx.get()] = visit{true,h}; }
+                    hashes.push_back(h);
+                }
+                else
+                {
+#ifdef FL_CONS_HASH_CACHE
+                    size_t cached = c.hash_cache_.load(std::memory_order_relaxed);
+                    if(cached)
+                    { 
+                        hashes.push_back(cached); 
+                        continue;
+                    }
+#endif
+                    if(cur.shared)
+                    {
+                        auto it = visited.find(cur.a.ctx.get());
+                        if(it != visited.end())
+                        {
+                            if(!it->second.done){ throw cycle_error(); } // in progress
+                            hashes.push_back(it->second.h);
+                            continue;
+                        }
+                        visited[cur.a.ctx.get()] = visit{false,0};
+                    }
+
+                    atom car_a = c.car();
+                    atom cdr_a = c.cdr();
+                    bool cdr_shared = is_cons(cdr_a) && shared(cdr_a);
+                    bool car_shared = is_cons(car_a) && shared(car_a);
+                    todo.push_back(pending{std::move(cur.a),true,cur.shared});
+                    todo.push_back(pending{std::move(cdr_a),false,cdr_shared});
+                    todo.push_back(pending{std::move(car_a),false,car_shared});
+                }
+            }
+        }
+
+        return hashes.back();
+    }
+}
+
+namespace detail {
+// structural comparison of the cons structures a and b with an explicit 
+// stack, used by equalv(). Like hash() it records the pairs of cells of 
+// which one is referenced from more than one place: a pair reached again is 
+// either being compared already or was found equal, so shared subtrees are 
+// compared once and comparing cyclic structures terminates.
+inline bool equal_cons(atom a, atom b)
+{
+    struct pending
+    {
+        atom a;
+        atom b;
+    };
+
+    struct pair_hash
+    {
+        size_t operator()(const std::pair<const void*,const void*>& p) const
+        {
+            return hash_combine(std::hash<const void*>()(p.first), 
+                                std::hash<const void*>()(p.second));
+        }
+    };
+
+    // a is a local copy, so one reference is ours and one the structure's
+    auto shared = [](const atom& a)
+    { 
+        return a.ctx->refs.load(std::memory_order_relaxed) > 2; 
+    };
+
+    std::vector<pending> todo;
+    std::unordered_set<std::pair<const void*,const void*>,pair_hash> visited;
+    todo.push_back(pending{std::move(a),std::move(b)});
+
+    while(!todo.empty())
+    {
+        pending cur = std::move(todo.back());
+        todo.pop_back();
+
+        if(cur.a.equalp(cur.b)){ continue; }
+        else if(!is_cons(cur.a) || !is_cons(cur.b))
+        {
+            // at most one is a cons_cell, so this does not recurse
+            if(!cur.a.equalv(cur.b)){ return false; }
+        }
+        else 
+        {
+            if(shared(cur.a) || shared(cur.b))
+            {
+                auto key = std::make_pair(static_cast<const void*>(cur.a.ctx.get()), 
+                                          static_cast<const void*>(cur.b.ctx.get()));
+                if(!visited.insert(key).second){ continue; }
+            }
+
+            const cons_cell& ca = value<cons_cell>(cur.a);
+            const cons_cell& cb = value<cons_cell>(cur.b);
+            todo.push_back(pending{ca.cdr(),cb.cdr()});
+            todo.push_back(pending{ca.car(),cb.car()});
+        }
+    }
+
+    return true;
+}
+}
+
+// intern an arbitrary atom. A value whose type has an intern_table is interned 
+// there, so intern(atom(5)) and intern(5) return the same atom. Lists and 
+// other values are interned in a table of atoms using hash() and equalv(), 
+// the interned atom is a copy_tree() of a, so later modifications through a 
+// do not affect it.
+namespace detail {
+template <>
+class intern_table<atom>
+{
+public:
+    static intern_table& instance()
+    {
+        static intern_table it;
+        return it;
+    }
+
+    inline atom intern(atom a)
+    {
+        if(is_interned(a)){ return a; }
+        else if(!is_nil(a) && !is_cons(a))
+        {
+            atom t = a.ctx->vt->intern(a.ctx->data());
+            if(!is_nil(t)){ return t; }
+        }
+
+        shard& sh = shards_[hash(a) % shard_count];
+        std::unique_lock<std::mutex> lk(sh.mtx);
+        auto it = sh.values.find(a);
+        if(it == sh.values.end())
+        {
+            arena_suspend as; // interned values live forever
+            atom c = copy_tree(a);
+            c.set_flag(interned_flag);
+            freeze(c); // interned values are visible to every thread
+            it = sh.values.insert(c).first;
+        }
+        return *it;
+    }
+
+private:
+    static constexpr size_t shard_count = 16;
+
+    struct atom_hash
+    {
+        size_t operator()(const atom& a) const { return hash(a); }
+    };
+
+    struct shard
+    {
+        std::mutex mtx;
+        std::unordered_set<atom,atom_hash> values;
+    };
+
+    shard shards_[shard_count];
+};
+}
+
+inline atom intern(atom a){ return detail::intern_table<atom>::instance().intern(a); }
+} // end fl
+
+namespace std {
+// allows atoms as keys in std::unordered_map and std::unordered_set, keys 
+// are compared with equalv()
+template <>
+struct hash<fl::atom>
+{
+    size_t operator()(const fl::atom& a) const { return fl::hash(a); }
+};
+}
+
+namespace fl {
+
+
+
+//-----------------------------------------------------------------------------
+// quote
+namespace detail {
+class quote{};
+}
+
+inline atom quote(atom a){ return cons(atom(detail::quote()),a); }
+inline bool is_quote(atom a){ return is<detail::quote>(a); }
+
+inline atom unquote(atom a)
+{
+    while(is_cons(a) && is_quote(car(a))){ a = cdr(a); }
+    return a;
+}
+
+
+
+//-----------------------------------------------------------------------------
+// eval 
+
+// The arguments of an fl::function call: either a list, or an array of atoms 
+// owned by the caller, usually on its stack. eval(f, args...) and the list 
+// algorithms pass arrays, so passing arguments allocates nothing. Functions 
+// converted with to_fl_function() read both forms directly. Converting an 
+// arg_span to an atom returns the list of its arguments, an array is then 
+// copied into a new list.
+class arg_span
+{
+public:
+    typedef atom value_type;
+
+    // the array must outlive the arg_span
+    arg_span(atom* first, size_t n) : first_(first), size_(n) {}
+    arg_span(atom lst) : first_(nullptr), size_(0), list_(std::move(lst)) {}
+
+    // the argument array, nullptr if the arguments are a list
+    inline atom* data() const { return first_; }
+
+    // count of arguments, see length() for lists
+    inline size_t size() const { return first_ ? size_ : length(list_); }
+
+    inline atom operator[](size_t i) const { return first_ ? first_[i] : nth(list_, i); }
+
+    // the arguments as a list
+    inline atom to_list() const
+    {
+        if(first_)
+        {
+            list_builder b(size_);
+            for(size_t i = 0; i < size_; ++i){ b.push_back(first_[i]); }
+            return b.finish();
+        }
+        else{ return list_; }
+    }
+
+private:
+    atom* first_;
+    size_t size_;
+    atom list_;
+};
+
+inline atom::atom(const arg_span& args) : atom(args.to_list()) {}
+inline atom::atom(arg_span& args) : atom(args.to_list()) {}
+inline atom::atom(arg_span&& args) : atom(args.to_list()) {}
+
+namespace detail {
+// true if a is a call: a list whose head is an fl::function
+inline bool is_call(const atom& a)
+{
+    return is_cons(a) && is<function>(value<cons_cell>(a).car());
+}
+
+// call the function at the head of the call c with the rest of c as its 
+// arguments, without evaluating them
+inline atom apply_call(const atom& c){ return value<function>(car(c))(arg_span(cdr(c))); }
+
+// the call a function returns in place of its result with fl::tail_call()
+struct tail_call_marker
+{
+    atom call;
+};
+}
+
+// true if a was returned by fl::tail_call() and has not been resolved yet
+inline bool is_tail_call(const atom& a){ return is<detail::tail_call_marker>(a); }
+
+// Return a call to f with the arguments ts from a function instead of making 
+// the call itself. eval(), run() and the algorithms built on them resolve the 
+// returned marker by calling f in a loop once the returning function has 
+// exited, so chains of tail calls of any length, mutually recursive functions 
+// and continuations which continue each other included, run in constant 
+// stack. Like eval(f, ts...) the arguments are passed as they are, without 
+// evaluating them. An fl::function which is called directly returns the 
+// marker unresolved, pass it to resolve() to finish the chain.
+//
+// Example:
+/*
+fl::atom count = fl::atom();
+count = [&](int n) -> fl::atom
+{
+    if(n == 0){ return fl::atom(0); }
+    return fl::tail_call(count, n - 1); // no stack frame is kept
+};
+int r = fl::value<int>(fl::eval(count, 1000000)); // 0
+ */
+template <typename F, typename... Ts>
+atom tail_call(F&& f, Ts&&... ts)
+{
+    atom c = list(std::forward<F>(f), std::forward<Ts>(ts)...);
+    if(!detail::is_call(c)){ throw std::invalid_argument("fl::tail_call() of an atom which is not a function"); }
+    return atom(detail::tail_call_marker{ std::move(c) });
+}
+
+// make the calls returned with fl::tail_call() until a function returns 
+// something else, and return that. Any other atom is returned unchanged.
+inline atom resolve(atom r)
+{
+    while(is_tail_call(r))
+    {
+        atom c = std::move(value<detail::tail_call_marker>(r).call);
+        r = detail::apply_call(c);
+    }
+    return r;
+}
+
+namespace detail {
+
+// array of atoms on the stack, or on the heap if more than 8 are needed
+class atom_buffer
+{
+public:
+    explicit atom_buffer(size_t n) : p_(n <= inline_size ? inline_ : new atom[n]) {}
+    ~atom_buffer(){ if(p_ != inline_){ delete[] p_; } }
+
+    atom_buffer(const atom_buffer&) = delete;
+    atom_buffer& operator=(const atom_buffer&) = delete;
+
+    inline atom* data(){ return p_; }
+
+private:
+    static constexpr size_t inline_size = 8;
+    atom inline_[inline_size];
+    atom* p_;
+};
+}
+
+// eval allows data to be treated as code. If the given atom is a list whose 
+// head is an fl::function, the function is called with the rest of the list 
+// as its arguments, which are passed as they are. Any other atom evaluates to
+// itself. Tail calls returned by the function are resolve()d before eval 
+// returns. See eval_tree() to evaluate the calls nested in the arguments.
+inline atom eval(atom a)
+{ 
+    if(is_cons(a))
+    {
+        const detail::cons_cell& c = value<detail::cons_cell>(a);
+        if(is<function>(c.car())){ return resolve(value<function>(c.car())(arg_span(c.cdr()))); }
+    }
+    return a;
+}
+
+// eval_tree evaluates an expression tree. Like eval() it calls a list whose 
+// head is an fl::function, but the arguments which are calls themselves are 
+// eval_tree()d first, in order, and the function is called with their 
+// results. Any other argument, a quote()d list included, is passed as it is.
+// compile() flattens the same expressions ahead of time.
+inline atom eval_tree(atom a)
+{ 
+    if(!detail::is_call(a)){ return a; }
+
+    atom f = car(a);
+    atom args = cdr(a);
+    size_t n = 0;
+    bool nested = false;
+
+    for(atom cur = args; is_cons(cur); cur = cdr(cur))
+    {
+        ++n;
+        nested = nested || detail::is_call(car(cur));
+    }
+
+    // arguments without calls are passed in the list itself
+    if(!nested){ return resolve(value<function>(f)(arg_span(std::move(args)))); }
+
+    detail::atom_buffer argv(n);
+    size_t i = 0;
+    for(atom cur = args; is_cons(cur); cur = cdr(cur), ++i){ argv.data()[i] = eval_tree(car(cur)); }
+    return resolve(value<function>(f)(arg_span(argv.data(), n)));
+}
+
+namespace detail {
+// call f with args. Callables other than fl::functions are invoked through 
+// their typed invoker directly, without being converted to an fl::function.
+// An atom which is not a function evaluates to the list of itself and its 
+// arguments, as eval() of that list would.
+inline atom apply_(const atom& f, const arg_span& args)
+{
+    if(is<function>(f)){ return value<function>(f)(args); }
+    else{ return cons(f, atom(args)); }
+}
+
+inline atom apply_(atom& f, const arg_span& args){ return apply_(static_cast<const atom&>(f), args); }
+inline atom apply_(atom&& f, const arg_span& args){ return apply_(static_cast<const atom&>(f), args); }
+inline atom apply_(const function& f, const arg_span& args){ return f(args); }
+inline atom apply_(function& f, const arg_span& args){ return f(args); }
+inline atom apply_(function&& f, const arg_span& args){ return f(args); }
+
+template <typename F, typename R, typename... As>
+atom apply_(F& f, const arg_span& args, R(*)(As...))
+{
+    return invoker_of<R,As...>::type::call(f, args);
+}
+
+template <typename F>
+atom apply_(F& f, const arg_span& args, atom(*)(const arg_span&)){ return f(args); }
+
+template <typename F>
+atom apply_(F& f, const arg_span& args, atom(*)(arg_span)){ return f(args); }
+
+template <typename F>
+atom apply_(F&& f, const arg_span& args)
+{
+    using fn = unqualified<F>;
+    using sig = typename signature_of<typename std::remove_pointer<fn>::type>::type;
+    return apply_(f, args, static_cast<sig*>(nullptr));
+}
+}
+
+// call f with the arguments ts, which are passed in an array on the stack 
+// rather than in a list. Like eval() of a list the arguments are passed as 
+// they are, without evaluating them.
+template <typename F, typename... Ts>
+inline atom eval(F&& f, Ts&&... ts)
+{ 
+    atom argv[] = { detail::to_atom(std::forward<Ts>(ts))..., atom() };
+    return resolve(detail::apply_(std::forward<F>(f), arg_span(argv, sizeof...(Ts))));
+}
+
+
+
+//-----------------------------------------------------------------------------
+// curry 
+namespace detail {
+// the function f expecting n arguments, with the arguments bound so far
+inline function curried(atom f, size_t n, std::vector<atom> bound)
+{
+    return [f, n, bound](const arg_span& args) -> atom
+    {
+        std::vector<atom> all(bound);
+        if(atom* first = args.data()){ all.insert(all.end(), first, first + args.size()); }
+        else
+        {
+            for(atom cur = args.to_list(); is_cons(cur); cur = cdr(cur)){ all.push_back(car(cur)); }
+        }
+
+        if(all.size() < n){ return atom(curried(f, n, std::move(all))); }
+        else{ return value<function>(f)(arg_span(all.data(), all.size())); }
+    };
+}
+}
+
+// curry takes any function, function pointer or function object with a 
+// fixed count of parameters and returns an fl::function which, called with 
+// fewer arguments than that, returns a function expecting the remaining ones.
+// Called with all of them it calls f.
+//
+// Example:
+/*
+fl::function add = fl::curry([](int a, int b, int c){ return a+b+c; });
+fl::atom add1 = add(fl::arg_span(fl::list(1)));
+int r = fl::value<int>(fl::eval(add1, 2, 3)); // 6
+ */
+template <typename F>
+function curry(F&& f)
+{
+    using fn = detail::unqualified<F>;
+    using sig = typename detail::signature_of<typename std::remove_pointer<fn>::type>::type;
+    return detail::curried(atom(to_fl_function(std::forward<F>(f))), 
+                           detail::function_traits<sig>::arity, 
+                           std::vector<atom>());
+}
+
+
+
+//-----------------------------------------------------------------------------
+// compile
+//
+// compile() flattens an expression into a program: a sequence of 
+// instructions over a stack of atoms, with every function and every constant 
+// stored once in the program. run() executes it with the same result as 
+// eval_tree() of the expression, but without walking the tree, type testing 
+// each node or copying car()s and cdr()s. The stack lives on the C++ stack 
+// unless the expression is deeply nested, so running a program allocates 
+// nothing but what its functions allocate.
+//
+// A program owns clones of the functions of the expression and copies of 
+// its constants, so the expression may be modified or dropped afterwards, 
+// and compile() throws std::logic_error if a function cannot be copied. The
+// constants are cow_copy_tree()d and functions receive handles to them on 
+// the stack, so a function writing through an atom& or T& parameter detaches
+// its own copy of the value and the program is left unchanged. Constants 
+// which are already frozen are shared as they are. The copies are made 
+// outside of any arena and share()d, so a program compiled in an arena or a 
+// local_scope outlives it. Programs are immutable and may be run from any 
+// number of threads at once.
+//
+// Example:
+/*
+atom expr = fl::list(add, fl::list(mul, 2, 3), 4);
+fl::program p = fl::compile(expr);
+atom r = fl::run(p); // 10, as fl::eval_tree(expr)
+ */
+
+class program
+{
+public:
+    program() : max_depth_(0) {}
+
+    // count of instructions
+    inline size_t size() const { return code_.size(); }
+
+private:
+    enum class op : unsigned char
+    {
+        constant, // push constants_[index]
+        call, // call functions_[fn] with the top count atoms of the stack, push the result
+        call_constants // call functions_[fn] with constants_[index,index+count), push the result
+    };
+
+    struct instruction
+    {
+        op code;
+        unsigned int count;
+        size_t index;
+        size_t fn;
+    };
+
+    std::vector<instruction> code_;
+    std::vector<atom> constants_;
+    std::vector<function> functions_;
+    size_t max_depth_; // stack size required to run
+
+    friend program compile(atom expr);
+    friend atom run(const program& p);
+};
+
+// compile the expression expr, see eval_tree()
+inline program compile(atom expr)
+{
+    struct frame
+    {
+        atom expr;
+        bool expanded; // the arguments have been compiled
+        unsigned int count; // count of arguments
+    };
+
+    program p;
+    std::vector<frame> todo;
+    size_t depth = 0;
+
+    // constants outlive any arena and are read by every thread running p
+    auto constant = [&](const atom& a)
+    {
+        detail::arena_suspend as;
+        p.constants_.push_back(is_frozen(a) && !is_arena_allocated(a) 
+                               ? a 
+                               : cow_copy_tree(share(copy_tree(a))));
+    };
+
+    auto push = [&](program::op code, unsigned int count, size_t index, const atom& fn)
+    {
+        size_t f = 0;
+        if(fn)
+        {
+            f = p.functions_.size();
+            p.functions_.push_back(value<function>(fn).clone());
+        }
+        p.code_.push_back(program::instruction{ code, count, index, f });
+    };
+
+    todo.push_back(frame{ std::move(expr), false, 0 });
+
+    while(!todo.empty())
+    {
+        frame f = std::move(todo.back());
+        todo.pop_back();
+
+        if(f.expanded)
+        {
+            push(program::op::call, f.count, 0, car(f.expr));
+            depth -= f.count;
+            ++depth;
+        }
+        else if(!detail::is_call(f.expr))
+        {
+            constant(f.expr);
+            push(program::op::constant, 0, p.constants_.size() - 1, atom());
+            ++depth;
+        }
+        else
+        {
+            std::vector<atom> args;
+            bool nested = false;
+            for(atom cur = cdr(f.expr); is_cons(cur); cur = cdr(cur))
+            {
+                args.push_back(car(cur));
+                nested = nested || detail::is_call(args.back());
+            }
+
+            if(nested)
+            {
+                todo.push_back(frame{ std::move(f.expr), true, (unsigned int)args.size() });
+                for(auto it = args.rbegin(); it != args.rend(); ++it)
+                {
+                    todo.push_back(frame{ std::move(*it), false, 0 });
+                }
+            }
+            else
+            {
+                // the arguments are stored consecutively
+                size_t first = p.constants_.size();
+                for(const atom& a : args){ constant(a); }
+                push(program::op::call_constants, (unsigned int)args.size(), first, car(f.expr));
+
+                // the arguments are copied onto the stack to make the call
+                if(depth + args.size() > p.max_depth_){ p.max_depth_ = depth + args.size(); }
+                ++depth;
+            }
+        }
+
+        if(depth > p.max_depth_){ p.max_depth_ = depth; }
+    }
+
+    return p;
+}
+
+// run a compiled program, returning the same result as eval_tree() of the 
+// expression it was compiled from
+inline atom run(const program& p)
+{
+    if(p.code_.empty()){ return atom(); }
+
+    detail::atom_buffer stack(p.max_depth_);
+    atom* sp = stack.data();
+    const atom* constants = p.constants_.data();
+
+    for(const program::instruction& i : p.code_)
+    {
+        switch(i.code)
+        {
+            case program::op::constant:
+                *sp++ = constants[i.index];
+                break;
+            case program::op::call:
+            {
+                sp -= i.count;
+                atom r = resolve(p.functions_[i.fn](arg_span(sp, i.count)));
+                for(unsigned int k = 1; k < i.count; ++k){ sp[k] = atom(); }
+                *sp++ = std::move(r);
+                break;
+            }
+            case program::op::call_constants:
+            {
+                // the arguments are copied, so functions cannot replace the 
+                // program's own atoms through atom& parameters
+                std::copy(constants + i.index, constants + i.index + i.count, sp);
+                atom r = resolve(p.functions_[i.fn](arg_span(sp, i.count)));
+                for(unsigned int k = 1; k < i.count; ++k){ sp[k] = atom(); }
+                *sp++ = std::move(r);
+                break;
+            }
+        }
+    }
+
+    return std::move(stack.data()[0]);
+}
+
+
+
+//-----------------------------------------------------------------------------
+// memoization
+//
+// memoize() wraps a function in a cache of its results, keyed by its 
+// arguments. Arguments are compared structurally, with hash() and equalv(), 
+// so a call with arguments equalv() to an earlier call's returns the earlier 
+// result without calling the function. The cache is split into independently 
+// locked shards and holds at most memo_policy::capacity results, evicting the 
+// least recently used (eviction::lru) or, cheaper to maintain on every hit, an
+// approximation of it (eviction::clock).
+//
+// A memoized function may be called from any number of threads at once, for 
+// instance by every worker of a workerpool. The wrapped function is called 
+// without holding any lock, so it may call the memoized function itself, and 
+// must be safe to call concurrently. The cache holds frozen copies of the 
+// arguments and results, the caller which computed a result receives it 
+// unchanged, every later caller shares the frozen copy. Only pure functions 
+// of their arguments should be memoized.
+//
+// Example:
+/*
+fl::memoized fib = fl::memoize([&](int n) -> int
+{ 
+    if(n < 2){ return n; }
+    return fl::value<int>(fl::eval(fib, n-1)) + fl::value<int>(fl::eval(fib, n-2));
+});
+atom r = fl::eval(fib, 80); 
+size_t hits = fib.hits();
+ */
+
+enum class eviction
+{
+    lru, // evict the least recently used result
+    clock // evict a result not used since the clock hand last passed it
+};
+
+struct memo_policy
+{
+    memo_policy(size_t c=1024, eviction e=eviction::lru) : capacity(c), evict(e) {}
+
+    size_t capacity; // maximum count of cached results
+    eviction evict;
+};
+
+namespace detail {
+template <typename V>
+void visit_args(const arg_span& args, V&& v)
+{
+    if(atom* first = args.data())
+    {
+        for(size_t i = 0; i < args.size(); ++i){ v(first[i]); }
+    }
+    else
+    {
+        for(atom cur = args.to_list(); is_cons(cur); cur = cdr(cur)){ v(car(cur)); }
+    }
+}
+
+inline size_t hash_args(const arg_span& args)
+{
+    size_t h = cons_hash_seed;
+    visit_args(args, [&h](const atom& a){ h = hash_combine(h, hash(a)); });
+    return h;
+}
+
+// true if the list key holds arguments equalv() to args
+inline bool equal_args(atom key, const arg_span& args)
+{
+    bool eq = true;
+    visit_args(args, [&](const atom& a)
+    {
+        if(eq)
+        {
+            eq = is_cons(key) && car(key).equalv(a);
+            if(eq){ key = cdr(key); }
+        }
+    });
+    return eq && !is_cons(key);
+}
+
+class memo_cache
+{
+public:
+    memo_cache(function f, const memo_policy& p) : 
+        fn_(std::move(f)), 
+        evict_(p.evict),
+        shard_count_(std::max<size_t>(1, std::min(p.capacity, max_shards))),
+        hits_(0),
+        misses_(0)
+    {
+        if(!fn_){ throw std::invalid_argument("fl::memoize() of an empty fl::function"); }
+
+        // distribute the capacity over the shards, the first ones receive 
+        // the remainder
+        for(size_t i = 0; i < shard_count_; ++i)
+        {
+            shards_[i].capacity = p.capacity / shard_count_ + 
+                                  (i < p.capacity % shard_count_ ? 1 : 0);
+            shards_[i].slots.reserve(shards_[i].capacity);
+        }
+    }
+
+    inline atom call(const arg_span& args)
+    {
+        const size_t h = hash_args(args);
+        // the low bits of h select the bucket inside the shard
+        shard& sh = shards_[(h >> 16) % shard_count_];
+
+        {
+            std::unique_lock<std::mutex> lk(sh.mtx);
+            atom r;
+            if(sh.find(h, args, evict_, r))
+            {
+                hits_.fetch_add(1, std::memory_order_relaxed);
+                return r;
+            }
+        }
+
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        atom r = resolve(fn_(args));
+        if(sh.capacity == 0){ return r; }
+
+        // the caller keeps using its arguments and the result, the cache 
+        // freezes copies
+        atom key;
+        atom cached;
+        {
+            arena_suspend as; // cached atoms outlive any arena
+            list_builder b(args.size());
+            visit_args(args, [&b](const atom& a)
+            { 
+                b.push_back(is_frozen(a) && !is_arena_allocated(a) ? a : copy_tree(a)); 
+            });
+            key = freeze(b.finish());
+            cached = is_frozen(r) && !is_arena_allocated(r) ? r : freeze(copy_tree(r));
+        }
+
+        // atoms evicted from the cache are released after unlocking
+        atom old_key;
+        atom old_result;
+        std::unique_lock<std::mutex> lk(sh.mtx);
+        sh.insert(h, std::move(key), std::move(cached), evict_, old_key, old_result);
+        return r;
+    }
+
+    inline size_t hits() const { return hits_.load(std::memory_order_relaxed); }
+    inline size_t misses() const { return misses_.load(std::memory_order_relaxed); }
+
+    inline size_t size()
+    {
+        size_t n = 0;
+        for(size_t i = 0; i < shard_count_; ++i)
+        {
+            std::unique_lock<std::mutex> lk(shards_[i].mtx);
+            n += shards_[i].slots.size();
+        }
+        return n;
+    }
+
+    inline void clear()
+    {
+        for(size_t i = 0; i < shard_count_; ++i)
+        {
+            std::vector<shard::slot> old;
+            {
+                std::unique_lock<std::mutex> lk(shards_[i].mtx);
+                old.swap(shards_[i].slots);
+                shards_[i].clear();
+            }
+        }
+    }
+
+private:
+    static constexpr size_t max_shards = 16;
+    static constexpr std::uint32_t none = std::uint32_t(-1);
+
+    struct shard
+    {
+        struct slot
+        {
+            atom key; // frozen list of the arguments
+            atom result;
+            size_t hash;
+            std::uint32_t prev; // lru order, most recently used first
+            std::uint32_t next;
+            bool referenced; // clock
+        };
+
+        inline bool find(size_t h, const arg_span& args, eviction e, atom& r)
+        {
+            auto range = index.equal_range(h);
+            for(auto it = range.first; it != range.second; ++it)
+            {
+                slot& s = slots[it->second];
+                if(equal_args(s.key, args))
+                {
+                    if(e == eviction::lru)
+                    {
+                        unlink(it->second);
+                        push_front(it->second);
+                    }
+                    else{ s.referenced = true; }
+                    r = s.result;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // cache the result r of the arguments key, unless another thread 
+        // cached a result for them first
+        inline void insert(size_t h, 
+                           atom key, 
+                           atom r, 
+                           eviction e, 
+                           atom& old_key, 
+                           atom& old_result)
+        {
+            auto range = index.equal_range(h);
+            for(auto it = range.first; it != range.second; ++it)
+            {
+                if(slots[it->second].key.equalv(key)){ return; }
+            }
+
+            std::uint32_t i;
+            if(slots.size() < capacity)
+            {
+                i = std::uint32_t(slots.size());
+                slots.push_back(slot{atom(), atom(), 0, none, none, false});
+            }
+            else
+            {
+                i = e == eviction::lru ? tail : next_victim();
+                if(e == eviction::lru){ unlink(i); }
+
+                auto old = index.equal_range(slots[i].hash);
+                for(auto it = old.first; it != old.second; ++it)
+                {
+                    if(it->second == i)
+                    {
+                        index.erase(it);
+                        break;
+                    }
+                }
+
+                old_key = std::move(slots[i].key);
+                old_result = std::move(slots[i].result);
+            }
+
+            slot& s = slots[i];
+            s.key = std::move(key);
+            s.result = std::move(r);
+            s.hash = h;
+            s.referenced = false;
+            if(e == eviction::lru){ push_front(i); }
+            index.emplace(h, i);
+        }
+
+        // advance the clock hand past referenced slots, clearing their 
+        // reference, and return the first unreferenced one
+        inline std::uint32_t next_victim()
+        {
+            while(slots[hand].referenced)
+            {
+                slots[hand].referenced = false;
+                hand = (hand + 1) % slots.size();
+            }
+            std::uint32_t i = hand;
+            hand = (hand + 1) % slots.size();
+            return i;
+        }
+
+        inline void unlink(std::uint32_t i)
+        {
+            slot& s = slots[i];
+            if(s.prev != none){ slots[s.prev].next = s.next; }
+            else{ head = s.next; }
+            if(s.next != none){ slots[s.next].prev = s.prev; }
+            else{ tail = s.prev; }
+            s.prev = none;
+            s.next = none;
+        }
+
+        inline void push_front(std::uint32_t i)
+        {
+            slot& s = slots[i];
+            s.prev = none;
+            s.next = head;
+            if(head != none){ slots[head].prev = i; }
+            head = i;
+            if(tail == none){ tail = i; }
+        }
+
+        inline void clear()
+        {
+            slots.clear();
+            slots.reserve(capacity);
+            index.clear();
+            head = none;
+            tail = none;
+            hand = 0;
+        }
+
+        std::mutex mtx;
+        size_t capacity = 0;
+        std::vector<slot> slots;
+        std::unordered_multimap<size_t,std::uint32_t> index; // hash to slot
+        std::uint32_t head = none;
+        std::uint32_t tail = none;
+        std::uint32_t hand = 0;
+    };
+
+    function fn_;
+    const eviction evict_;
+    const size_t shard_count_;
+    shard shards_[max_shards];
+    std::atomic<size_t> hits_;
+    std::atomic<size_t> misses_;
+};
+}
+
+// A memoized function, returned by memoize(). Copies share the same cache, 
+// storing a memoized in an atom stores it as an fl::function which receives 
+// the whole arg_span.
+class memoized
+{
+public:
+    memoized(function f, const memo_policy& p=memo_policy()) : 
+        cache_(std::make_shared<detail::memo_cache>(std::move(f), p))
+    { }
+
+    inline atom operator()(const arg_span& args) const { return cache_->call(args); }
+
+    // count of calls answered from the cache
+    inline size_t hits() const { return cache_->hits(); }
+
+    // count of calls which called the wrapped function
+    inline size_t misses() const { return cache_->misses(); }
+
+    // count of cached results
+    inline size_t size() const { return cache_->size(); }
+
+    // drop every cached result, the counters are kept
+    inline void clear(){ cache_->clear(); }
+
+private:
+    std::shared_ptr<detail::memo_cache> cache_;
+};
+
+// return f with its results cached according to policy p. f may be an 
+// fl::function, an atom holding one, or any callable to_fl_function() 
+// accepts.
+template <typename F>
+memoized memoize(F&& f, const memo_policy& p=memo_policy())
+{
+    return memoized(to_fl_function(std::forward<F>(f)), p);
+}
+
+inline memoized memoize(const atom& f, const memo_policy& p=memo_policy())
+{
+    return memoized(value<function>(f).clone(), p);
+}
+
+inline memoized memoize(atom& f, const memo_policy& p=memo_policy())
+{
+    return memoize(static_cast<const atom&>(f), p);
+}
+
+inline memoized memoize(atom&& f, const memo_policy& p=memo_policy())
+{
+    return memoize(static_cast<const atom&>(f), p);
+}
+
+
+
+//-----------------------------------------------------------------------------
+// atom printing 
+
+
+namespace detail {
+// The registry of type names and printers. Both are reached through the 
+// atom's vtable: printers are fixed when the vtable is instantiated and names
+// live in per-type slots, so printing takes no lock and does no lookup, 
+// however many threads print at once. Registration only writes the slot of 
+// its own type.
+class print_map
+{
+public:
+    static inline std::pair<std::string,std::string> get_value_info(atom a)
+    {
+        return std::pair<std::string,std::string>(get_type(a),get_value(a));
+    }
+
+    // the registered name of a's type, empty if it was never registered
+    static inline const std::string& get_type_name(atom a)
+    {
+        static const std::string unregistered;
+        const std::string* n = a.ctx->vt->name->load(std::memory_order_acquire);
+        return n ? *n : unregistered;
+    }
+
+    static inline std::string get_type(atom a){ return get_type_name(a); }
+
+    // values are printed by their type's vtable, no lookup is required
+    static inline std::string get_value(atom a){ return a.ctx->vt->print(a.ctx->data()); }
+
+    // format a's value into [first,last) without allocating, returns the 
+    // end of the value or nullptr if a's type cannot be formatted this way
+    static inline char* format_value(atom a, char* first, char* last)
+    {
+        return a.ctx->vt->format(a.ctx->data(), first, last);
+    }
+
+private:
+    template <typename T> 
+    static void register_type(const char* name)
+    { 
+        // names are interned in the symbol table, which never frees them
+        const std::string* n = &(symbol(name).name());
+
+        // don't modify an already registered type
+        const std::string* expected = nullptr;
+        detail::type_name<T>::value.compare_exchange_strong(expected, 
+                                                             n, 
+                                                             std::memory_order_acq_rel);
+    } 
+
+    template <typename T> friend class register_type;
+};
+
+template <typename T>
+class register_type
+{
+public:
+    register_type(const char* name){ print_map::register_type<T>(name); }
+};
+}
+inline std::string atom_name(atom a){ return detail::print_map::get_type(a); }
+inline std::string atom_value(atom a){ return detail::print_map::get_value(a); }
+
+// returns a name,value pair
+inline std::pair<std::string,std::string> atom_type_info(atom a)
+{ 
+    return detail::print_map::get_value_info(a); 
+}
+
+
+// the string representation of a, with the type name of every value: a list
+// is written as (int:1 std::string:"two"), a pvector as [int:1 int:2] and a 
+// pmap as {int:1 int:2, int:3 int:4}. Defined with write(), which writes the 
+// same representation to an std::ostream.
+inline std::string to_string(atom a);
+
+
+
+//-----------------------------------------------------------------------------
+// iteration
+namespace detail {
+inline void iterate_(){ return; }
+
+template <typename A, typename... As>
+void iterate_(A& a, As&... as)
+{ 
+    a = cdr(a);
+    iterate_(as...); 
+}
+}
+
+// map, the results are returned in order in a list of the length of a
+template <typename F, typename... As>
+atom map(F&& f, atom a, As... as)
+{
+    size_t len;
+    list_builder ret(detail::run_cells::length(a,len) ? len : 0);
+
+    while(!is_nil(a))
+    {
+        ret.push_back(eval(f,car(a),car(as)...));
+        detail::iterate_(a,as...);
+    }
+    return ret.finish();
+}
+
+// map length
+template <typename F, typename... As>
+atom mapl(F&& f, size_t len, atom a, As... as)
+{
+    list_builder ret(len);
+
+    while(len)
+    {
+        --len;
+        ret.push_back(eval(f,car(a),car(as)...));
+        detail::iterate_(a,as...);
+    }
+    return ret.finish();
+}
+
+// fold left, f is called with the accumulated value and a list of the 
+// current element of each list
+template <typename F, typename... As>
+atom foldl(F&& f, atom init, atom a, As... as)
+{
+    while(!is_nil(a))
+    {
+        init = eval(f,init,list(car(a),car(as)...));
+        detail::iterate_(a,as...);
+    }
+    return init;
+}
+
+// fold left-to-right length 
+template <typename F, typename... As>
+atom foldll(F&& f, size_t len, atom init, atom a, As... as)
+{
+    while(len)
+    {
+        --len;
+        init = eval(f,init,list(car(a),car(as)...));
+        detail::iterate_(a,as...);
+    }
+    return init;
+}
+
+// fold right-to-left
+template <typename F, typename... As>
+atom foldr(F&& f, atom init, atom a, As... as)
+{
+    return foldl(std::forward<F>(f),init,reverse(a),reverse(as)...);
+}
+
+// fold right-to-left length
+template <typename F, typename... As>
+atom foldrl(F&& f, size_t len, atom init, atom a, As... as)
+{
+    return foldll(std::forward<F>(f),len,init,reverse(a),reverse(as)...);
+}
+
+// variadic fold left, f is called with the accumulated value followed by the 
+// current element of each list as separate arguments, so no list is built 
+// for each step
+template <typename F, typename... As>
+atom foldlv(F&& f, atom init, atom a, As... as)
+{
+    while(!is_nil(a))
+    {
+        init = eval(f,init,car(a),car(as)...);
+        detail::iterate_(a,as...);
+    }
+    return init;
+}
+
+// variadic fold left-to-right length 
+template <typename F, typename... As>
+atom foldllv(F&& f, size_t len, atom init, atom a, As... as)
+{
+    while(len)
+    {
+        --len;
+        init = eval(f,init,car(a),car(as)...);
+        detail::iterate_(a,as...);
+    }
+    return init;
+}
+
+// variadic fold right-to-left
+template <typename F, typename... As>
+atom foldrv(F&& f, atom init, atom a, As... as)
+{
+    return foldlv(std::forward<F>(f),init,reverse(a),reverse(as)...);
+}
+
+// variadic fold right-to-left length
+template <typename F, typename... As>
+atom foldrlv(F&& f, size_t len, atom init, atom a, As... as)
+{
+    return foldllv(std::forward<F>(f),len,init,reverse(a),reverse(as)...);
+}
+
+//TODO: implement the following (racket) iterating algorithms:
+/*
+ andmap
+ andmapl
+ ormap
+ ormapl
+ for_each
+ filter
+ remove 
+ remv
+ remp
+ remove_set
+ remsetv
+ remsetp
+ sort
+ member
+ memv
+ memp
+ memf
+ findf
+ assoc
+ assv
+ assp
+ assf
+ */
+
+
+
+//-----------------------------------------------------------------------------
+// stream
+//
+// fl::stream is a lazy list. It holds its first element and a call (f args...)
+// for the rest of the stream, which is only made when stream_cdr() is first 
+// called. Like eval(f, args...) the arguments are passed as they are, so 
+// they may be any data. The result, another stream atom or nil at the end of 
+// the stream, is memoized and shared by every copy of the stream, so the call 
+// is made at most once even when several threads force it. 
+//
+// Elements are only computed as they are consumed, and a stream cell is freed
+// as soon as nothing refers to it anymore, so a pipeline which does not hold 
+// on to the front of its input runs in constant memory whatever the length of
+// the data, and stops computing as soon as the consumer stops asking. 
+//
+// The stream algorithms take their streams by value and drop each cell as 
+// they move past it, pass temporaries or std::move() the streams to keep them
+// from being retained.
+//
+// Example:
+/*
+// the infinite stream n, n+1, n+2...
+atom integers(int n)
+{
+    return fl::make_stream(n, integers, n + 1);
+}
+
+atom squares = fl::stream_map([](int i){ return i*i; }, integers(1));
+atom first10 = fl::stream_to_list(fl::stream_take(10, std::move(squares)));
+ */
+
+namespace detail {
+// the memoized rest of a stream
+struct stream_delay
+{
+    explicit stream_delay(atom e) : expr(std::move(e)), done(false) {}
+
+    std::once_flag once;
+    atom expr;
+    atom value;
+    std::atomic<bool> done;
+};
+}
+
+class stream
+{
+public:
+    // rest is a call made the first time it is needed, which must return a 
+    // stream atom or nil. Any other atom is the rest of the stream itself.
+    stream(atom first, atom rest) : 
+        car_(std::move(first)), 
+        cdr_(std::make_shared<detail::stream_delay>(std::move(rest)))
+    {}
+
+    inline const atom& car() const { return car_; }
+
+    // force the rest of the stream
+    inline atom cdr() const
+    {
+        detail::stream_delay& d = *cdr_;
+        if(!d.done.load(std::memory_order_acquire))
+        {
+            std::call_once(d.once, [&d]{
+                d.value = detail::is_call(d.expr) ? resolve(detail::apply_call(d.expr)) : d.expr;
+                d.expr = atom(); // the expression is not needed anymore
+                d.done.store(true, std::memory_order_release);
+            });
+        }
+        return d.value;
+    }
+
+    // true if the rest of the stream has been evaluated
+    inline bool forced() const { return cdr_->done.load(std::memory_order_acquire); }
+
+    // streams are equal if they are copies of each other
+    inline bool operator==(const stream& rhs) const { return cdr_ == rhs.cdr_; }
+
+private:
+    atom car_;
+    std::shared_ptr<detail::stream_delay> cdr_;
+};
+
+inline bool is_stream(atom a){ return is<stream>(a); }
+
+// return a stream of first followed by the stream returned by eval(f, ts...)
+template <typename F, typename... Ts>
+atom make_stream(atom first, F&& f, Ts&&... ts)
+{
+    return atom(stream(std::move(first), list(std::forward<F>(f), std::forward<Ts>(ts)...)));
+}
+
+// the first element of a stream
+inline atom stream_car(atom s){ return value<stream>(s).car(); }
+
+// the rest of a stream, evaluating it if necessary
+inline atom stream_cdr(atom s){ return value<stream>(s).cdr(); }
+
+namespace detail {
+// nil and false are false, everything else is true
+inline bool is_true(const atom& a){ return !is_nil(a) && !(is<bool>(a) && value<bool>(a)==false); }
+}
+
+// lazily apply f to every element of s
+template <typename F>
+atom stream_map(F&& f, atom s)
+{
+    if(is_nil(s)){ return s; }
+    else 
+    {
+        atom fa = detail::to_atom(std::forward<F>(f));
+        atom first = eval(fa, stream_car(s));
+        return make_stream(std::move(first), 
+                           [](atom f, atom s){ return stream_map(f, stream_cdr(s)); }, 
+                           std::move(fa), 
+                           std::move(s));
+    }
+}
+
+// lazily keep the elements of s for which f is true. Elements are skipped 
+// until one is kept, so filtering an infinite stream which never again 
+// matches does not return.
+template <typename F>
+atom stream_filter(F&& f, atom s)
+{
+    atom fa = detail::to_atom(std::forward<F>(f));
+    while(!is_nil(s) && !detail::is_true(eval(fa, stream_car(s)))){ s = stream_cdr(s); }
+
+    if(is_nil(s)){ return s; }
+    else 
+    {
+        atom first = stream_car(s);
+        return make_stream(std::move(first), 
+                           [](atom f, atom s){ return stream_filter(f, stream_cdr(s)); }, 
+                           std::move(fa), 
+                           std::move(s));
+    }
+}
+
+// lazily take the first n elements of s
+inline atom stream_take(size_t n, atom s)
+{
+    if(!n || is_nil(s)){ return atom(); }
+    else if(n == 1){ return atom(stream(stream_car(s), atom())); } // don't force s
+    else 
+    {
+        atom first = stream_car(s);
+        return make_stream(std::move(first), 
+                           [](size_t n, atom s){ return stream_take(n, stream_cdr(s)); }, 
+                           n - 1, 
+                           std::move(s));
+    }
+}
+
+// fold left over s, forcing it to its end
+template <typename F>
+atom stream_foldl(F&& f, atom init, atom s)
+{
+    while(!is_nil(s))
+    {
+        init = eval(f, init, stream_car(s));
+        s = stream_cdr(s);
+    }
+    return init;
+}
+
+// force s to its end and return its elements as a list
+inline atom stream_to_list(atom s)
+{
+    list_builder b;
+    while(!is_nil(s))
+    {
+        b.push_back(stream_car(s));
+        s = stream_cdr(s);
+    }
+    return b.finish();
+}
+
+// return a stream of the elements of lst, the list is kept alive until the 
+// stream is consumed
+inline atom list_to_stream(atom lst)
+{
+    if(is_nil(lst)){ return lst; }
+    else 
+    {
+        atom first = car(lst);
+        // a callable taking one atom receives the whole argument list
+        return make_stream(std::move(first), 
+                           [](atom args){ return list_to_stream(car(args)); }, 
+                           cdr(lst));
+    }
+}
+
+
+
+//-----------------------------------------------------------------------------
+// pvector
+//
+// fl::pvector is an immutable vector of atoms stored in a 32-way radix tree. 
+// Indexing, update (assoc()), push_back() and pop_back() are O(log32 n), 
+// which is effectively constant, and every operation returns a new pvector 
+// sharing all untouched nodes with the original. Because nodes are never 
+// modified after construction a pvector is safe to read from any number of 
+// threads, and copy() of a pvector atom is O(1). 
+//
+// The last (up to) 32 elements are kept in a separate tail leaf, so 
+// push_back() only touches the tree once every 32 elements.
+//
+// Example:
+/*
+atom v = fl::make_pvector(1, 2, 3);
+const fl::pvector& pv = fl::value<fl::pvector>(v);
+atom v2 = pv.push_back(4).assoc(0, 0); // [0 2 3 4], v is still [1 2 3]
+std::vector<int> iv = fl::reconstitute_container<std::vector<int>>(v2);
+ */
+
+namespace detail {
+// node of a pvector's radix tree, leaves hold atoms and branches hold nodes
+struct pvector_node
+{
+    static constexpr size_t bits = 5;
+    static constexpr size_t width = 1 << bits;
+    static constexpr size_t mask = width - 1;
+
+    explicit pvector_node(bool is_leaf) : refs(1), leaf(is_leaf) {}
+
+    inline void retain(){ refs.fetch_add(1, std::memory_order_relaxed); }
+    static inline void release(pvector_node* n);
+
+    std::atomic<unsigned int> refs;
+    const bool leaf;
+};
+
+struct pvector_leaf : public pvector_node
+{
+    pvector_leaf() : pvector_node(true) {}
+
+    // copy the first count values of rhs
+    pvector_leaf(const pvector_leaf& rhs, size_t count) : pvector_node(true)
+    {
+        std::copy(rhs.values, rhs.values + count, values);
+    }
+
+    atom values[width];
+};
+
+struct pvector_branch : public pvector_node
+{
+    pvector_branch() : pvector_node(false) 
+    { 
+        std::fill(children, children + width, nullptr); 
+    }
+
+    pvector_branch(const pvector_branch& rhs) : pvector_node(false)
+    {
+        for(size_t i=0; i<width; ++i)
+        {
+            children[i] = rhs.children[i];
+            if(children[i]){ children[i]->retain(); }
+        }
+    }
+
+    ~pvector_branch()
+    {
+        for(pvector_node* c : children)
+        {
+            if(c){ release(c); }
+        }
+    }
+
+    pvector_node* children[width];
+};
+
+inline void pvector_node::release(pvector_node* n)
+{
+    if(n->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        if(n->leaf){ delete static_cast<pvector_leaf*>(n); }
+        else{ delete static_cast<pvector_branch*>(n); }
+    }
+}
+}
+
+class pvector 
+{
+public:
+    class const_iterator;
+
+    pvector() noexcept : size_(0), shift_(bits), root_(nullptr), tail_(nullptr) {}
+
+    // construct from a range of values or atoms
+    template <typename IT>
+    pvector(IT first, IT last) : pvector()
+    {
+        for(; first != last; ++first){ append(detail::to_atom(*first)); }
+    }
+
+    pvector(const pvector& rhs) noexcept : 
+        size_(rhs.size_), 
+        shift_(rhs.shift_), 
+        root_(rhs.root_), 
+        tail_(rhs.tail_)
+    {
+        if(root_){ root_->retain(); }
+        if(tail_){ tail_->retain(); }
+    }
+
+    pvector(pvector&& rhs) noexcept : pvector() { swap(rhs); }
+
+    ~pvector()
+    {
+        if(root_){ detail::pvector_node::release(root_); }
+        if(tail_){ detail::pvector_node::release(tail_); }
+    }
+
+    pvector& operator=(const pvector& rhs)
+    {
+        pvector(rhs).swap(*this);
+        return *this;
+    }
+
+    pvector& operator=(pvector&& rhs) noexcept
+    {
+        pvector(std::move(rhs)).swap(*this);
+        return *this;
+    }
+
+    inline void swap(pvector& rhs) noexcept
+    {
+        std::swap(size_, rhs.size_);
+        std::swap(shift_, rhs.shift_);
+        std::swap(root_, rhs.root_);
+        std::swap(tail_, rhs.tail_);
+    }
+
+    inline size_t size() const { return size_; }
+    inline bool empty() const { return size_ == 0; }
+
+    // unchecked element access
+    inline const atom& operator[](size_t i) const 
+    { 
+        return leaf_for(i)->values[i & detail::pvector_node::mask]; 
+    }
+
+    // element access, throws std::out_of_range if i >= size()
+    inline const atom& nth(size_t i) const
+    {
+        if(i >= size_){ throw std::out_of_range("fl::pvector index out of range"); }
+        return (*this)[i];
+    }
+
+    // return a pvector with v appended
+    inline pvector push_back(atom v) const
+    {
+        pvector ret(*this);
+        ret.append(std::move(v));
+        return ret;
+    }
+
+    // return a pvector with the element at index i replaced by v, i == size()
+    // appends v. Throws std::out_of_range if i > size().
+    inline pvector assoc(size_t i, atom v) const
+    {
+        if(i == size_){ return push_back(std::move(v)); }
+        else if(i > size_){ throw std::out_of_range("fl::pvector index out of range"); }
+
+        pvector ret(*this);
+        share(v);
+
+        if(i >= tail_offset())
+        {
+            detail::pvector_leaf* t = new detail::pvector_leaf(*tail_, tail_count());
+            t->values[i & detail::pvector_node::mask] = std::move(v);
+            detail::pvector_node::release(ret.tail_);
+            ret.tail_ = t;
+        }
+        else 
+        {
+            detail::pvector_node* r = assoc_(shift_, root_, i, std::move(v));
+            detail::pvector_node::release(ret.root_);
+            ret.root_ = r;
+        }
+
+        return ret;
+    }
+
+    // return a pvector without the last element, throws std::out_of_range if
+    // empty
+    inline pvector pop_back() const
+    {
+        if(!size_){ throw std::out_of_range("fl::pvector is empty"); }
+        else if(size_ == 1){ return pvector(); }
+
+        pvector ret(*this);
+
+        if(tail_count() > 1)
+        {
+            detail::pvector_leaf* t = new detail::pvector_leaf(*tail_, tail_count() - 1);
+            detail::pvector_node::release(ret.tail_);
+            ret.tail_ = t;
+        }
+        else 
+        {
+            // the last leaf of the tree becomes the tail
+            detail::pvector_leaf* t = leaf_for(size_ - 2);
+            t->retain();
+            detail::pvector_node* r = pop_tail(shift_, root_);
+            size_t shift = shift_;
+
+            if(r && shift > bits)
+            {
+                detail::pvector_branch* b = static_cast<detail::pvector_branch*>(r);
+                if(!b->children[1])
+                {
+                    detail::pvector_node* c = b->children[0];
+                    c->retain();
+                    detail::pvector_node::release(r);
+                    r = c;
+                    shift -= bits;
+                }
+            }
+
+            detail::pvector_node::release(ret.tail_);
+            detail::pvector_node::release(ret.root_);
+            ret.tail_ = t;
+            ret.root_ = r;
+            ret.shift_ = r ? shift : bits;
+        }
+
+        --ret.size_;
+        return ret;
+    }
+
+    inline const_iterator begin() const;
+    inline const_iterator end() const;
+
+    // element wise equalv()
+    inline bool operator==(const pvector& rhs) const
+    {
+        if(size_ != rhs.size_){ return false; }
+        else if(root_ == rhs.root_ && tail_ == rhs.tail_){ return true; }
+
+        for(size_t i=0; i<size_; ++i)
+        {
+            if(!equalv((*this)[i], rhs[i])){ return false; }
+        }
+        return true;
+    }
+
+    inline bool operator!=(const pvector& rhs) const { return !(*this == rhs); }
+
+private:
+    static constexpr size_t bits = detail::pvector_node::bits;
+    static constexpr size_t width = detail::pvector_node::width;
+
+    // index of the first element stored in the tail
+    inline size_t tail_offset() const 
+    { 
+        return size_ < width ? 0 : ((size_ - 1) >> bits) << bits; 
+    }
+
+    inline size_t tail_count() const { return size_ - tail_offset(); }
+
+    inline detail::pvector_leaf* leaf_for(size_t i) const
+    {
+        if(i >= tail_offset()){ return tail_; }
+
+        detail::pvector_node* n = root_;
+        for(size_t level = shift_; level; level -= bits)
+        {
+            n = static_cast<detail::pvector_branch*>(n)->children[(i >> level) & detail::pvector_node::mask];
+        }
+        return static_cast<detail::pvector_leaf*>(n);
+    }
+
+    // Append v to this pvector. The tail is only modified in place while this
+    // pvector is its sole owner, which is only guaranteed for pvectors which 
+    // have not been published yet, otherwise it is copied.
+    inline void append(atom v)
+    {
+        share(v);
+        size_t count = tail_count();
+
+        if(!tail_)
+        {
+            tail_ = new detail::pvector_leaf;
+        }
+        else if(count == width)
+        {
+            push_tail();
+            tail_ = new detail::pvector_leaf;
+            count = 0;
+        }
+        else if(tail_->refs.load(std::memory_order_acquire) > 1)
+        {
+            detail::pvector_leaf* t = new detail::pvector_leaf(*tail_, count);
+            detail::pvector_node::release(tail_);
+            tail_ = t;
+        }
+
+        tail_->values[count] = std::move(v);
+        ++size_;
+    }
+
+    // move the full tail into the tree, the tail reference is transferred
+    inline void push_tail()
+    {
+        detail::pvector_node* t = tail_;
+        tail_ = nullptr;
+
+        if(!root_)
+        {
+            detail::pvector_branch* b = new detail::pvector_branch;
+            b->children[0] = t;
+            root_ = b;
+            shift_ = bits;
+        }
+        else if((size_ >> bits) > (size_t(1) << shift_)) // root is full
+        {
+            detail::pvector_branch* b = new detail::pvector_branch;
+            b->children[0] = root_;
+            b->children[1] = new_path(shift_, t);
+            root_ = b;
+            shift_ += bits;
+        }
+        else 
+        {
+            detail::pvector_node* r = push_tail_(shift_, root_, t);
+            detail::pvector_node::release(root_);
+            root_ = r;
+        }
+    }
+
+    inline detail::pvector_node* push_tail_(size_t level, 
+                                             detail::pvector_node* parent, 
+                                             detail::pvector_node* t) const
+    {
+        size_t sub = ((size_ - 1) >> level) & detail::pvector_node::mask;
+        detail::pvector_branch* ret = new detail::pvector_branch(
+            *static_cast<detail::pvector_branch*>(parent));
+
+        if(level == bits){ ret->children[sub] = t; }
+        else 
+        {
+            detail::pvector_node* child = ret->children[sub];
+            if(child)
+            {
+                ret->children[sub] = push_tail_(level - bits, child, t);
+                detail::pvector_node::release(child);
+            }
+            else{ ret->children[sub] = new_path(level - bits, t); }
+        }
+
+        return ret;
+    }
+
+    static inline detail::pvector_node* new_path(size_t level, detail::pvector_node* n)
+    {
+        if(!level){ return n; }
+        detail::pvector_branch* b = new detail::pvector_branch;
+        b->children[0] = new_path(level - bits, n);
+        return b;
+    }
+
+    static inline detail::pvector_node* assoc_(size_t level, 
+                                               detail::pvector_node* n, 
+                                               size_t i, 
+                                               atom&& v)
+    {
+        if(!level)
+        {
+            detail::pvector_leaf* l = new detail::pvector_leaf(
+                *static_cast<detail::pvector_leaf*>(n), width);
+            l->values[i & detail::pvector_node::mask] = std::move(v);
+            return l;
+        }
+        else 
+        {
+            detail::pvector_branch* b = new detail::pvector_branch(
+                *static_cast<detail::pvector_branch*>(n));
+            size_t sub = (i >> level) & detail::pvector_node::mask;
+            detail::pvector_node* child = b->children[sub];
+            b->children[sub] = assoc_(level - bits, child, i, std::move(v));
+            detail::pvector_node::release(child);
+            return b;
+        }
+    }
+
+    // return a copy of n without its last leaf, nullptr if n becomes empty
+    inline detail::pvector_node* pop_tail(size_t level, detail::pvector_node* n) const
+    {
+        size_t sub = ((size_ - 2) >> level) & detail::pvector_node::mask;
+        detail::pvector_branch* b = static_cast<detail::pvector_branch*>(n);
+
+        if(level > bits)
+        {
+            detail::pvector_node* child = pop_tail(level - bits, b->children[sub]);
+            if(!child && !sub){ return nullptr; }
+
+            detail::pvector_branch* ret = new detail::pvector_branch(*b);
+            detail::pvector_node::release(ret->children[sub]);
+            ret->children[sub] = child;
+            return ret;
+        }
+        else if(!sub){ return nullptr; }
+        else 
+        {
+            detail::pvector_branch* ret = new detail::pvector_branch(*b);
+            detail::pvector_node::release(ret->children[sub]);
+            ret->children[sub] = nullptr;
+            return ret;
+        }
+    }
+
+    size_t size_;
+    size_t shift_;
+    detail::pvector_node* root_;
+    detail::pvector_leaf* tail_;
+};
+
+// forward iterator over the elements of a pvector, valid as long as the 
+// pvector is
+class pvector::const_iterator
+{
+public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef atom value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const atom* pointer;
+    typedef const atom& reference;
+
+    const_iterator() : v_(nullptr), i_(0), leaf_(nullptr) {}
+    const_iterator(const pvector* v, size_t i) : v_(v), i_(i), leaf_(nullptr) {}
+
+    inline const atom& operator*() const 
+    { 
+        if(!leaf_){ leaf_ = v_->leaf_for(i_); }
+        return leaf_->values[i_ & detail::pvector_node::mask]; 
+    }
+
+    inline const atom* operator->() const { return &**this; }
+
+    inline const_iterator& operator++()
+    {
+        ++i_;
+        if(!(i_ & detail::pvector_node::mask)){ leaf_ = nullptr; } // next leaf
+        return *this;
+    }
+
+    inline const_iterator operator++(int)
+    {
+        const_iterator ret(*this);
+        ++*this;
+        return ret;
+    }
+
+    inline bool operator==(const const_iterator& rhs) const { return i_ == rhs.i_ && v_ == rhs.v_; }
+    inline bool operator!=(const const_iterator& rhs) const { return !(*this == rhs); }
+
+private:
+    const pvector* v_;
+    size_t i_;
+    mutable const detail::pvector_leaf* leaf_; // leaf containing i_
+};
+
+inline pvector::const_iterator pvector::begin() const { return const_iterator(this, 0); }
+inline pvector::const_iterator pvector::end() const { return const_iterator(this, size_); }
+
+namespace detail {
+// prints the elements as [a b c]
+inline std::string print_value(const pvector& v, std::false_type){ return to_string(atom(v)); }
+}
+} // end fl
+
+namespace std {
+// consistent with pvector's element wise equalv()
+template <>
+struct hash<fl::pvector>
+{
+    size_t operator()(const fl::pvector& v) const 
+    { 
+        size_t h = v.size();
+        for(const fl::atom& a : v){ h = fl::detail::hash_combine(h, fl::hash(a)); }
+        return h;
+    }
+};
+}
+
+namespace fl {
+inline bool is_pvector(atom a){ return is<pvector>(a); }
+
+// return an atom containing a pvector of the arguments
+inline atom make_pvector(){ return atom(pvector()); }
+
+template <typename T, typename... Ts>
+atom make_pvector(T&& t, Ts&&... ts)
+{
+    atom elems[] = { detail::to_atom(std::forward<T>(t)), 
+                     detail::to_atom(std::forward<Ts>(ts))... };
+    return atom(pvector(std::begin(elems), std::end(elems)));
+}
+
+
+
+//-----------------------------------------------------------------------------
+// pmap
+//
+// fl::pmap is an immutable map from atoms to atoms implemented as a hash array
+// mapped trie. Keys are hashed with fl::hash() and compared with equalv(), so 
+// lists, strings and numbers are looked up by value. get(), assoc() and 
+// dissoc() are O(log32 n), and like pvector every operation returns a new 
+// pmap sharing all untouched nodes with the original. 
+//
+// Keys are frozen when inserted (a frozen key is used as is, any other key is
+// copy_tree()d and frozen) so a key's hash never changes, values are share()d.
+// Nodes are never modified once published, so a pmap can be read from any 
+// number of threads. Copying a pmap atom, which is what channel::send() and 
+// continuations do with non-frozen atoms, is O(1) and never copies the map's 
+// entries. freeze() a pmap atom to pass it without even that.
+//
+// Example:
+/*
+atom m = fl::make_pmap("one", 1, "two", 2);
+const fl::pmap& pm = fl::value<fl::pmap>(m);
+atom m2 = pm.assoc("three", 3).dissoc("one"); // m is unchanged
+atom v = fl::value<fl::pmap>(m2).get("two"); // 2
+ */
+
+namespace detail {
+inline unsigned int popcount32(std::uint32_t x)
+{
+    x = x - ((x >> 1) & 0x55555555);
+    x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+    return (((x + (x >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+struct pmap_entry
+{
+    atom key;
+    atom value;
+    size_t hash; // fl::hash() of key
+};
+
+// Node of a pmap's trie. datamap marks the 5 bit hash fragments with an entry
+// stored in this node, nodemap the ones with a child node. Entries and then 
+// children follow the node in the same allocation, both in bit order. When 
+// every hash bit is used up colliding entries are kept in a collision node, 
+// an unordered array of entries.
+struct pmap_node
+{
+    static constexpr size_t bits = 5;
+    static constexpr size_t mask = (1 << bits) - 1;
+    static constexpr size_t max_shift = sizeof(size_t)*8; 
+
+    // allocate a node with uninitialized entries and children
+    static inline pmap_node* make(std::uint32_t datamap, 
+                                  std::uint32_t nodemap, 
+                                  size_t entry_count, 
+                                  bool collision=false)
+    {
+        size_t child_count = popcount32(nodemap);
+        void* mem = ::operator new(entries_offset() + 
+                                   entry_count*sizeof(pmap_entry) + 
+                                   child_count*sizeof(pmap_node*));
+        return new(mem) pmap_node(datamap, nodemap, entry_count, child_count, collision);
+    }
+
+    static constexpr size_t entries_offset()
+    {
+        return (sizeof(pmap_node) + alignof(pmap_entry) - 1) & ~(alignof(pmap_entry) - 1);
+    }
+
+    inline pmap_entry* entries() 
+    { 
+        return reinterpret_cast<pmap_entry*>(reinterpret_cast<char*>(this) + entries_offset()); 
+    }
+
+    inline pmap_node** children() 
+    { 
+        return reinterpret_cast<pmap_node**>(entries() + entry_count); 
+    }
+
+    inline void retain(){ refs.fetch_add(1, std::memory_order_relaxed); }
+
+    static inline void release(pmap_node* n)
+    {
+        if(n->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            for(size_t i=0; i<n->entry_count; ++i){ n->entries()[i].~pmap_entry(); }
+            for(size_t i=0; i<n->child_count; ++i){ release(n->children()[i]); }
+            n->~pmap_node();
+            ::operator delete(n);
+        }
+    }
+
+    static inline std::uint32_t bit_for(size_t hash, size_t shift)
+    {
+        return std::uint32_t(1) << ((hash >> shift) & mask);
+    }
+
+    inline size_t entry_index(std::uint32_t bit) const { return popcount32(datamap & (bit - 1)); }
+    inline size_t child_index(std::uint32_t bit) const { return popcount32(nodemap & (bit - 1)); }
+
+    std::atomic<unsigned int> refs;
+    const std::uint32_t datamap;
+    const std::uint32_t nodemap;
+    const std::uint32_t entry_count;
+    const std::uint32_t child_count;
+    const bool collision;
+
+private:
+    pmap_node(std::uint32_t d, std::uint32_t n, size_t ec, size_t cc, bool c) : 
+        refs(1), 
+        datamap(d), 
+        nodemap(n), 
+        entry_count(std::uint32_t(ec)), 
+        child_count(std::uint32_t(cc)), 
+        collision(c) 
+    { }
+};
+}
+
+class pmap 
+{
+public:
+    typedef detail::pmap_entry entry;
+    class const_iterator;
+
+    pmap() noexcept : size_(0), root_(nullptr) {}
+
+    pmap(const pmap& rhs) noexcept : size_(rhs.size_), root_(rhs.root_)
+    {
+        if(root_){ root_->retain(); }
+    }
+
+    pmap(pmap&& rhs) noexcept : pmap() { swap(rhs); }
+
+    ~pmap(){ if(root_){ detail::pmap_node::release(root_); } }
+
+    pmap& operator=(const pmap& rhs)
+    {
+        pmap(rhs).swap(*this);
+        return *this;
+    }
+
+    pmap& operator=(pmap&& rhs) noexcept
+    {
+        pmap(std::move(rhs)).swap(*this);
+        return *this;
+    }
+
+    inline void swap(pmap& rhs) noexcept
+    {
+        std::swap(size_, rhs.size_);
+        std::swap(root_, rhs.root_);
+    }
+
+    inline size_t size() const { return size_; }
+    inline bool empty() const { return size_ == 0; }
+
+    // return the entry of key, nullptr if key is not in the map
+    inline const entry* find(const atom& key) const
+    {
+        if(!root_){ return nullptr; }
+
+        size_t h = hash(key);
+        detail::pmap_node* n = root_;
+
+        for(size_t shift = 0; ; shift += detail::pmap_node::bits)
+        {
+            if(n->collision)
+            {
+                for(size_t i=0; i<n->entry_count; ++i)
+                {
+                    const entry& e = n->entries()[i];
+                    if(e.hash == h && equalv(e.key, key)){ return &e; }
+                }
+                return nullptr;
+            }
+
+            std::uint32_t bit = detail::pmap_node::bit_for(h, shift);
+            if(n->datamap & bit)
+            {
+                const entry& e = n->entries()[n->entry_index(bit)];
+                return e.hash == h && equalv(e.key, key) ? &e : nullptr;
+            }
+            else if(n->nodemap & bit){ n = n->children()[n->child_index(bit)]; }
+            else{ return nullptr; }
+        }
+    }
+
+    inline bool contains(const atom& key) const { return find(key) != nullptr; }
+
+    // return the value of key, nil if key is not in the map
+    inline atom get(atom key) const
+    {
+        const entry* e = find(key);
+        return e ? e->value : nil();
+    }
+
+    template <typename T>
+    atom get(T&& key) const { return get(detail::to_atom(std::forward<T>(key))); }
+
+    // return a pmap with key mapped to value
+    inline pmap assoc(atom key, atom value) const
+    {
+        share(value);
+        pmap ret;
+        entry e{ is_frozen(key) ? key : freeze(copy_tree(key)), std::move(value), hash(key) };
+        bool added = false;
+
+        if(root_){ ret.root_ = assoc_(root_, 0, e, added); }
+        else
+        {
+            ret.root_ = detail::pmap_node::make(detail::pmap_node::bit_for(e.hash, 0), 0, 1);
+            new(ret.root_->entries()) entry(std::move(e));
+            added = true;
+        }
+
+        ret.size_ = size_ + (added ? 1 : 0);
+        return ret;
+    }
+
+    template <typename K, typename V>
+    pmap assoc(K&& key, V&& value) const
+    {
+        return assoc(detail::to_atom(std::forward<K>(key)), 
+                     detail::to_atom(std::forward<V>(value)));
+    }
+
+    // return a pmap without key
+    inline pmap dissoc(atom key) const
+    {
+        if(!contains(key)){ return *this; }
+
+        pmap ret;
+        ret.root_ = dissoc_(root_, 0, hash(key), key);
+        ret.size_ = size_ - 1;
+        return ret;
+    }
+
+    template <typename T>
+    pmap dissoc(T&& key) const { return dissoc(detail::to_atom(std::forward<T>(key))); }
+
+    inline const_iterator begin() const;
+    inline const_iterator end() const;
+
+    // equal if both maps contain equalv() keys mapped to equalv() values
+    inline bool operator==(const pmap& rhs) const;
+    inline bool operator!=(const pmap& rhs) const { return !(*this == rhs); }
+
+private:
+    typedef detail::pmap_node node;
+
+    static inline size_t hash(const atom& key){ return fl::hash(key); }
+
+    // copy all entries and children of n, and retain the children
+    static inline void copy_into(node* dst, node* src, 
+                                 size_t skip_entry=size_t(-1), 
+                                 size_t skip_child=size_t(-1),
+                                 size_t entry_gap=size_t(-1), 
+                                 size_t child_gap=size_t(-1))
+    {
+        entry* de = dst->entries();
+        for(size_t i=0; i<src->entry_count; ++i)
+        {
+            if(i == skip_entry){ continue; }
+            if(de - dst->entries() == std::ptrdiff_t(entry_gap)){ ++de; }
+            new(de++) entry(src->entries()[i]);
+        }
+
+        node** dc = dst->children();
+        for(size_t i=0; i<src->child_count; ++i)
+        {
+            if(i == skip_child){ continue; }
+            if(dc - dst->children() == std::ptrdiff_t(child_gap)){ ++dc; }
+            *dc = src->children()[i];
+            (*dc)->retain();
+            ++dc;
+        }
+    }
+
+    // return a node for two entries whose hashes are equal up to shift
+    static inline node* merge(entry&& a, entry&& b, size_t shift)
+    {
+        if(shift >= node::max_shift)
+        {
+            node* n = node::make(0, 0, 2, true);
+            new(n->entries()) entry(std::move(a));
+            new(n->entries() + 1) entry(std::move(b));
+            return n;
+        }
+
+        std::uint32_t abit = node::bit_for(a.hash, shift);
+        std::uint32_t bbit = node::bit_for(b.hash, shift);
+
+        if(abit == bbit)
+        {
+            node* child = merge(std::move(a), std::move(b), shift + node::bits);
+            node* n = node::make(0, abit, 0);
+            n->children()[0] = child;
+            return n;
+        }
+        else 
+        {
+            node* n = node::make(abit | bbit, 0, 2);
+            bool a_first = abit < bbit;
+            new(n->entries() + (a_first ? 0 : 1)) entry(std::move(a));
+            new(n->entries() + (a_first ? 1 : 0)) entry(std::move(b));
+            return n;
+        }
+    }
+
+    static inline node* assoc_(node* n, size_t shift, entry& e, bool& added)
+    {
+        if(n->collision)
+        {
+            for(size_t i=0; i<n->entry_count; ++i)
+            {
+                if(equalv(n->entries()[i].key, e.key))
+                {
+                    node* ret = node::make(0, 0, n->entry_count, true);
+                    copy_into(ret, n);
+                    ret->entries()[i].value = std::move(e.value);
+                    return ret;
+                }
+            }
+
+            node* ret = node::make(0, 0, n->entry_count + 1, true);
+            copy_into(ret, n);
+            new(ret->entries() + n->entry_count) entry(std::move(e));
+            added = true;
+            return ret;
+        }
+
+        std::uint32_t bit = node::bit_for(e.hash, shift);
+
+        if(n->datamap & bit)
+        {
+            size_t i = n->entry_index(bit);
+            entry& cur = n->entries()[i];
+
+            if(cur.hash == e.hash && equalv(cur.key, e.key))
+            {
+                // replace the value
+                node* ret = node::make(n->datamap, n->nodemap, n->entry_count);
+                copy_into(ret, n);
+                ret->entries()[i].value = std::move(e.value);
+                return ret;
+            }
+            else
+            {
+                // push both entries down into a new child
+                node* child = merge(entry(cur), std::move(e), shift + node::bits);
+                node* ret = node::make(n->datamap & ~bit, n->nodemap | bit, n->entry_count - 1);
+                size_t ci = ret->child_index(bit);
+                copy_into(ret, n, i, size_t(-1), size_t(-1), ci);
+                ret->children()[ci] = child;
+                added = true;
+                return ret;
+            }
+        }
+        else if(n->nodemap & bit)
+        {
+            size_t ci = n->child_index(bit);
+            node* child = assoc_(n->children()[ci], shift + node::bits, e, added);
+            node* ret = node::make(n->datamap, n->nodemap, n->entry_count);
+            copy_into(ret, n, size_t(-1), ci, size_t(-1), ci);
+            ret->children()[ci] = child;
+            return ret;
+        }
+        else 
+        {
+            node* ret = node::make(n->datamap | bit, n->nodemap, n->entry_count + 1);
+            size_t i = ret->entry_index(bit);
+            copy_into(ret, n, size_t(-1), size_t(-1), i);
+            new(ret->entries() + i) entry(std::move(e));
+            added = true;
+            return ret;
+        }
+    }
+
+    // key must be in n, returns nullptr if the resulting node is empty
+    static inline node* dissoc_(node* n, size_t shift, size_t h, const atom& key)
+    {
+        if(n->collision)
+        {
+            size_t i = 0;
+            while(!equalv(n->entries()[i].key, key)){ ++i; }
+            if(n->entry_count == 1){ return nullptr; }
+
+            node* ret = node::make(0, 0, n->entry_count - 1, true);
+            copy_into(ret, n, i);
+            return ret;
+        }
+
+        std::uint32_t bit = node::bit_for(h, shift);
+
+        if(n->datamap & bit)
+        {
+            if(n->entry_count == 1 && !n->child_count){ return nullptr; }
+
+            node* ret = node::make(n->datamap & ~bit, n->nodemap, n->entry_count - 1);
+            copy_into(ret, n, n->entry_index(bit));
+            return ret;
+        }
+        else 
+        {
+            size_t ci = n->child_index(bit);
+            node* child = dissoc_(n->children()[ci], shift + node::bits, h, key);
+
+            if(!child)
+            {
+                if(!n->entry_count && n->child_count == 1){ return nullptr; }
+
+                node* ret = node::make(n->datamap, n->nodemap & ~bit, n->entry_count);
+                copy_into(ret, n, size_t(-1), ci);
+                return ret;
+            }
+            else if(child->entry_count == 1 && !child->child_count)
+            {
+                // pull a lone entry back up, keeping the trie compact
+                node* ret = node::make(n->datamap | bit, n->nodemap & ~bit, n->entry_count + 1);
+                size_t i = ret->entry_index(bit);
+                copy_into(ret, n, size_t(-1), ci, i);
+                new(ret->entries() + i) entry(child->entries()[0]);
+                node::release(child);
+                return ret;
+            }
+            else 
+            {
+                node* ret = node::make(n->datamap, n->nodemap, n->entry_count);
+                copy_into(ret, n, size_t(-1), ci, size_t(-1), ci);
+                ret->children()[ci] = child;
+                return ret;
+            }
+        }
+    }
+
+    size_t size_;
+    node* root_;
+};
+
+// forward iterator over the entries of a pmap in unspecified order, valid as 
+// long as the pmap is
+class pmap::const_iterator
+{
+public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef entry value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const entry* pointer;
+    typedef const entry& reference;
+
+    const_iterator() : depth_(0) {} // end
+
+    explicit const_iterator(detail::pmap_node* root) : depth_(0)
+    {
+        if(root)
+        {
+            push(root);
+            settle();
+        }
+    }
+
+    inline const entry& operator*() const 
+    { 
+        const frame& f = stack_[depth_ - 1];
+        return f.n->entries()[f.entry]; 
+    }
+
+    inline const entry* operator->() const { return &**this; }
+
+    inline const_iterator& operator++()
+    {
+        ++stack_[depth_ - 1].entry;
+        settle();
+        return *this;
+    }
+
+    inline const_iterator operator++(int)
+    {
+        const_iterator ret(*this);
+        ++*this;
+        return ret;
+    }
+
+    inline bool operator==(const const_iterator& rhs) const 
+    { 
+        if(depth_ != rhs.depth_){ return false; }
+        else if(!depth_){ return true; } // both end
+        else
+        {
+            const frame& a = stack_[depth_ - 1];
+            const frame& b = rhs.stack_[depth_ - 1];
+            return a.n == b.n && a.entry == b.entry;
+        }
+    }
+
+    inline bool operator!=(const const_iterator& rhs) const { return !(*this == rhs); }
+
+private:
+    struct frame
+    {
+        detail::pmap_node* n;
+        size_t entry; // next entry to visit
+        size_t child; // next child to visit
+    };
+
+    inline void push(detail::pmap_node* n){ stack_[depth_++] = frame{ n, 0, 0 }; }
+
+    // advance to the next unvisited entry, or become end
+    inline void settle()
+    {
+        while(depth_)
+        {
+            frame& f = stack_[depth_ - 1];
+            if(f.entry < f.n->entry_count){ return; }
+            else if(f.child < f.n->child_count)
+            { 
+                detail::pmap_node* c = f.n->children()[f.child++];
+                push(c);
+            }
+            else{ --depth_; }
+        }
+    }
+
+    // a trie is at most max_shift/bits + 2 nodes deep, including a collision 
+    // node
+    frame stack_[detail::pmap_node::max_shift/detail::pmap_node::bits + 2];
+    size_t depth_;
+};
+
+inline pmap::const_iterator pmap::begin() const { return const_iterator(root_); }
+inline pmap::const_iterator pmap::end() const { return const_iterator(); }
+
+inline bool pmap::operator==(const pmap& rhs) const
+{
+    if(size_ != rhs.size_){ return false; }
+    else if(root_ == rhs.root_){ return true; }
+
+    for(const entry& e : *this)
+    {
+        const entry* o = rhs.find(e.key);
+        if(!o || !equalv(e.value, o->value)){ return false; }
+    }
+    return true;
+}
+
+namespace detail {
+// prints the entries as {k v, k v}
+inline std::string print_value(const pmap& m, std::false_type){ return to_string(atom(m)); }
+}
+} // end fl
+
+namespace std {
+// consistent with pmap's equality, independent of the order of entries
+template <>
+struct hash<fl::pmap>
+{
+    size_t operator()(const fl::pmap& m) const 
+    { 
+        size_t h = m.size();
+        for(const fl::pmap::entry& e : m)
+        { 
+            h += fl::detail::hash_combine(e.hash, fl::hash(e.value)); 
+        }
+        return h;
+    }
+};
+}
+
+namespace fl {
+inline bool is_pmap(atom a){ return is<pmap>(a); }
+
+namespace detail {
+inline pmap make_pmap_(pmap m){ return m; }
+
+template <typename K, typename V, typename... As>
+pmap make_pmap_(pmap m, K&& k, V&& v, As&&... as)
+{
+    return make_pmap_(m.assoc(std::forward<K>(k), std::forward<V>(v)), 
+                      std::forward<As>(as)...);
+}
+}
+
+// return an atom containing a pmap of the arguments, which are alternating 
+// keys and values
+template <typename... As>
+atom make_pmap(As&&... as)
+{
+    static_assert(sizeof...(As) % 2 == 0, "make_pmap() requires key value pairs");
+    return atom(detail::make_pmap_(pmap(), std::forward<As>(as)...));
+}
+
+
+
+//-----------------------------------------------------------------------------
+// partial evaluation
+//
+// specialize() evaluates the parts of an expression which do not depend on 
+// its inputs ahead of time, returning a smaller residual expression which 
+// eval_tree() returns the same result for. Inputs are named by symbols: a 
+// symbol in bindings is replaced by its bound value, any other symbol is an 
+// input still unknown and so is every call depending on it. A call of a pure() 
+// function whose arguments are all known is made once, here, and replaced by
+// its result. Calls of functions which are not pure are kept, as are calls 
+// returning a call, which eval_tree() would call again.
+//
+// Like eval_tree() only the arguments of calls are visited: quote()d lists and 
+// other data are constants and nothing inside them is replaced. A bound 
+// value is specialized as an expression in turn, but symbols inside it are 
+// data and are not looked up, so bindings cannot refer to each other. 
+// Expressions are walked iteratively, so arbitrarily deep expressions can be 
+// specialized.
+//
+// Example:
+/*
+atom add = fl::pure([](int a, int b){ return a + b; });
+atom mul = fl::pure([](int a, int b){ return a * b; });
+atom x = fl::make_symbol("x");
+atom y = fl::make_symbol("y");
+
+// (add (mul x 3) y)
+atom expr = fl::list(add, fl::list(mul, x, 3), y);
+atom residual = fl::specialize(expr, fl::make_pmap(x, 2)); // (add 6 y)
+atom r = fl::eval_tree(fl::specialize(residual, fl::make_pmap(y, 4))); // 10
+ */
+
+// mark the fl::function held by f pure, specialize() calls pure functions 
+// with known arguments ahead of time. The mark belongs to f's context, it is 
+// kept by copies and dropped when the function is replaced with set().
+inline atom pure(atom f)
+{
+    if(!is<function>(f)){ throw std::invalid_argument("fl::pure() of an atom which is not a function"); }
+    f.ctx->set(detail::pure_flag);
+    return f;
+}
+
+template <typename F>
+atom pure(F&& f){ return pure(atom(to_fl_function(std::forward<F>(f)))); }
+
+inline bool is_pure(atom a){ return a.has_flag(detail::pure_flag); }
+
+// specialize the expression expr for the symbols bound in the pmap bindings
+inline atom specialize(atom expr, const pmap& bindings)
+{
+    struct frame
+    {
+        atom expr;
+        bool expanded; // the arguments have been specialized
+        bool bound; // expr is, or is inside, a bound value
+        size_t count; // count of arguments
+    };
+
+    // a specialized expression, known if eval_tree() of it does not depend on
+    // any input
+    struct result
+    {
+        atom expr;
+        bool known;
+    };
+
+    std::vector<frame> todo;
+    std::vector<result> results;
+    todo.push_back(frame{ std::move(expr), false, false, 0 });
+
+    while(!todo.empty())
+    {
+        frame f = std::move(todo.back());
+        todo.pop_back();
+
+        if(f.expanded)
+        {
+            auto first = results.end() - f.count;
+            bool known = is_pure(car(f.expr));
+            for(auto it = first; known && it != results.end(); ++it){ known = it->known; }
+
+            atom r;
+            if(known)
+            {
+                detail::atom_buffer argv(f.count);
+                for(size_t i = 0; i < f.count; ++i){ argv.data()[i] = std::move(first[i].expr); }
+                r = resolve(value<function>(car(f.expr))(arg_span(argv.data(), f.count)));
+
+                // a call returned as data would be called by eval_tree()
+                if(detail::is_call(r))
+                {
+                    for(size_t i = 0; i < f.count; ++i){ first[i].expr = std::move(argv.data()[i]); }
+                    known = false;
+                }
+            }
+
+            if(!known)
+            {
+                list_builder b(f.count + 1);
+                b.push_back(car(f.expr));
+                for(auto it = first; it != results.end(); ++it){ b.push_back(std::move(it->expr)); }
+                r = b.finish();
+            }
+
+            results.erase(first, results.end());
+            results.push_back(result{ std::move(r), known });
+        }
+        else if(is_symbol(f.expr) && !f.bound)
+        {
+            if(const pmap::entry* e = bindings.find(f.expr))
+            {
+                todo.push_back(frame{ e->value, false, true, 0 });
+            }
+            else{ results.push_back(result{ std::move(f.expr), false }); } // an input
+        }
+        else if(!detail::is_call(f.expr)){ results.push_back(result{ std::move(f.expr), true }); }
+        else
+        {
+            size_t count = 0;
+            for(atom cur = cdr(f.expr); is_cons(cur); cur = cdr(cur)){ ++count; }
+
+            todo.push_back(frame{ f.expr, true, f.bound, count });
+
+            // arguments are pushed in reverse so they are specialized in order
+            size_t first = todo.size();
+            for(atom cur = cdr(f.expr); is_cons(cur); cur = cdr(cur))
+            {
+                todo.push_back(frame{ car(cur), false, f.bound, 0 });
+            }
+            std::reverse(todo.begin() + first, todo.end());
+        }
+    }
+
+    return std::move(results.back().expr);
+}
+
+// bindings is a pmap atom, or nil when no symbols are bound
+inline atom specialize(atom expr, atom bindings=atom())
+{
+    if(is_nil(bindings)){ return specialize(std::move(expr), pmap()); }
+    else{ return specialize(std::move(expr), value<pmap>(bindings)); }
+}
+
+
+
+//-----------------------------------------------------------------------------
+// writing
+//
+// write() and format_to() serialize an atom straight into an std::ostream or 
+// a caller supplied buffer. The tree is walked iteratively, so arbitrarily 
+// long lists and deep trees are written in constant stack, and nothing is 
+// built up in between: numbers are formatted with std::to_chars into a small
+// buffer on the stack, strings and type names are written from where they 
+// are stored. Other values are written with their type's printer.
+//
+// write_limits truncate the output of large values, for instance in logs:
+// collections nested deeper than depth are written as ..., and at most length
+// elements of each list, pvector or pmap are written, followed by ... if 
+// there are more. format_to() also stops at the end of its buffer. 
+//
+// Example:
+/*
+atom lst = fl::list(1, fl::list(2, fl::list(3)), 4, 5);
+fl::write(std::cout, lst); // (int:1 (int:2 (int:3)) int:4 int:5)
+fl::write(std::cout, lst, fl::write_limits(1, 3)); // (int:1 ... int:4 ...)
+
+char buf[128];
+size_t n = fl::format_to(buf, sizeof(buf), lst); 
+ */
+
+// limits of write() and format_to(), 0 is unlimited
+struct write_limits
+{
+    write_limits(size_t d=0, size_t l=0) : depth(d), length(l) {}
+
+    size_t depth; // collections nested deeper are written as ...
+    size_t length; // elements written per collection, the rest as ...
+};
+
+namespace detail {
+// a piece of output still to be written: an atom, the elements of a list or 
+// pvector following index, or text
+struct write_item
+{
+    enum kind_t : unsigned char { value, list_rest, vector_rest, text };
+
+    kind_t kind;
+    atom a;
+    size_t index;
+    size_t depth; // of a, or of the elements still to be written
+    const char* s;
+};
+
+template <typename Sink>
+void write_(Sink& out, atom a, const write_limits& lim)
+{
+    auto put = [&out](const char* s){ out.put(s, std::strlen(s)); };
+    auto push = [](std::vector<write_item>& todo, 
+                   write_item::kind_t k, 
+                   atom a, 
+                   size_t index, 
+                   size_t depth, 
+                   const char* s)
+    {
+        todo.push_back(write_item{ k, std::move(a), index, depth, s });
+    };
+
+    std::vector<write_item> todo;
+    push(todo, write_item::value, std::move(a), 0, 0, nullptr);
+
+    while(!todo.empty() && !out.full())
+    {
+        write_item it = std::move(todo.back());
+        todo.pop_back();
+
+        switch(it.kind)
+        {
+            case write_item::text:
+                put(it.s);
+                break;
+            case write_item::list_rest:
+                if(is_nil(it.a)){ put(")"); }
+                else if(!is_cons(it.a)) // dotted pair
+                {
+                    put(" . ");
+                    push(todo, write_item::text, atom(), 0, 0, ")");
+                    push(todo, write_item::value, std::move(it.a), 0, it.depth, nullptr);
+                }
+                else if(lim.length && it.index == lim.length){ put(" ...)"); }
+                else
+                {
+                    if(it.index){ put(" "); }
+                    atom elem = car(it.a);
+                    push(todo, write_item::list_rest, cdr(it.a), it.index + 1, it.depth, nullptr);
+                    push(todo, write_item::value, std::move(elem), 0, it.depth, nullptr);
+                }
+                break;
+            case write_item::vector_rest:
+            {
+                const pvector& v = value<pvector>(it.a);
+                if(it.index == v.size()){ put("]"); }
+                else if(lim.length && it.index == lim.length){ put(" ...]"); }
+                else
+                {
+                    if(it.index){ put(" "); }
+                    atom elem = v[it.index];
+                    push(todo, write_item::vector_rest, std::move(it.a), it.index + 1, it.depth, nullptr);
+                    push(todo, write_item::value, std::move(elem), 0, it.depth, nullptr);
+                }
+                break;
+            }
+            case write_item::value:
+                if(is_nil(it.a)){ put("nil"); }
+                else if(is_quote(it.a)){ put("'"); }
+                else if(is_cons(it.a) || is<pvector>(it.a) || is<pmap>(it.a))
+                {
+                    if(lim.depth && it.depth >= lim.depth){ put("..."); }
+                    else if(is_cons(it.a))
+                    {
+                        if(is_quote(car(it.a)))
+                        {
+                            put("'(");
+                            push(todo, write_item::list_rest, cdr(it.a), 0, it.depth + 1, nullptr);
+                        }
+                        else
+                        {
+                            put("(");
+                            push(todo, write_item::list_rest, std::move(it.a), 0, it.depth + 1, nullptr);
+                        }
+                    }
+                    else if(is<pvector>(it.a))
+                    {
+                        put("[");
+                        push(todo, write_item::vector_rest, std::move(it.a), 0, it.depth + 1, nullptr);
+                    }
+                    else
+                    {
+                        // entries are pushed in reverse, so they are gathered first
+                        const pmap& m = value<pmap>(it.a);
+                        std::vector<const pmap::entry*> entries;
+                        for(const pmap::entry& e : m)
+                        {
+                            if(lim.length && entries.size() == lim.length){ break; }
+                            entries.push_back(&e);
+                        }
+
+                        put("{");
+                        push(todo, write_item::text, atom(), 0, 0, 
+                             entries.size() < m.size() ? " ...}" : "}");
+                        for(size_t i = entries.size(); i-- > 0;)
+                        {
+                            push(todo, write_item::value, entries[i]->value, 0, it.depth + 1, nullptr);
+                            push(todo, write_item::text, atom(), 0, 0, " ");
+                            push(todo, write_item::value, entries[i]->key, 0, it.depth + 1, nullptr);
+                            if(i){ push(todo, write_item::text, atom(), 0, 0, ", "); }
+                        }
+                    }
+                }
+                else
+                {
+                    const std::string& name = print_map::get_type_name(it.a);
+                    out.put(name.data(), name.size());
+                    put(":");
+
+                    char num[64];
+                    if(char* end = print_map::format_value(it.a, num, num + sizeof(num)))
+                    {
+                        out.put(num, size_t(end - num));
+                    }
+                    else if(is<std::string>(it.a))
+                    {
+                        const std::string& s = value<std::string>(it.a);
+                        put("\"");
+                        out.put(s.data(), s.size());
+                        put("\"");
+                    }
+                    else if(is<symbol>(it.a))
+                    {
+                        const std::string& s = value<symbol>(it.a).name();
+                        out.put(s.data(), s.size());
+                    }
+                    else
+                    {
+                        std::string s = print_map::get_value(it.a);
+                        out.put(s.data(), s.size());
+                    }
+                }
+                break;
         }
-    } 
-
-    friend template <typename T> class register_type;
-};
-
-template <typename T>
-class register_type
-{
-public:
-    register_type(const char* name)
-    {
-        detail::print_map::instance()->register_type<T>(name);
     }
-};
-}
-inline std::string atom_name(atom a){ return detail::print_map::instance()->get_type(a); }
-inline std::string atom_value(atom a){ return detail::print_map::instance()->get_value(a); }
-
-// returns a name,value pair
-inline std::pair<std::string,std::string> atom_type_info(atom a)
-{ 
-    return detail::print_map::instance()->get_value_info(a); 
 }
 
+class string_sink
+{
+public:
+    string_sink(std::string& s) : s_(s) {}
+    inline void put(const char* p, size_t n){ s_.append(p, n); }
+    inline bool full() const { return false; }
 
-inline std::string to_string(atom a);
+private:
+    std::string& s_;
+};
 
-namespace detail {
-inline std::string to_string1(atom a)
+// collects small writes to pass them to the stream in larger blocks
+class ostream_sink
 {
-    if(is_cons(a)){ return to_string(a); }
-    else if(is_quote(a)){ return std::string("'"); }
-    else if(is_nil(a)){ return std::string("nil"); }
-    else
-    { 
-        auto ti = atom_type_info(a);
-        return ti.first+":"+ti.second; 
-    }
-}
-}
+public:
+    ostream_sink(std::ostream& os) : os_(os), n_(0) {}
+    ~ostream_sink(){ flush(); }
 
-inline std::string to_string(atom a)
-{ 
-    std::string s;
-    if(is_cons(a))
+    inline void put(const char* p, size_t n)
     {
-        if(is_quote(car(a))){ s+=std::string("'("); }
-        else 
-        {
-            s+=std::string("("); 
-            s+=detail::to_string1(car(a));
-        }
-
-        a = cdr(a);
-
-        while(!is_nil(a))
+        if(n_ + n > sizeof(buf_)){ flush(); }
+        if(n > sizeof(buf_)){ os_.write(p, std::streamsize(n)); }
+        else
         {
-            s+=std::string(" "); 
-            s+=detail::to_string1(a);
-            a = cdr(a);
+            std::memcpy(buf_ + n_, p, n);
+            n_ += n;
         }
-        s+=std::string(")");
     }
-    else{ s+=detail::to_string1(a); }
-    return s;
-}
-
-
-
-//-----------------------------------------------------------------------------
-// iteration
-namespace detail {
-void iterate_(){ return; }
 
-template <typename A, typename As...>
-void iterate_(A& a, As&... as)
-{ 
-    a = cdr(a);
-    iterate_(as...); 
-}
-}
+    inline bool full() const { return !os_.good(); }
 
-// map
-template <typename A, typename As...>
-atom map(A f, A a, A... as)
-{
-    atom ret; // default atom is nil 
-    while(!is_nil(a))
+    inline void flush()
     {
-        ret = cons(eval(f,list(car(a),car(as)...)), ret);
-        iterate_(a,as...);
+        if(n_){ os_.write(buf_, std::streamsize(n_)); }
+        n_ = 0;
     }
-    return std::move(a);
-}
 
-// map length
-template <typename F, typename A, typename As...>
-atom mapl(F&& f, size_t len, A a, A... as)
-{
-    atom ret; // default atom is nil
-    while(len)
-    {
-        --len;
-        ret = cons(eval(f,list(car(a),car(as)...)), ret);
-        iterate_(a,as...);
-    }
-    return std::move(a);
-}
+private:
+    std::ostream& os_;
+    char buf_[512];
+    size_t n_;
+};
 
-// fold left 
-template <typename F, typename As...>
-atom foldl(F&& f, atom init, atom a, As... as)
+class buffer_sink
 {
-    while(!is_nil(a))
-    {
-        init = eval(f,init,list(car(a),car(as)...));
-        iterate_(a,as...);
-    }
-    return init;
-}
+public:
+    buffer_sink(char* buf, size_t capacity) : buf_(buf), cap_(capacity), n_(0), truncated_(false) {}
 
-// fold left-to-right length 
-template <typename F, typename As...>
-atom foldll(F&& f, size_t len, atom init, atom a, As... as)
-{
-    while(len)
+    inline void put(const char* p, size_t n)
     {
-        --len
-        init = eval(f,init,list(car(a),car(as)...));
-        iterate_(a,as...);
+        size_t m = std::min(n, cap_ - n_);
+        std::memcpy(buf_ + n_, p, m);
+        n_ += m;
+        if(m < n){ truncated_ = true; }
     }
-    return init;
+
+    inline bool full() const { return truncated_; }
+    inline size_t size() const { return n_; }
+
+private:
+    char* buf_;
+    const size_t cap_;
+    size_t n_;
+    bool truncated_;
+};
 }
 
-// fold right-to-left
-template <typename F, typename As...>
-atom foldr(F&& f, atom init, atom a, As... as)
+// write a to os, as to_string() would, and return os
+inline std::ostream& write(std::ostream& os, atom a, const write_limits& lim=write_limits())
 {
-    return foldl(std::forward<F>(f),reverse(a),reverse(as)...);
+    detail::ostream_sink out(os);
+    detail::write_(out, std::move(a), lim);
+    return os;
 }
 
-// fold right-to-left length
-template <typename F, typename As...>
-atom foldrl(F&& f, size_t len, atom init, atom a, As... as)
+// write a into the buffer buf of size bytes, as to_string() would, and 
+// return the count of characters written. The result is always terminated 
+// with a '\0' which is not counted, and ends with ... if it was cut short at 
+// the end of the buffer.
+inline size_t format_to(char* buf, size_t size, atom a, const write_limits& lim=write_limits())
 {
-    return foldll(std::forward<F>(f),len,reverse(a),reverse(as)...);
+    if(size == 0){ return 0; }
+
+    detail::buffer_sink out(buf, size - 1);
+    detail::write_(out, std::move(a), lim);
+    size_t n = out.size();
+    if(out.full() && n >= 3){ std::memcpy(buf + n - 3, "...", 3); }
+    buf[n] = '\0';
+    return n;
 }
 
-//TODO: implement the following (racket) iterating algorithms:
-/*
- andmap
- andmapl
- ormap
- ormapl
- for_each
- filter
- remove 
- remv
- remp
- remove_set
- remsetv
- remsetp
- sort
- member
- memv
- memp
- memf
- findf
- assoc
- assv
- assp
- assf
- */
+inline std::string to_string(atom a)
+{ 
+    std::string s;
+    detail::string_sink out(s);
+    detail::write_(out, std::move(a), write_limits());
+    return s;
+}
 
 
 
 //-----------------------------------------------------------------------------
 // std:: container conversions
 
-// convert an allocator aware container to an fl::list containing all elements 
-// of said container. The elements are returned in the reverse order traversed 
-// over the container, the list must be reverse()d if order matters (although 
-// rebuilding a list via cons() during foldl will have the same effect with the 
-// extra functionality of operating on the data).
+namespace detail {
+template <typename C>
+auto container_size(const C& c, int) -> decltype(size_t(c.size())){ return c.size(); }
+
+// containers without size(), such as std::forward_list
+template <typename C>
+size_t container_size(const C& c, long){ return std::distance(c.begin(), c.end()); }
+}
+
+// convert an allocator aware container to an fl::list containing len elements
+// of said container starting at index idx, or all elements after idx if len is 
+// 0. The elements are in the order traversed over the container. If c is an
+// rvalue the elements are moved into the list. fl::pvectors are containers of 
+// atoms and are converted the same way.
 template <typename C>
 atom atomize_container(C&& c, size_t idx=0, size_t len=0)
 {
-    const bool is_rvalue = std::is_rvalue_reference<C&&>::value;
-    typedef typename std::remove_cv<C> UC; // unqualified C
-    typedef typename UC::iterator IT;
-
-    IT cur=c.begin();
-    IT end;
-    atom lst=nil();
+    const bool is_rvalue = !std::is_lvalue_reference<C>::value;
+    size_t sz = detail::container_size(c, 0);
+    if(idx >= sz){ return nil(); }
+    if(!len || len > sz - idx){ len = sz - idx; }
 
-    if(len){ end = std::next(cur); }
-    else{ end=c.end() };
+    auto cur = std::next(c.begin(), idx);
+    list_builder b(len); // the list is a single run
 
-    if(is_rvalue)
-    {
-        for(; cur!=end; ++cur)
-        { 
-            lst = cons(car(lst), cons(p(std::move(*cur),nil())));
-        }
-    } 
-    else 
-    {
-        for(; cur!=end; ++cur)
-        { 
-            lst = cons(car(lst), cons(p(*cur,nil())));
-        }
+    for(; len; --len, ++cur)
+    { 
+        if(is_rvalue){ b.push_back(std::move(*cur)); }
+        else{ b.push_back(*cur); }
     }
 
-    return lst;
+    return b.finish();
 }
 
-// convert an fl::atom list to an allocator aware, size constructable container. 
+// convert an fl::atom list or pvector to an allocator aware, size 
+// constructable container. The length of lists built by list() and 
+// atomize_container() is known in constant time, so the list is traversed 
+// once.
 template <typename C>
 C reconstitute_container(atom a)
 {
     typedef typename C::value_type T;
-    const bool is_rvalue = std::is_rvalue_reference<A&&>::value;
+
+    if(is_pvector(a))
+    {
+        const pvector& v = value<pvector>(a);
+        C c(v.size());
+        std::transform(v.begin(), v.end(), c.begin(), [](const atom& e){ return value<T>(e); });
+        return c;
+    }
 
     auto linfo = inspect_list(a);
     if(linfo.is_list)
     {
         C c(linfo.length);
 
-        auto cur = c.begin();
-        auto end = c.end();
-
-        if(is_rvalue)
-        {
-            while(; cur!=end; ++cur)
-            {
-                auto& c = value<detail::cons_cell>(a);
-                *cur = value<T>(c.car);
-                a = c.cdr;
-            }
-        }
-        else
+        for(auto cur = c.begin(); cur != c.end(); ++cur)
         {
-            while(; cur!=end; ++cur)
-            {
-                auto& c = value<detail::cons_cell>(a);
-                *cur = std::move(value<T>(c.car));
-                a = c.cdr;
-            }
+            const detail::cons_cell& cell = value<detail::cons_cell>(a);
+            *cur = value<T>(cell.car());
+            a = cell.cdr();
         }
 
-        return std::move(c);
+        return c;
     }
     else{ return C(); }
 }
@@ -1173,100 +6156,130 @@ C reconstitute_container(atom a)
 //-----------------------------------------------------------------------------
 //  std:: compatibility
 
-// fl::iterator for fl::list organizations of atoms, for use in std:: 
-// algorithms
-class iterator : public std::forward_iterator_tag
+// fl::iterator for fl::list organizations of atoms and fl::pvectors, for use 
+// in std:: algorithms. Lists are traversed cell by cell, pvectors by index.
+class iterator
 {
 public:
-    typedef value_type atom;
-
-    iterator() : a(atom(detail::cons_cell())) {} // nil
-    iterator(atom ia) : a(ia) {}
-    iterator(const iterator& rhs) : a(rhs.a) {}
-    iterator(iterator&& rhs) : a(std::move(rhs.a)) {}
-
-    iterator& operator=(const iterator& rhs) const
+    typedef std::forward_iterator_tag iterator_category;
+    typedef atom value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef atom* pointer;
+    typedef atom& reference;
+
+    iterator() : i(0) {} // end
+    iterator(atom ia) : a(ia), i(0) { load(); }
+    iterator(const iterator& rhs) : a(rhs.a), i(rhs.i), e(rhs.e) {}
+    iterator(iterator&& rhs) : a(std::move(rhs.a)), i(rhs.i), e(std::move(rhs.e)) {}
+
+    iterator& operator=(const iterator& rhs)
     {
         a = rhs.a;
+        i = rhs.i;
+        e = rhs.e;
         return *this;
     }
 
-    iterator& operator=(iterator&& rhs) const
+    iterator& operator=(iterator&& rhs)
     {
         a = std::move(rhs.a);
+        i = rhs.i;
+        e = std::move(rhs.e);
         return *this;
     }
 
-    iterator& operator++() const
+    iterator& operator++()
     {
-        if(is_cons(a) && !is_nil(a)){ a = a.cdr; }
+        next();
         return *this;
     }
 
-    iterator operator++(int unused) const 
+    iterator operator++(int unused)
     {
         iterator ret(*this);
-        if(is_cons(a) && !is_nil(a)){ a = a.cdr; }
+        next();
         return ret;
     }
 
-    bool operator==(const iterator& rhs) const { return compare(a, rhs.a); }
-    bool operator==(iterator&& rhs) const { return compare(a, rhs.a); }
-    bool operator!=(const iterator& rhs) const { return !compare(a, rhs.a); }
-    bool operator!=(iterator&& rhs) const { return !compare(a, rhs.a); }
+    bool operator==(const iterator& rhs) const { return a.equalp(rhs.a) && i == rhs.i; }
+    bool operator!=(const iterator& rhs) const { return !(*this == rhs); }
 
-    atom& operator*() const { return a; }
-    atom* operator->() const { return &a; }
+    atom& operator*() const { return e; }
+    atom* operator->() const { return &e; }
 
 private: 
-    mutable atom a;
+    // load the current element, or become the end iterator
+    inline void load()
+    {
+        if(is_cons(a)){ e = car(a); }
+        else if(is_pvector(a) && i < value<pvector>(a).size()){ e = value<pvector>(a)[i]; }
+        else 
+        {
+            a = nil();
+            i = 0;
+            e = nil();
+        }
+    }
+
+    inline void next()
+    {
+        if(is_cons(a)){ a = cdr(a); }
+        else{ ++i; }
+        load();
+    }
+
+    atom a; // current cons cell or the pvector
+    size_t i; // pvector index
+    mutable atom e; // current element
 };
 
-class const_iterator : public std::forward_iterator_tag
+class const_iterator
 {
 public:
-    typedef value_type atom;
-
-    const_iterator() : a(atom(detail::cons_cell())) {} // nil
-    const_iterator(atom ia) : a(ia) {}
-    const_iterator(const const_iterator& rhs) : a(rhs.a) {}
-    const_iterator(const_iterator&& rhs) : a(std::move(rhs.a)) {}
-
-    const_iterator& operator=(const const_iterator& rhs) const
+    typedef std::forward_iterator_tag iterator_category;
+    typedef atom value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const atom* pointer;
+    typedef const atom& reference;
+
+    const_iterator() {} // end
+    const_iterator(atom ia) : it(ia) {}
+    const_iterator(const const_iterator& rhs) : it(rhs.it) {}
+    const_iterator(const_iterator&& rhs) : it(std::move(rhs.it)) {}
+
+    const_iterator& operator=(const const_iterator& rhs)
     {
-        a = rhs.a;
+        it = rhs.it;
         return *this;
     }
 
-    const_iterator& operator=(const_iterator&& rhs) const
+    const_iterator& operator=(const_iterator&& rhs)
     {
-        a = std::move(rhs.a);
+        it = std::move(rhs.it);
         return *this;
     }
 
-    const_iterator& operator++() const
+    const_iterator& operator++()
     {
-        if(is_cons(a) && !is_nil(a)){ a = a.cdr; }
+        ++it;
         return *this;
     }
 
-    const_iterator operator++(int unused) const 
+    const_iterator operator++(int unused)
     {
         const_iterator ret(*this);
-        if(is_cons(a) && !is_nil(cdr(a))){ a = cdr(a); }
+        ++it;
         return ret;
     }
 
-    bool operator==(const const_iterator& rhs) const { return compare(a, rhs.a); }
-    bool operator==(const_iterator&& rhs) const { return compare(a, rhs.a); }
-    bool operator!=(const const_iterator& rhs) const { return !compare(a, rhs.a); }
-    bool operator!=(const_iterator&& rhs) const { return !compare(a, rhs.a); }
+    bool operator==(const const_iterator& rhs) const { return it == rhs.it; }
+    bool operator!=(const const_iterator& rhs) const { return it != rhs.it; }
 
-    const atom& operator*() const { return a; }
-    const atom* operator->() const { return &a; }
+    const atom& operator*() const { return *it; }
+    const atom* operator->() const { return &*it; }
 
 private: 
-    mutable atom a;
+    iterator it;
 };
 } // end fl
 
@@ -1275,11 +6288,11 @@ private:
 //-----------------------------------------------------------------------------
 // overload for std::begin 
 namespace std {
-iterator begin(fl::atom a){ return iterator(fl::value<fl::detail::cons_cell>(a).car); }
-iterator end(fl::atom a){ return iterator(); }
+inline fl::iterator begin(fl::atom a){ return fl::iterator(a); }
+inline fl::iterator end(fl::atom a){ return fl::iterator(); }
 
-iterator cbegin(fl::atom a){ return const_iterator(fl::value<fl::detail::cons_cell>(a).car); }
-iterator cend(fl::atom a){ return const_iterator(); }
+inline fl::const_iterator cbegin(fl::atom a){ return fl::const_iterator(a); }
+inline fl::const_iterator cend(fl::atom a){ return fl::const_iterator(); }
 }
 
 
@@ -1288,7 +6301,12 @@ iterator cend(fl::atom a){ return const_iterator(); }
 // channel 
 
 // channel is an interface (via std::shared_ptr) to an internal mechanism for 
-// sending atoms and retrieving atoms from a threadsafe queue. 
+// sending atoms and retrieving atoms from a threadsafe queue. Sent atoms are 
+// copied with the channel's copy_policy and share()d, frozen atoms are sent 
+// as they are. fl::functions are never clone()d, the receiver calls the 
+// sender's function, so move only functions can be sent and scheduled. With 
+// copy_policy::copy_on_write only the contexts not yet marked are visited, so
+// sending a tree which was sent before is O(1).
 
 namespace fl {
 
@@ -1311,9 +6329,13 @@ public:
         return *this;
     }
 
-    bool operator bool(){ return ctx ? true : false; }
+    inline explicit operator bool() const { return ctx ? true : false; }
+
+    inline void make(copy_policy p=copy_policy::deep)
+    { 
+        ctx = std::make_shared<channel_context>(p); 
+    }
 
-    inline void make(){ ctx = std::make_shared<channel_context>(); }
     inline void close(){ return ctx->close(); }
     inline bool closed(){ return ctx->closed(); }
     inline size_t size(){ return ctx->size(); }
@@ -1325,30 +6347,30 @@ public:
 
     template <typename T>
     bool recv(T& t)
-    { 
-        atom a(std::move(t));
-        bool success = ctx->recv(a); 
-        t = extract<T>(a);
+    {
+        atom a;
+        bool success = ctx->recv(a);
+        if(success){ t = value<T>(a); }
         return success;
     }
 
 private:
-    struct channel_context 
+    struct channel_context
     {
     public:
-        inline channel_context() : closed(false) {}
+        inline channel_context(copy_policy p) : closed_(false), policy(p) {}
 
         inline void close()
         {
             std::unique_lock<std::mutex> lk(mtx);
-            closed=true;
+            closed_=true;
             non_empty_cv.notify_all();
         }
 
         inline bool closed()
         {
             std::unique_lock<std::mutex> lk(mtx);
-            return closed;
+            return closed_;
         }
 
         inline size_t size()
@@ -1359,9 +6381,12 @@ private:
 
         inline bool send(atom a)
         {
-            atom s = copy_tree(a);
+            // the copy may have been made inside a local_scope, and should 
+            // not retain the sender's arena
+            detail::arena_suspend as;
+            atom s = is_frozen(a) ? a : detail::copy_with_policy(a, policy);
             std::unique_lock<std::mutex> lk(mtx);
-            if(!closed)
+            if(!closed_)
             {
                 lst.push_back(s);
                 non_empty_cv.notify_one();
@@ -1373,8 +6398,8 @@ private:
         inline bool recv(atom& a)
         {
             std::unique_lock<std::mutex> lk(mtx);
-            while(!closed && lst.size()){ non_empty_cv.wait(lk); }
-            if(!closed)
+            while(!closed_ && lst.empty()){ non_empty_cv.wait(lk); }
+            if(!closed_)
             {
                 a = lst.front();
                 lst.pop_front();
@@ -1387,30 +6412,39 @@ private:
         std::mutex mtx;
         std::condition_variable non_empty_cv;
         std::list<atom> lst;
-        bool closed;
+        bool closed_;
+        copy_policy policy;
     };
 
     std::shared_ptr<channel_context> ctx;
 };
 
-channel make_channel(size_t capacity=1)
-{ 
+// make a channel which sends values with the given copy_policy
+inline channel make_channel(copy_policy p=copy_policy::deep)
+{
     channel c;
-    c.make(capacity);
+    c.make(p);
     return c;
 }
 
 
 
 //-----------------------------------------------------------------------------
-// worker 
+// worker
 //
 // worker is an interface to an std::thread stored in an std::shared_ptr.
 //
-// The std::thread will continually call its function f on atoms received from 
-// its schedule() call. This will continue until the worker's context 
-// std::shared_ptr goes out of scope or halt() is called, upon which calls to f 
-// will cease, the worker function will return and the thread joined.
+// The std::thread will continually call its function f on atoms received from
+// its schedule() call. This will continue until the worker's context
+// std::shared_ptr goes out of scope or halt() is called, upon which calls to f
+// will cease, the worker function will return and the thread joined. A worker
+// which halt()s itself from its own thread is detached instead, its thread
+// exits once f returns.
+//
+// Frozen atoms are scheduled by reference, see freeze(). If f takes its 
+// message by mutable reference, like message& below, it receives a mutable 
+// copy_tree() of each frozen message instead. An fl::function is opaque and 
+// receives frozen messages as they are.
 //
 // Example:
 /*
@@ -1420,7 +6454,7 @@ struct message
 {
     size_t command;
     atom payload;
-    
+
     message(size_t in_command) : command(in_command) { }
     message(size_t in_command, atom in_payload) : command(in_command), payload(in_payload) { }
 };
@@ -1429,7 +6463,7 @@ int main()
 {
     channel done_ch = make_channel();
 
-    // w calls our custom function with whatever we send it with its schedule() 
+    // w calls our custom function with whatever we send it with its schedule()
     // function
     worker w([=](message& m)
     {
@@ -1442,7 +6476,7 @@ int main()
             eval([](std::string s){ std::cout << s << std::endl; }, m.payload);
             break;
         case 2:
-            std::cout << "world" << std::endl; 
+            std::cout << "world" << std::endl;
             break;
         case 3:
         default:
@@ -1452,7 +6486,7 @@ int main()
         }
     });
 
-    w.schedule(message(0,[]{ std::cout << 3 << std::endl; }));
+    w.schedule(message(0,list([]{ std::cout << 3 << std::endl; })));
     w.schedule(message(1,"hello"));
     w.schedule(message(2));
     w.schedule(message(3));
@@ -1466,14 +6500,17 @@ int main()
 
 class workerpool; // forward declaration
 
-class worker 
+class worker
 {
 public:
     inline worker(){}
     inline worker(const worker& rhs) : ctx(rhs.ctx) { }
     inline worker(worker&& rhs) : ctx(std::move(rhs.ctx)) { }
-    inline worker(function f){ start(this,f); }
-    template <typename f> worker(F&& f){ start(this,std::forward<F>(f)); }
+    inline worker(function f){ start(std::move(f)); }
+
+    template <typename F,
+              typename = typename std::enable_if<detail::is_callable<detail::unqualified<F>>::value>::type>
+    worker(F&& f){ start(std::forward<F>(f)); }
 
     inline worker& operator=(const worker& rhs)
     {
@@ -1487,124 +6524,108 @@ public:
         return *this;
     }
 
-    bool operator bool(){ return ctx ? true : false; }
+    inline explicit operator bool() const { return ctx ? true : false; }
 
-    inline void start(function f){ ctx = std::make_shared<worker_context>(this,f); }
+    inline void start(function f)
+    {
+        ctx = std::make_shared<worker_context>();
+        ctx->start(std::move(f), false);
+    }
 
     template <typename F>
     inline void start(F&& f)
     {
-        start(atomize_function(std::forward<F>(f)));
+        ctx = std::make_shared<worker_context>();
+        ctx->start(to_fl_function(std::forward<F>(f)), 
+                   detail::writes_arguments<detail::unqualified<F>>::value);
     }
 
-    inline bool halt(){ ctx->halt(); }
+    inline void halt(){ if(ctx){ ctx->halt(); } }
+
+    inline bool schedule(atom a){ return ctx->schedule(a); }
 
-    inline void schedule(atom a){ return ctx->schedule(a); }
+    template <typename T>
+    bool schedule(T&& t){ return schedule(atom(std::forward<T>(t))); }
 
-    template <typename F, typename... Ts>
-    void schedule(F&& f, Ts&&... ts)
+    // schedule the call of f with the arguments ts
+    template <typename F, typename T, typename... Ts>
+    bool schedule(F&& f, T&& t, Ts&&... ts)
     {
-        return schedule(list(std::forward<F>(f),std::forward<Ts>(ts)...));
+        return schedule(list(std::forward<F>(f),std::forward<T>(t),std::forward<Ts>(ts)...));
     }
 
 private:
-    struct worker_context 
+    struct worker_context : public std::enable_shared_from_this<worker_context>
     {
     public:
-        inline worker_context(worker* parent_w, function f) : parent_tp(nullptr), ch(make_channel())
+        inline worker_context() : ch(make_channel()) { }
+        inline ~worker_context(){ halt(); }
+
+        // f receives a mutable copy of each frozen message if copy_frozen
+        inline void start(function f, bool copy_frozen)
         {
-            run = std::make_shared<bool>(false);
-            done = std::make_shared<bool>(false);
-            thd = std::thread([&](function f)
+            // the thread only holds its own handles to the channel and the
+            // function, as the context may be destroyed while f is running
+            std::weak_ptr<worker_context> self = weak_from_this();
+            thd = std::thread([self, copy_frozen](channel ch, function f)
             {
-                worker_context* parent_worker = get_current_worker();
-                set_current_worker(parent_w);
-                try 
-                {
-                    bool recv_success=false;
-                    std::unique_lock<std::mutex> lk(mtx);
-                    *run=true;
-                    ready_cv.notify_one();
-                    atom a;
-                    while(*run)
-                    {
-                        lk.unlock();
-                        recv_success = ch.recv(a);
-                        if(recv_success)
-                        { 
-                            f(a); 
-                            lk.lock();
-                        }
-                        else 
-                        {
-                            lk.lock();
-                            *run=false; // shutdown if channel is closed
-                        }
-                    }
-                }
-                catch(...)
-                {
-                    *done=true;
-                    set_current_worker(parent_worker);
-                    done_cv.notify_one();
-                    std::rethrow_exception(std::current_exception());
+                current() = self;
+                atom a;
+                while(ch.recv(a))
+                { 
+                    if(copy_frozen && is_frozen(a)){ a = copy_tree(a); }
+                    // a returned tail call is made here, as eval() would
+                    resolve(f(arg_span(&a, 1))); 
                 }
-                *done=true;
-                set_current_worker(parent_worker);
-                done_cv.notify_one();
-            }, f);
-
-            std::unique_lock<std::mutex> lk(mtx);
-            while(!*run){ ready_cv.wait(lk); }
+                current().reset();
+            }, ch, std::move(f));
         }
 
-        worker* get_current_worker();
-        void set_current_worker(worker* w);
+        inline bool schedule(atom a){ return ch.send(a); }
 
-        inline void schedule(atom a){ return ch.send(a); }
         inline void halt()
-        { 
-            std::unique_lock<std::mutex> lk(mtx);
-            if(thd.joinable())
+        {
+            ch.close();
+
+            std::thread t;
             {
-                *run = false;
-                ch.close();
-                while(!*done){ done_cv.wait(lk); }
-                lk.unlock();
-                thd.join();
+                std::unique_lock<std::mutex> lk(mtx);
+                t = std::move(thd);
             }
-        }
 
-        inline bool in_workerpool(){ return parent_tp ? true : false; }
-        inline workerpool* get_workerpool(){ return *parent_tp; }
+            if(t.joinable())
+            {
+                // a worker halting itself cannot wait for its own thread
+                if(t.get_id() == std::this_thread::get_id()){ t.detach(); }
+                else{ t.join(); }
+            }
+        }
 
-        inline ~worker_context(){ halt(); }
+        // the context of the worker running on this thread, if any
+        static std::weak_ptr<worker_context>& current();
 
     private:
         std::mutex mtx;
-        std::condition_variable ready_cv;
-        std::condition_variable done_cv;
         std::thread thd;
-        std::shared_ptr<bool> run;
-        std::shared_ptr<bool> done;
         channel ch;
-        workerpool* parent_tp;
-        friend class workerpool;
     };
 
+    inline worker(std::shared_ptr<worker_context> c) : ctx(std::move(c)) { }
+
     std::shared_ptr<worker_context> ctx;
-    friend class workerpool;
+    friend bool in_worker();
+    friend worker current_worker();
 };
 
 bool in_worker();
 
-// Keeping a copy of a worker (for instance, in an atom) can cause the worker to 
-// never go out of scope, causing a memory leak. Try to always use this function 
-// inline instead of caching it. 
+// Keeping a copy of a worker (for instance, in an atom) can cause the worker to
+// never go out of scope, causing a memory leak. Try to always use this function
+// inline instead of caching it.
 //
-// An exception to this is when the lifetime of the copy is temporary, such as 
-// when creating a worker to execute an io call, whereupon a cached 
-// current_worker() value is used to re-schedule the continuation.
+// An exception to this is when the lifetime of the copy is temporary, such as
+// when a thread executing an io call keeps a cached current_worker() value
+// to re-schedule the continuation.
 worker current_worker();
 
 
@@ -1612,19 +6633,20 @@ worker current_worker();
 //-----------------------------------------------------------------------------
 // workerpool
 //
-// workerpool is an interface class to a shared_ptr context of managed worker 
-// objects. A workerpool will create N count of workers when its start() 
-// function is called, and will schedule atoms for evaluation to said workers 
+// workerpool is an interface class to a shared_ptr context of managed worker
+// objects. A workerpool will create N count of workers when its start()
+// function is called, and will schedule atoms for evaluation to said workers
 // when its schedule() function is called.
 //
-// All workers created with workerpool are passed the function eval(). Thus, 
-// workers in a workerpool are very generic, and are best used when efficient,
+// All workers created with workerpool eval() the atoms scheduled on them, an
+// fl::function scheduled by itself is called without arguments. Thus, workers
+// in a workerpool are very generic, and are best used when efficient,
 // asynchronous computation is required.
 //
-// All workers will be halt()ed when the last workerpool to the shared context 
+// All workers will be halt()ed when the last workerpool to the shared context
 // goes out of scope.
 
-class workerpool 
+class workerpool
 {
 public:
     inline workerpool(){}
@@ -1643,65 +6665,70 @@ public:
         return *this;
     }
 
-    bool operator bool(){ return ctx ? true : false; }
+    inline explicit operator bool() const { return ctx ? true : false; }
 
     inline void start(size_t worker_count=std::thread::hardware_concurrency())
     {
-        ctx = std::make_shared<workerpool_context>(this, worker_count);
+        ctx = std::make_shared<workerpool_context>();
+        ctx->start(worker_count);
     }
 
-    inline void halt(){ ctx->halt(); }
+    inline void halt(){ if(ctx){ ctx->halt(); } }
 
     inline size_t worker_count(){ return ctx->worker_count(); }
 
-    inline void schedule(atom a){ return ctx->schedule(a); }
+    inline bool schedule(atom a){ return ctx->schedule(a); }
 
-    template <typename F, typename... Ts>
-    void schedule(F&& f, Ts&&... ts)
+    template <typename T>
+    bool schedule(T&& t){ return schedule(atom(std::forward<T>(t))); }
+
+    // schedule the call of f with the arguments ts
+    template <typename F, typename T, typename... Ts>
+    bool schedule(F&& f, T&& t, Ts&&... ts)
     {
-        return schedule(list(std::forward<F>(f),std::forward<Ts>(ts)...));
+        return schedule(list(std::forward<F>(f),std::forward<T>(t),std::forward<Ts>(ts)...));
     }
 
 private:
-    struct workerpool_context 
+    struct workerpool_context : public std::enable_shared_from_this<workerpool_context>
     {
     public:
-        inline workerpool_context(workerpool* parent_tp, 
-                                  size_t worker_count) :
-            ch(make_channel())
-        { 
+        inline workerpool_context() : next(0) { }
+
+        inline void start(size_t worker_count)
+        {
             if(!worker_count){ worker_count=1; }
 
+            std::weak_ptr<workerpool_context> self = weak_from_this();
             workers.reserve(worker_count);
             for(size_t i=0; i<worker_count; ++i)
-            { 
-                workers.emplace_back(eval,make_channel());
-                workers.back().ctx->parent_tp = this;
-            }
+            {
+                bool registered = false;
+                workers.emplace_back(function([self, registered](atom args) mutable
+                {
+                    if(!registered)
+                    {
+                        current() = self;
+                        registered = true;
+                    }
 
-            cur = workers.begin();
-            end = workers.end();
+                    atom a = car(args);
+                    if(is<function>(a)){ return resolve(value<function>(a)(arg_span(nullptr, 0))); }
+                    else{ return eval(a); }
+                }));
+            }
         }
 
-        inline void schedule(atom a)
+        inline bool schedule(atom a)
         {
-            std::unique_lock<std::mutex> lk(mtx);
-            cur->schedule(a);
             // rotate which worker to schedule on next
-            if(cur==end){ cur = workers.begin(); }
-            else{ ++cur; }
-            return nil();
+            return workers[next++ % workers.size()].schedule(a);
         }
 
-        inline size_t worker_count()
-        { 
-            std::unique_lock<std::mutex> lk(mtx);
-            return workers.size(); 
-        }
+        inline size_t worker_count(){ return workers.size(); }
 
         inline void halt()
         {
-            std::unique_lock<std::mutex> lk(mtx);
             for(auto cur = workers.begin(); cur!=workers.end(); ++cur)
             {
                 cur->halt();
@@ -1710,81 +6737,93 @@ private:
 
         ~workerpool_context(){ halt(); }
 
+        // the context of the workerpool running this thread, if any
+        static std::weak_ptr<workerpool_context>& current();
+
     private:
-        std::mutex mtx;
-        channel ch;
         std::vector<worker> workers;
-        std::vector<worker>::iterator cur;
-        std::vector<worker>::iterator end;
-        workerpool* parent_tp;
-        workerpool* previous_tp;
+        std::atomic<size_t> next;
     };
 
+    inline workerpool(std::shared_ptr<workerpool_context> c) : ctx(std::move(c)) { }
+
     std::shared_ptr<workerpool_context> ctx;
+    friend bool in_workerpool();
+    friend workerpool current_workerpool();
 };
 
 bool in_workerpool();
 
-// keeping a copy of the workerpool (for instance, in an atom) can cause the 
-// workerpool to never go out of scope, causing a memory leak. Try to always 
+// keeping a copy of the workerpool (for instance, in an atom) can cause the
+// workerpool to never go out of scope, causing a memory leak. Try to always
 // use this function inline instead of caching it.
-workerpool current_workerpool(); 
+workerpool current_workerpool();
 
-// set the worker thread count (only effective if default_workerpool() has not 
+// set the worker thread count (only effective if default_workerpool() has not
 // yet been called, as that function forces initialization).
 void set_default_workerpool_worker_count(size_t cnt);
 
-// keeping a copy of the workerpool (for instance, in an atom) can cause the 
-// workerpool to never go out of scope, causing a memory leak. Try to always 
+// keeping a copy of the workerpool (for instance, in an atom) can cause the
+// workerpool to never go out of scope, causing a memory leak. Try to always
 // use this function inline instead of caching it.
 workerpool default_workerpool();
 
 
 
 //-----------------------------------------------------------------------------
-// schedule an atom for execution on a worker thread in either the current 
+// schedule an atom for execution on a worker thread in either the current
 // workerpool, the current worker, or the default workerpool, in that order,
-// as available.
-atom schedule(atom a);
+// as available. Returns false if the atom could not be scheduled.
+bool schedule(atom a);
 
-template <typename F, typename... Ts>
-atom schedule(F&& f, Ts&&... ts)
+template <typename T>
+bool schedule(T&& t){ return schedule(atom(std::forward<T>(t))); }
+
+// schedule the call of f with the arguments ts
+template <typename F, typename T, typename... Ts>
+bool schedule(F&& f, T&& t, Ts&&... ts)
 {
-    return schedule(list(std::forward<F>(f),std::forward<Ts>(ts)...));
+    return schedule(list(std::forward<F>(f),std::forward<T>(t),std::forward<Ts>(ts)...));
 }
 
 
 
 //-----------------------------------------------------------------------------
-// continuation 
+// continuation
 //
-// A continuation is a special channel which implements non-blocking behavior by 
-// scheduling functions (continuations) that will continue the current operation 
-// when a send/recv can succeed. This is a variation of a technique known in the 
+// A continuation is a special channel which implements non-blocking behavior by
+// scheduling functions (continuations) that will continue the current operation
+// when a send/recv can succeed. This is a variation of a technique known in the
 // lisp world as "continuation passing" style.
 //
 // In practice, this behavior is essentially an implementation of "coroutines".
-// Fully supported coroutines can implement this behavior by allocating an 
-// entire stack (similar to a thread's call stack) where the coroutine can 
-// execute. This behavior is emulated here not through an allocated call stack, 
-// but by using atoms for their default shared_ptr behavior. 
+// Fully supported coroutines can implement this behavior by allocating an
+// entire stack (similar to a thread's call stack) where the coroutine can
+// execute. This behavior is emulated here not through an allocated call stack,
+// but by using atoms for their default shared_ptr behavior.
 //
-// This non-blocking behavior is *extremely* efficient, it effectively allows 
+// This non-blocking behavior is *extremely* efficient, it effectively allows
 // regular functions to behave like threads, yet actually executing on a small
-// number of worker threads (typically identical in number to the count of 
-// available CPUs), maximizing cpu usage while minimizing the cost of context 
+// number of worker threads (typically identical in number to the count of
+// available CPUs), maximizing cpu usage while minimizing the cost of context
 // switching.
 //
 // When a continuation::send(send_val, send_cont) OR
 // continuation::recv(recv_cont) succeeds it will schedule send_cont for 
 // evaluation with send_val as an argument, while scheduling recv_cont with a 
-// copy (default copy function is a deep copy with copy_tree()) of send_val. 
-// An alternate fl::function can be provided to make() as the copy function if 
-// necessary for efficiency.
+// copy of send_val. The copy is made with the copy_policy given to make(), 
+// by default a deep copy with copy_tree(). copy_policy::copy_on_write copies 
+// with cow_copy_tree() instead, which is more efficient for read mostly 
+// values.
 //
-// An alternate send(send_val) variant is available if no continuation is 
+// An alternate send(send_val) variant is available if no continuation is
 // required by the sending code.
 //
+// A continuation which continues directly into another function, rather than 
+// through send()/recv(), should return fl::tail_call(next, args...) instead of 
+// calling next itself. The worker resolves the call after the continuation 
+// has returned, so long chains of continuations do not grow the stack.
+//
 // If there are no receivers when a send() occurs the send operation will be 
 // cached until the next recv() call. The same is true if there are no senders 
 // when a receive occurs until the next send() call.
@@ -1798,14 +6837,14 @@ int main()
     fl::continuation cn = fl::make_continuation();
     fl::channel ch = fl::make_channel();
 
-    // sender 
+    // sender
     fl::atom send_f = [=](int i)
     {
         if(i<2){ cn.send(++i,send_f); }
         else{ ch.send(0); }
     };
-    
-    // receiver 
+
+    // receiver
     fl::atom recv_f = [=](int i)
     {
         if(i<2)
@@ -1813,14 +6852,14 @@ int main()
             std::cout << i << std::endl;
             cn.recv(recv_f);
         }
-        else{ ch.send(0; }
+        else{ ch.send(0); }
     };
 
     cn.send(-1, send_f);
     cn.recv(recv_f);
 
     // synchronize with worker functions
-    i=0;
+    int i=0;
     ch.recv(i);
     ch.recv(i);
     return 0;
@@ -1830,7 +6869,7 @@ int main()
 // 1
 // 2
  */
-class continuation 
+class continuation
 {
 public:
     continuation(){}
@@ -1849,83 +6888,83 @@ public:
         return *this;
     }
 
-    inline bool operator bool(){ return ctx ? true : false; }
-    inline void make(){ ctx = std::make_shared<continuation_context>(); }
-    inline void make(atom copy_func){ ctx = std::make_shared<continuation_context>(copy_func); }
-
-    template <typename F>
-    void make(F&& copy_func){ make(atom(std::forward<F>(copy_func))); }
+    inline explicit operator bool() const { return ctx ? true : false; }
+    inline void make(copy_policy p=copy_policy::deep){ ctx = std::make_shared<continuation_context>(p); }
 
     inline void close(){ ctx->close(); }
-    inline bool close(){ return ctx->closed(); }
+    inline bool closed(){ return ctx->closed(); }
     inline bool send(atom val, atom cont){ return ctx->send(val,cont); }
     inline bool send(atom val){ return ctx->send(val); }
-    inline bool recv(atom& cont){ return ctx->recv(cont); }
+    inline bool recv(atom cont){ return ctx->recv(cont); }
 
-    template <typename T, typename F> 
+    template <typename T, typename F>
     bool send(T&& t, F&& f)
-    { 
-        return ctx->send(atom(std::forward<T>(t)), atom(std::forward<F>(f))); 
+    {
+        return ctx->send(atom(std::forward<T>(t)), atom(std::forward<F>(f)));
     }
 
-    template <typename T, typename F> 
+    template <typename T>
     bool send(T&& t)
-    { 
-        return ctx->send(atom(std::forward<T>(t))); 
+    {
+        return ctx->send(atom(std::forward<T>(t)));
     }
 
-    template <typename T, typename F> 
+    template <typename F>
     bool recv(F&& f)
-    {  
-        return ctx->recv(atom(std::forward<F>(f))); 
+    {
+        return ctx->recv(atom(std::forward<F>(f)));
     }
 
 private:
-    struct continuation_context 
+    struct continuation_context
     {
-        continuation_context() : closed(false), copy_func(copy_tree) {}
-        continuation_context(atom in_copy_func) : closed(false), copy_func(in_copy_func) {}
+        continuation_context(copy_policy p) : closed_(false), policy(p) {}
 
         inline void close()
         {
             std::unique_lock<std::mutex> lk(mtx);
-            closed=true;
+            closed_=true;
         }
 
         inline bool closed()
         {
             std::unique_lock<std::mutex> lk(mtx);
-            return closed;
+            return closed_;
         }
 
         inline bool send(atom send_val, atom send_cont)
         { 
-            atom recv_val = eval(list(copy_func,send_val));
+            // all values are captured by scheduled functions where share() 
+            // cannot reach them. Frozen values are passed by reference.
+            atom recv_val = is_frozen(send_val)
+                            ? send_val
+                            : detail::copy_with_policy(send_val, policy);
+            share(send_val);
+            share(send_cont);
 
             std::unique_lock<std::mutex> lk(mtx);
-            if(closed){ return false; }
+            if(closed_){ return false; }
             else
             {
                 if(receivers.size())
                 {
                     atom recv_cont = receivers.front();
                     receivers.pop_front();
-                    atom send_val = car(s);
-                    atom send_cont = cdr(s);
-                    schedule(atom([=]{ eval(list(recv_cont, recv_val)); }));
-                    schedule(atom([=]{ eval(list(send_cont, send_val)); }));
+                    fl::schedule(atom([=]{ eval(recv_cont, recv_val); }));
+                    fl::schedule(atom([=]{ eval(send_cont, send_val); }));
                 }
                 else{ senders.push_back(cons(recv_val,cons(send_val,send_cont))); }
                 return true;
             }
         }
 
-        inline bool send(atom send_val){ return send(send_val,atom([]{}); }
+        inline bool send(atom send_val){ return send(send_val,atom([]{})); }
 
         inline bool recv(atom recv_cont)
         { 
+            share(recv_cont);
             std::unique_lock<std::mutex> lk(mtx);
-            if(closed){ return false; }
+            if(closed_){ return false; }
             else
             {
                 if(senders.size())
@@ -1936,8 +6975,8 @@ private:
                     atom ccell = cdr(s);
                     atom send_val = car(ccell);
                     atom send_cont = cdr(ccell);
-                    schedule(atom([=]{ eval(list(recv_cont, recv_val)); }));
-                    schedule(atom([=]{ eval(list(send_cont, send_val)); }));
+                    fl::schedule(atom([=]{ eval(recv_cont, recv_val); }));
+                    fl::schedule(atom([=]{ eval(send_cont, send_val); }));
                 }
                 else{ receivers.push_back(recv_cont); }
                 return true;
@@ -1945,89 +6984,76 @@ private:
         }
 
         std::mutex mtx;
-        std::condition_variable cv;
-        bool closed;
+        bool closed_;
+        copy_policy policy;
         std::list<atom> senders;
         std::list<atom> receivers;
-        atom copy_func;
     };
 
     std::shared_ptr<continuation_context> ctx;
 };
 
-continuation make_continuation()
-{
-    continuation cn;
-    cn.make();
-    return cn;
-}
-
-continuation make_continuation(atom copy_func)
-{
-    continuation cn;
-    cn.make(copy_func);
-    return cn;
-}
-
-template <typename F>
-continuation make_continuation(F&& copy_func)
+// make a continuation which copies values with the given copy_policy
+inline continuation make_continuation(copy_policy p=copy_policy::deep)
 {
     continuation cn;
-    cn.make(atom(std::forward<F>(copy_func)));
+    cn.make(p);
     return cn;
 }
 
 
 
 //-----------------------------------------------------------------------------
-// io  
+// io
 //
-// io is similar to continuation in that io() itself is non-blocking. io() will 
-// launch a new thread that will execute a function (io_call) after which, if a 
-// function cont was provided, it will schedule() cont on the original worker 
-// io() was called from.
-bool io(atom io_call, atom cont)
+// io is similar to continuation in that io() itself is non-blocking. io() will
+// launch a new thread that will execute a function (io_call) after which, if a
+// function cont was provided, it will schedule() cont on the original worker
+// io() was called from. io_call is either a function, called without
+// arguments, or a call eval()uated on the new thread.
+namespace detail {
+inline atom eval_io_call(const atom& io_call)
+{
+    if(is<function>(io_call)){ return resolve(value<function>(io_call)(arg_span(nullptr, 0))); }
+    else{ return eval(io_call); }
+}
+}
+
+inline bool io(atom io_call, atom cont)
 {
     if(in_worker())
     {
         worker cw = current_worker();
-        worker w(eval);
-        w.schedule([=]
+        std::thread([=]() mutable
         {
-            eval(io_call);
+            detail::eval_io_call(io_call);
             cw.schedule(cont);
-            current_worker().halt();
-        });
+        }).detach();
         return true;
     }
     else{ return false; }
 }
 
 template <typename IO, typename CONT>
-void io(IO&& io_f, CONT&& cont_f)
+bool io(IO&& io_f, CONT&& cont_f)
 {
-    io(list(std::forward<IO>(io_f),std::forward<CONT>(cont_f)));
+    return io(atom(std::forward<IO>(io_f)),atom(std::forward<CONT>(cont_f)));
 }
 
-bool io(atom io_call)
+inline bool io(atom io_call)
 {
     if(in_worker())
     {
-        worker w(eval);
-        w.schedule([=]
-        {
-            eval(io_call);
-            current_worker().halt();
-        });
+        std::thread([=]{ detail::eval_io_call(io_call); }).detach();
         return true;
     }
     else{ return false; }
 }
 
-template <typename IO, typename CONT>
-void io(IO&& io_f)
+template <typename IO>
+bool io(IO&& io_f)
 {
-    io(list(std::forward<IO>(io_f)));
+    return io(atom(std::forward<IO>(io_f)));
 }
 
 } // end fl
@@ -1,9 +1,15 @@
-#include <gtest>
+#include <gtest/gtest.h>
 
 #include <vector>
 #include <list>
 #include <forward_list>
 #include <map>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <chrono>
 
 #include "fl.hpp"
 
@@ -12,112 +18,3197 @@ using namespace fl;
 
 //-----------------------------------------------------------------------------
 // atom tests
-TEST(atom,atom_default_constructor){}
-TEST(atom,atom_lvalue_constructor){}
-TEST(atom,atom_rvalue_constructor){}
-TEST(atom,atom_T_constructor){}
-TEST(atom,operator_bool){}
-TEST(atom,nil){}
-TEST(atom,is_nil){}
+TEST(atom,atom_default_constructor)
+{
+    atom a;
+    EXPECT_TRUE(a.is_nil());
+}
+TEST(atom,atom_lvalue_constructor)
+{
+    atom a(1);
+    atom b(a);
+    EXPECT_TRUE(equalp(a, b));
+    const atom c(2);
+    atom d(c);
+    EXPECT_TRUE(equalp(c, d));
+}
+TEST(atom,atom_rvalue_constructor)
+{
+    atom a(1);
+    atom b(std::move(a));
+    EXPECT_EQ(1, value<int>(b));
+
+
+    // a const rvalue atom is copied, not wrapped in a new atom
+    const atom c(2);
+    atom d(std::move(c));
+    EXPECT_TRUE(equalp(c, d));
+    atom e;
+    e = std::move(c);
+    EXPECT_TRUE(equalp(c, e));
+}
+TEST(atom,atom_T_constructor)
+{
+    EXPECT_EQ(1, value<int>(atom(1)));
+    EXPECT_EQ("hello", value<std::string>(atom("hello")));
+    std::string s("world");
+    EXPECT_EQ("world", value<std::string>(atom(s)));
+}
+TEST(atom,operator_bool)
+{
+    EXPECT_FALSE(atom());
+    EXPECT_TRUE(atom(0));
+}
+TEST(atom,nil)
+{
+    EXPECT_TRUE(nil().is_nil());
+}
+TEST(atom,is_nil)
+{
+    EXPECT_TRUE(is_nil(nil()));
+    EXPECT_FALSE(is_nil(atom(1)));
+}
+TEST(atom,small_value_storage)
+{
+    EXPECT_TRUE(detail::is_small_value<int>::value);
+    EXPECT_TRUE(detail::is_small_value<std::string>::value);
+    EXPECT_TRUE(detail::is_small_value<detail::cons_cell>::value);
+
+    // changing the value reuses the existing context, so every copy of the 
+    // atom sees the new value and type
+    atom a(1);
+    atom b = a;
+    a.set(std::string("two"));
+    EXPECT_TRUE(equalp(a, b));
+    EXPECT_EQ("two", value<std::string>(b));
+    a.set(3.0);
+    EXPECT_EQ(3.0, value<double>(b));
+    EXPECT_THROW(value<std::string>(b), std::bad_cast);
+
+    atom c = a.copy();
+    c.set(4.0);
+    EXPECT_EQ(3.0, value<double>(a));
+
+    // the new value is built before the old one is destroyed, so an atom 
+    // can be set from its own value
+    atom s(std::string("self"));
+    s.set(s.value<std::string>());
+    EXPECT_EQ("self", value<std::string>(s));
+
+    // a throwing constructor leaves the old value intact
+    struct throws
+    {
+        throws(){}
+        throws(const throws&){ throw std::runtime_error("copy"); }
+    };
+    throws t;
+    EXPECT_THROW(s.set(t), std::runtime_error);
+    EXPECT_EQ("self", value<std::string>(s));
+}
+TEST(atom,boxed_value_storage)
+{
+    typedef std::array<char,256> big;
+    EXPECT_FALSE(detail::is_small_value<big>::value);
+
+    big v;
+    v.fill('x');
+    atom a(v);
+    EXPECT_TRUE(is<big>(a));
+    EXPECT_EQ(v, value<big>(a));
+
+    // copies own a separate box
+    atom b = a.copy();
+    b.atom_cast<big&>()[0] = 'y';
+    EXPECT_EQ('x', value<big>(a)[0]);
+    EXPECT_EQ('y', value<big>(b)[0]);
+
+    // a boxed value can be replaced with a small one and back
+    a.set(1);
+    EXPECT_EQ(1, value<int>(a));
+    a.set(v);
+    EXPECT_EQ(v, value<big>(a));
+
+    std::vector<int> moved(100, 1);
+    atom c(moved);
+    std::vector<int> out = c.extract<std::vector<int>>();
+    EXPECT_EQ(100u, out.size());
+}
 
 
 //-----------------------------------------------------------------------------
 // type and value tests
-TEST(type_and_value,is){}
-TEST(type_and_value,lvalue_value){}
-TEST(type_and_value,rvalue_value){}
+TEST(type_and_value,is)
+{
+    atom a(1);
+    EXPECT_TRUE(is<int>(a));
+    EXPECT_FALSE(is<double>(a));
+    EXPECT_FALSE(is<int>(nil()));
+}
+TEST(type_and_value,type_id)
+{
+    EXPECT_EQ(detail::get_type_id<int>(), detail::get_type_id<const int&>());
+    EXPECT_NE(detail::get_type_id<int>(), detail::get_type_id<long>());
+    EXPECT_NE(detail::get_type_id<int>(), detail::get_type_id<unsigned int>());
+
+    // type tests ignore qualifiers and never throw
+    atom a(1);
+    EXPECT_TRUE(is<const int&>(a));
+    EXPECT_FALSE(is<long>(a));
+    a.set(1L);
+    EXPECT_TRUE(is<long>(a));
+    EXPECT_FALSE(is<int>(a));
+}
+TEST(type_and_value,lvalue_value)
+{
+    atom a(std::string("hello"));
+    const std::string& s = value<std::string>(a);
+    EXPECT_EQ("hello", s);
+    EXPECT_THROW(value<int>(a), std::bad_cast);
+}
+TEST(type_and_value,rvalue_value)
+{
+    EXPECT_EQ(2.5, value<double>(atom(2.5)));
+}
 
 
 //-----------------------------------------------------------------------------
 // equality tests
-TEST(equality,equalv){}
-TEST(equality,equalp){}
+TEST(equality,equalv)
+{
+    EXPECT_TRUE(equalv(atom(1), atom(1)));
+    EXPECT_FALSE(equalv(atom(1), atom(2)));
+    EXPECT_FALSE(equalv(atom(1), atom(1.0)));
+    EXPECT_TRUE(equalv(atom("abc"), std::string("abc")));
+    EXPECT_TRUE(equalv(nil(), nil()));
+    EXPECT_FALSE(equalv(nil(), atom(1)));
+    EXPECT_TRUE(equalv(list(1, 2), list(1, 2)));
+    EXPECT_FALSE(equalv(list(1, 2), list(1, 3)));
+}
+TEST(equality,equalp)
+{
+    atom a(1);
+    atom b = a;
+    EXPECT_TRUE(equalp(a, b));
+    EXPECT_FALSE(equalp(a, atom(1)));
+}
+TEST(equality,equalv_without_operator_equality)
+{
+    struct no_equality { int i; };
+    atom a(no_equality{1});
+    atom b(no_equality{1});
+    EXPECT_TRUE(equalv(a, a));
+    EXPECT_FALSE(equalv(a, b));
+    EXPECT_FALSE(equalv(a, a.copy()));
+
+    // functions are only equal to themselves
+    atom f([](int i){ return i; });
+    EXPECT_TRUE(equalv(f, f));
+    EXPECT_FALSE(equalv(f, f.copy()));
+}
+
+
+//-----------------------------------------------------------------------------
+// hash tests
+TEST(hash,hash_value)
+{
+    EXPECT_EQ(hash(atom(1)), hash(atom(1)));
+    EXPECT_NE(hash(atom(1)), hash(atom(2)));
+    EXPECT_EQ(hash(atom("abc")), hash(atom(std::string("abc"))));
+    EXPECT_EQ(hash(nil()), hash(atom()));
+    EXPECT_NE(hash(nil()), hash(atom(0)));
+}
+TEST(hash,hash_cons)
+{
+    EXPECT_EQ(hash(cons(1, 2)), hash(cons(1, 2)));
+    EXPECT_NE(hash(cons(1, 2)), hash(cons(2, 1)));
+    EXPECT_EQ(hash(list(1, list(2, 3))), hash(list(1, list(2, 3))));
+    EXPECT_NE(hash(list(1, list(2, 3))), hash(list(1, 2, 3)));
+}
+TEST(hash,hash_long_list)
+{
+    // hashing is iterative, so it does not recurse once per element
+    const int n = 1000000;
+    atom a;
+    atom b;
+    for(int i = 0; i < n; ++i)
+    {
+        a = cons(i, a);
+        b = cons(i, b);
+    }
+    EXPECT_EQ(hash(a), hash(b));
+
+    // tear the lists down one cell at a time
+    while(a){ a = cdr(a); }
+    while(b){ b = cdr(b); }
+}
+TEST(hash,hash_equalv)
+{
+    // atoms which are equalv() always hash equal
+    atom a = list(1, std::string("two"), list(3.0, 'c'));
+    atom b = list(1, std::string("two"), list(3.0, 'c'));
+    ASSERT_TRUE(equalv(a, b));
+    EXPECT_EQ(hash(a), hash(b));
+    EXPECT_EQ(hash(a), hash(copy_tree(a)));
+    EXPECT_EQ(hash(intern(5)), hash(atom(5)));
+    EXPECT_EQ(hash(make_symbol("x")), hash(atom(symbol("x"))));
+
+    // types without std::hash which are comparable with == still hash equal
+    struct comparable 
+    { 
+        int i; 
+        bool operator==(const comparable& rhs) const { return i == rhs.i; }
+    };
+    ASSERT_TRUE(equalv(atom(comparable{1}), atom(comparable{1})));
+    EXPECT_EQ(hash(atom(comparable{1})), hash(atom(comparable{1})));
+}
+TEST(hash,hash_shared_subtree)
+{
+    // a subtree reached twice hashes the same as two equal subtrees
+    atom s = list(1, 2);
+    EXPECT_EQ(hash(list(s, s, s)), hash(list(list(1, 2), list(1, 2), list(1, 2))));
+    EXPECT_EQ(hash(cons(s, s)), hash(cons(list(1, 2), list(1, 2))));
+
+    // a DAG of depth n has 2^n paths but n shared cells
+    atom d = list(0);
+    for(int i = 0; i < 64; ++i){ d = cons(d, d); }
+    EXPECT_EQ(hash(d), hash(d));
+}
+TEST(hash,hash_cycle)
+{
+    atom a = list(1, 2);
+    atom last = cdr(a);
+    last.atom_cast<detail::cons_cell&>() = detail::cons_cell(atom(2), a);
+    EXPECT_THROW(hash(a), cycle_error);
+    EXPECT_THROW(hash(last), cycle_error);
+
+    // a cycle through a car
+    atom b = list(1);
+    b.atom_cast<detail::cons_cell&>() = detail::cons_cell(b, atom());
+    EXPECT_THROW(hash(b), cycle_error);
+
+    // break the cycles so the cells are released
+    last.atom_cast<detail::cons_cell&>() = detail::cons_cell(atom(2), atom());
+    b.atom_cast<detail::cons_cell&>() = detail::cons_cell(atom(1), atom());
+    EXPECT_EQ(hash(list(1, 2)), hash(a));
+    EXPECT_EQ(hash(list(1)), hash(b));
+}
+TEST(hash,equalv_long_list)
+{
+    // structural equality is iterative as hashing is, so long keys can be 
+    // looked up without exhausting the stack
+    const int n = 1000000;
+    atom a;
+    atom b;
+    for(int i = 0; i < n; ++i)
+    {
+        a = cons(i, a);
+        b = cons(i, b);
+    }
+    EXPECT_TRUE(equalv(a, b));
+    EXPECT_FALSE(equalv(a, cons(-1, b)));
+
+    std::unordered_set<atom> keys;
+    keys.insert(a);
+    EXPECT_EQ(1u, keys.count(b));
+    keys.clear();
+
+    while(a){ a = cdr(a); }
+    while(b){ b = cdr(b); }
+}
+TEST(hash,equalv_shared_subtree)
+{
+    // 2^64 paths through 64 shared cells
+    atom a = list(0);
+    atom b = list(0);
+    for(int i = 0; i < 64; ++i)
+    {
+        a = cons(a, a);
+        b = cons(b, b);
+    }
+    EXPECT_TRUE(equalv(a, b));
+    EXPECT_FALSE(equalv(a, cons(b, list(1))));
+}
+TEST(hash,equalv_cycle)
+{
+    // (1 2 1 2 ...) and (1 2 1 2 ...) built separately
+    atom a = list(1, 2);
+    atom b = list(1, 2);
+    atom c = list(1, 2);
+    atom a_last = cdr(a);
+    atom b_last = cdr(b);
+    atom c_last = cdr(c);
+    a_last.atom_cast<detail::cons_cell&>() = detail::cons_cell(atom(2), a);
+    b_last.atom_cast<detail::cons_cell&>() = detail::cons_cell(atom(2), b);
+    EXPECT_TRUE(equalv(a, b));
+    EXPECT_TRUE(equalv(a, cdr(b_last))); 
+
+    // (1 2 1 3 1 3 ...) differs in its second round
+    c_last.atom_cast<detail::cons_cell&>() = detail::cons_cell(atom(2), list(1, 3));
+    atom c_end = cdr(cdr(c_last));
+    c_end.atom_cast<detail::cons_cell&>() = detail::cons_cell(atom(3), cdr(c_last));
+    EXPECT_FALSE(equalv(a, c));
+
+    // break the cycles so the cells are released
+    a_last.atom_cast<detail::cons_cell&>() = detail::cons_cell(atom(2), atom());
+    b_last.atom_cast<detail::cons_cell&>() = detail::cons_cell(atom(2), atom());
+    c_end.atom_cast<detail::cons_cell&>() = detail::cons_cell(atom(3), atom());
+    EXPECT_TRUE(equalv(a, b));
+}
+TEST(hash,std_hash)
+{
+    atom a = list(1, 2);
+    EXPECT_EQ(hash(a), std::hash<atom>()(a));
+    EXPECT_EQ(std::hash<atom>()(a), std::hash<atom>()(list(1, 2)));
+}
+TEST(hash,unordered_map_key)
+{
+    std::unordered_map<atom,int> m;
+    m[list(1, 2)] = 3;
+    m[atom(std::string("key"))] = 4;
+    EXPECT_EQ(2u, m.size());
+    EXPECT_EQ(3, m[list(1, 2)]); // found by value, not identity
+    EXPECT_EQ(4, m[atom("key")]);
+    EXPECT_EQ(2u, m.size());
+    EXPECT_TRUE(m.find(list(2, 1)) == m.end());
+}
+
+
+//-----------------------------------------------------------------------------
+// thread local tests
+TEST(thread_local_atom,local_scope)
+{
+    EXPECT_FALSE(is_local(atom(1)));
+    atom outer;
+    {
+        local_scope ls;
+        outer = list(1, 2);
+        EXPECT_TRUE(is_local(outer));
+        EXPECT_TRUE(is_local(car(outer)));
+        {
+            local_scope nested;
+            EXPECT_TRUE(is_local(atom(3)));
+        }
+        EXPECT_TRUE(is_local(atom(4))); // still inside the outer scope
+    }
+    EXPECT_FALSE(is_local(atom(5)));
+
+    // local atoms stay valid after their scope ends
+    EXPECT_TRUE(is_local(outer));
+    EXPECT_TRUE(equalv(list(1, 2), outer));
+    atom c = outer;
+    outer = nil();
+    EXPECT_EQ(2, value<int>(nth(c, 1)));
+}
+TEST(thread_local_atom,is_local)
+{
+    EXPECT_FALSE(is_local(nil()));
+    local_scope ls;
+    EXPECT_TRUE(is_local(atom(1)));
+    EXPECT_FALSE(is_local(nil()));
+    EXPECT_TRUE(is_local(atom(1).copy()));
+}
+TEST(thread_local_atom,share)
+{
+    local_scope ls;
+    atom l = list(1, list(2, 3));
+    atom r = share(l);
+    EXPECT_TRUE(equalp(l, r));
+    EXPECT_FALSE(is_local(l));
+    EXPECT_FALSE(is_local(car(l)));
+    EXPECT_FALSE(is_local(cdr(l)));
+    EXPECT_FALSE(is_local(nth(l, 1)));
+    EXPECT_FALSE(is_local(car(nth(l, 1))));
+    EXPECT_FALSE(is_local(nth(nth(l, 1), 1)));
+    EXPECT_TRUE(is_nil(share(nil())));
+}
+TEST(thread_local_atom,share_cycle)
+{
+    local_scope ls;
+    atom a = list(1, 2);
+    atom last = cdr(a);
+    last.atom_cast<detail::cons_cell&>() = detail::cons_cell(atom(2), a);
+
+    // every context of the cycle is shared once and the walk terminates
+    share(a);
+    EXPECT_FALSE(is_local(a));
+    EXPECT_FALSE(is_local(last));
+    EXPECT_FALSE(is_local(car(last)));
+    share(a); // already shared, O(1)
+
+    // break the cycle so the cells are released
+    last.atom_cast<detail::cons_cell&>() = detail::cons_cell(atom(2), atom());
+}
+TEST(thread_local_atom,channel_send_shares)
+{
+    channel ch = make_channel();
+    {
+        local_scope ls;
+        EXPECT_TRUE(ch.send(list(1, 2)));
+    }
+
+    std::atomic<bool> local(true);
+    std::thread t([&]{
+        atom a;
+        if(ch.recv(a))
+        {
+            local = is_local(a) || is_local(car(a)) || is_local(cdr(a));
+        }
+    });
+    t.join();
+    EXPECT_FALSE(local);
+}
+TEST(thread_local_atom,continuation_send_shares)
+{
+    continuation cn = make_continuation();
+    channel done = make_channel();
+    atom v;
+    {
+        local_scope ls;
+        v = list(1, 2);
+        atom recv_f([done](atom args) mutable 
+        { 
+            return done.send(is_local(car(args)) || is_local(car(car(args))));
+        });
+        cn.send(v);
+        cn.recv(recv_f);
+        EXPECT_FALSE(is_local(v));
+        EXPECT_FALSE(is_local(recv_f));
+    }
+    bool local = true;
+    ASSERT_TRUE(done.recv(local));
+    EXPECT_FALSE(local);
+}
+
+
+//-----------------------------------------------------------------------------
+// arena tests
+TEST(arena,arena)
+{
+    arena ar;
+    atom l;
+    for(int i = 0; i < 100000; ++i){ l = cons(i, l); } // spans several blocks
+    EXPECT_EQ(100000u, length(l));
+    EXPECT_EQ(99999, value<int>(car(l)));
+    EXPECT_TRUE(is_arena_allocated(l));
+    EXPECT_TRUE(is_local(l));
+    while(l){ l = cdr(l); }
+}
+TEST(arena,nested_arena)
+{
+    arena outer;
+    atom a(1);
+    {
+        arena inner;
+        atom b(2);
+        EXPECT_EQ(1u, outer.live());
+        EXPECT_EQ(1u, inner.live());
+    }
+    atom c(3); // allocations return to the outer arena
+    EXPECT_EQ(2u, outer.live());
+    EXPECT_TRUE(is_arena_allocated(c));
+}
+TEST(arena,live)
+{
+    arena ar;
+    EXPECT_EQ(0u, ar.live());
+    atom l = list(1, 2);
+    EXPECT_EQ(4u, ar.live()); // two cells and two values
+    atom c = l; // copies share the context
+    EXPECT_EQ(4u, ar.live());
+    l = nil();
+    c = nil();
+    EXPECT_EQ(0u, ar.live());
+}
+TEST(arena,is_arena_allocated)
+{
+    EXPECT_FALSE(is_arena_allocated(atom(1)));
+    EXPECT_FALSE(is_arena_allocated(nil()));
+    arena ar;
+    EXPECT_TRUE(is_arena_allocated(atom(1)));
+    {
+        detail::arena_suspend as;
+        EXPECT_FALSE(is_arena_allocated(atom(1)));
+    }
+    EXPECT_FALSE(is_arena_allocated(intern(12345))); // interned values live forever
+}
+TEST(arena,escape)
+{
+    atom e;
+    {
+        arena ar;
+        atom l = list(1, list(2, 3));
+        e = escape(l);
+        EXPECT_FALSE(is_arena_allocated(e));
+        EXPECT_FALSE(is_arena_allocated(car(e)));
+        EXPECT_FALSE(is_arena_allocated(nth(e, 1)));
+        EXPECT_FALSE(is_arena_allocated(car(nth(e, 1))));
+        EXPECT_TRUE(is_arena_allocated(l));
+        EXPECT_EQ(7u, ar.live()); // only l, the escaped copy is on the heap
+    }
+    EXPECT_TRUE(equalv(list(1, list(2, 3)), e));
+}
+TEST(arena,outlive_arena)
+{
+    // an atom keeps its arena's memory alive after the arena is closed
+    atom a;
+    {
+        arena ar;
+        a = list(1, std::string("a string too long for small string storage"));
+    }
+    EXPECT_TRUE(is_arena_allocated(a));
+    EXPECT_EQ(1, value<int>(car(a)));
+    EXPECT_EQ("a string too long for small string storage", value<std::string>(nth(a, 1)));
+    EXPECT_FALSE(is_arena_allocated(atom(1)));
+    a = nil(); // frees the arena's blocks
+}
+
+
+//-----------------------------------------------------------------------------
+// copy-on-write tests
+TEST(copy_on_write,cow_copy)
+{
+    atom a(1);
+    atom b = cow_copy(a);
+    EXPECT_TRUE(equalp(a, b)); // no copy is made
+    b.set(2);
+    EXPECT_FALSE(equalp(a, b));
+    EXPECT_EQ(1, value<int>(a));
+    EXPECT_EQ(2, value<int>(b));
+}
+TEST(copy_on_write,cow_copy_set)
+{
+    atom a(1);
+    atom b = cow_copy(a);
+    a.set(2); // the original detaches just the same
+    EXPECT_EQ(2, value<int>(a));
+    EXPECT_EQ(1, value<int>(b));
+}
+TEST(copy_on_write,cow_copy_extract)
+{
+    atom a(std::string("hello"));
+    atom b = cow_copy(a);
+    std::string s = b.extract<std::string>();
+    EXPECT_EQ("hello", s);
+    EXPECT_EQ("hello", value<std::string>(a));
+}
+TEST(copy_on_write,cow_copy_read_only_cast)
+{
+    atom a(std::string("hello"));
+    atom b = cow_copy(a);
+    EXPECT_EQ("hello", b.atom_cast<const std::string&>());
+    EXPECT_EQ("hello", b.atom_cast<std::string>());
+    EXPECT_TRUE(equalp(a, b)); // reads do not detach
+    EXPECT_TRUE(is_cow(b));
+
+    b.atom_cast<std::string&>() = "world";
+    EXPECT_FALSE(equalp(a, b));
+    EXPECT_EQ("hello", value<std::string>(a));
+    EXPECT_EQ("world", value<std::string>(b));
+}
+TEST(copy_on_write,cow_copy_of_shared_context)
+{
+    // earlier plain copies keep sharing writes, the copy-on-write copy is a 
+    // plain copy
+    atom a(1);
+    atom b = a;
+    atom c = cow_copy(a);
+    EXPECT_FALSE(is_cow(b));
+    EXPECT_FALSE(equalp(a, c));
+    b.set(2);
+    EXPECT_EQ(2, value<int>(a));
+    EXPECT_EQ(1, value<int>(c));
+}
+TEST(copy_on_write,free_functions)
+{
+    // the free functions write through the caller's atom
+    atom a(std::string("hello"));
+    atom b = cow_copy(a);
+    b = atom();
+    fl::set(a, "world");
+    EXPECT_EQ("world", value<std::string>(a));
+
+    b = cow_copy(a);
+    b = atom();
+    fl::atom_cast<std::string&>(a) = "again";
+    EXPECT_EQ("again", value<std::string>(a));
+
+    b = cow_copy(a);
+    b = atom();
+    std::string s = fl::extract<std::string>(a);
+    EXPECT_EQ("again", s);
+    EXPECT_FALSE(is_cow(a));
+
+    // while shared they detach the caller's atom only
+    b = cow_copy(a);
+    fl::set(a, "hello");
+    EXPECT_EQ("hello", value<std::string>(a));
+    EXPECT_TRUE(is_cow(b));
+}
+TEST(copy_on_write,cow_copy_tree)
+{
+    atom a = list(1,2,3);
+    atom b = cow_copy_tree(a);
+    EXPECT_TRUE(equalp(a, b));
+    atom e = car(b);
+    e.set(4);
+    EXPECT_EQ(4, value<int>(e));
+    EXPECT_TRUE(equalv(a, list(1,2,3)));
+    EXPECT_TRUE(equalv(b, list(1,2,3)));
+}
+TEST(copy_on_write,is_cow)
+{
+    atom a = list(1,2);
+    EXPECT_FALSE(is_cow(a));
+    cow_copy_tree(a);
+    EXPECT_TRUE(is_cow(a));
+    EXPECT_TRUE(is_cow(car(a)));
+    EXPECT_TRUE(is_cow(cdr(a)));
+
+    // the sole owner of a context modifies it in place
+    atom b(1);
+    cow_copy(b);
+    b.set(2);
+    EXPECT_FALSE(is_cow(b));
+}
+TEST(copy_on_write,channel_copy_policy)
+{
+    channel ch = make_channel(copy_policy::copy_on_write);
+    atom a = list(1,2,3);
+    ch.send(a);
+    atom b;
+    ASSERT_TRUE(ch.recv(b));
+    EXPECT_TRUE(equalp(a, b));
+    EXPECT_TRUE(is_cow(a));
+
+    atom e = car(b);
+    e.set(4);
+    EXPECT_TRUE(equalv(a, list(1,2,3)));
+
+    // a tree already sent is sent again without copying or walking it
+    {
+        local_scope ls;
+        atom l = list(1, list(2, 3));
+        ch.send(l);
+        ASSERT_TRUE(ch.recv(b));
+        EXPECT_TRUE(is_cow(nth(l, 1)));
+        EXPECT_FALSE(is_local(car(nth(l, 1))));
+        ch.send(l);
+        ASSERT_TRUE(ch.recv(b));
+        EXPECT_TRUE(equalp(l, b));
+    }
+
+    // the default policy is a deep copy
+    channel deep = make_channel();
+    deep.send(a);
+    ASSERT_TRUE(deep.recv(b));
+    EXPECT_FALSE(equalp(a, b));
+    EXPECT_TRUE(equalv(a, b));
+}
+TEST(copy_on_write,continuation_copy_policy)
+{
+    continuation cn = make_continuation(copy_policy::copy_on_write);
+    channel done = make_channel(copy_policy::copy_on_write);
+    atom a = list(1,2,3);
+    cn.send(a);
+    cn.recv([done](atom args) mutable { done.send(car(args)); });
+    atom b;
+    ASSERT_TRUE(done.recv(b));
+    EXPECT_TRUE(equalp(a, b));
+    EXPECT_TRUE(is_cow(a));
+}
+
+
+//-----------------------------------------------------------------------------
+// freeze tests
+TEST(freeze,freeze)
+{
+    atom a = list(1, list(2, 3));
+    EXPECT_TRUE(equalp(a, freeze(a)));
+    EXPECT_TRUE(is_frozen(a));
+    EXPECT_TRUE(is_frozen(car(a)));
+    EXPECT_TRUE(is_frozen(car(car(cdr(a)))));
+}
+TEST(freeze,is_frozen)
+{
+    EXPECT_FALSE(is_frozen(atom(1)));
+    EXPECT_FALSE(is_frozen(nil()));
+    EXPECT_TRUE(is_frozen(freeze(atom(1))));
+}
+TEST(freeze,frozen_set_throws)
+{
+    atom a = freeze(atom(1));
+    EXPECT_THROW(a.set(2), frozen_error);
+    EXPECT_EQ(1, value<int>(a));
+
+    atom lst = freeze(list(1,2));
+    atom e = car(lst);
+    EXPECT_THROW(e.set(3), frozen_error);
+    EXPECT_THROW(e = 3, frozen_error);
+}
+TEST(freeze,frozen_extract_throws)
+{
+    atom a = freeze(atom(std::string("hello")));
+    EXPECT_THROW(a.extract<std::string>(), frozen_error);
+    EXPECT_THROW(a.atom_cast<std::string&>(), frozen_error);
+    EXPECT_EQ("hello", a.atom_cast<const std::string&>()); // reads are allowed
+    EXPECT_EQ("hello", value<std::string>(a));
+}
+TEST(freeze,copy_frozen)
+{
+    atom a = freeze(list(1,2));
+    atom b = copy_tree(a);
+    EXPECT_FALSE(is_frozen(b));
+    EXPECT_FALSE(is_frozen(car(b)));
+    atom e = car(b);
+    e.set(3);
+    EXPECT_TRUE(equalv(a, list(1,2)));
+
+    atom c = copy(car(a));
+    c.set(4);
+    EXPECT_EQ(1, value<int>(car(a)));
+}
+TEST(freeze,channel_send_frozen)
+{
+    channel ch = make_channel();
+    atom a = freeze(list(1,2));
+    ch.send(a);
+    atom b;
+    ASSERT_TRUE(ch.recv(b));
+    EXPECT_TRUE(equalp(a, b)); // not copied
+}
+TEST(freeze,worker_schedule_frozen)
+{
+    struct message { int count; };
+    channel done = make_channel();
+
+    // a function writing to its message receives a mutable copy
+    worker w([done](message& m) mutable 
+    { 
+        ++m.count; 
+        done.send(m.count); 
+    });
+    atom a = freeze(atom(message{1}));
+    w.schedule(a);
+    w.schedule(a);
+    int n = 0;
+    ASSERT_TRUE(done.recv(n));
+    EXPECT_EQ(2, n);
+    ASSERT_TRUE(done.recv(n));
+    EXPECT_EQ(2, n);
+    EXPECT_EQ(1, value<message>(a).count);
+
+    // other functions receive the frozen message itself
+    worker r([done](atom m) mutable { done.send(is_frozen(car(m))); });
+    r.schedule(a);
+    bool frozen = false;
+    ASSERT_TRUE(done.recv(frozen));
+    EXPECT_TRUE(frozen);
+}
+TEST(freeze,continuation_send_frozen)
+{
+    continuation cn = make_continuation();
+    channel done = make_channel();
+    atom a = freeze(list(1,2));
+    cn.send(a);
+    cn.recv([done](atom args) mutable { done.send(car(args)); });
+    atom b;
+    ASSERT_TRUE(done.recv(b));
+    EXPECT_TRUE(equalp(a, b)); // passed by reference, not copied
+}
+
+
+
+//-----------------------------------------------------------------------------
+// reclamation tests
+TEST(reclamation,long_list)
+{
+    // recursive destruction would overflow the stack long before this
+    const int n = 2000000;
+    atom a;
+    for(int i = 0; i < n; ++i){ a = cons(i, a); }
+    EXPECT_EQ(size_t(n), length(a));
+    a = nil();
+    EXPECT_EQ(0u, pending_reclaim());
+
+    std::vector<int> v(n, 1);
+    atom b = atomize_container(v);
+    b = nil();
+    EXPECT_EQ(0u, pending_reclaim());
+}
+TEST(reclamation,deep_tree)
+{
+    const int n = 1000000;
+    atom a(0);
+    for(int i = 0; i < n; ++i){ a = cons(a, i); } // nested through the cars
+    EXPECT_EQ(n - 1, value<int>(cdr(a)));
+    a = nil();
+    EXPECT_EQ(0u, pending_reclaim());
+}
+TEST(reclamation,sliced)
+{
+    set_reclaim_mode(reclaim_mode::sliced, 100);
+    EXPECT_EQ(reclaim_mode::sliced, get_reclaim_mode());
+
+    // each cell holds a copy of p, so p's use count tracks the cells left
+    std::shared_ptr<int> p = std::make_shared<int>(1);
+    atom a;
+    for(int i = 0; i < 1000; ++i){ a = cons(p, a); }
+    EXPECT_EQ(1001, p.use_count());
+
+    a = nil(); // frees a slice of 100 contexts, queues the rest
+    EXPECT_GT(pending_reclaim(), 0u);
+    long left = p.use_count();
+    EXPECT_LT(left, 1001);
+    EXPECT_GT(left, 1000 - 100);
+
+    // each further release frees another slice
+    atom b(2);
+    b = nil();
+    EXPECT_LT(p.use_count(), left);
+    EXPECT_GT(p.use_count(), left - 100);
+
+    while(pending_reclaim()){ atom c(3); c = nil(); }
+    EXPECT_EQ(1, p.use_count());
+
+    set_reclaim_mode(reclaim_mode::immediate);
+}
+TEST(reclamation,reclaim)
+{
+    set_reclaim_mode(reclaim_mode::sliced, 10);
+    std::shared_ptr<int> p = std::make_shared<int>(1);
+    atom a;
+    for(int i = 0; i < 1000; ++i){ a = cons(p, a); }
+    a = nil();
+
+    ASSERT_GT(pending_reclaim(), 0u);
+    long left = p.use_count();
+    EXPECT_EQ(pending_reclaim(), reclaim(10));
+    EXPECT_LT(p.use_count(), left);
+    EXPECT_GT(p.use_count(), 1);
+    EXPECT_EQ(0u, reclaim());
+    EXPECT_EQ(0u, pending_reclaim());
+    EXPECT_EQ(1, p.use_count());
+
+    set_reclaim_mode(reclaim_mode::immediate);
+}
+TEST(reclamation,background)
+{
+    set_reclaim_mode(reclaim_mode::background, 10);
+
+    std::shared_ptr<int> p = std::make_shared<int>(1);
+    std::weak_ptr<int> w = p;
+    atom a = list(p);
+    p.reset();
+    for(int i = 0; i < 10000; ++i){ a = cons(i, a); }
+
+    a = nil(); // the rest is handed to the background reclaimer
+    EXPECT_EQ(0u, pending_reclaim());
+
+    for(int i = 0; i < 1000 && !w.expired(); ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    EXPECT_TRUE(w.expired());
+
+    set_reclaim_mode(reclaim_mode::immediate);
+}
+TEST(reclamation,background_keeps_local)
+{
+    set_reclaim_mode(reclaim_mode::background, 10);
+    {
+        local_scope ls;
+        atom a;
+        for(int i = 0; i < 1000; ++i){ a = cons(i, a); }
+        a = nil();
+        EXPECT_GT(pending_reclaim(), 0u); // not handed to another thread
+    }
+    EXPECT_EQ(0u, reclaim());
+    set_reclaim_mode(reclaim_mode::immediate);
+}
+TEST(reclamation,thread_exit)
+{
+    std::shared_ptr<int> p = std::make_shared<int>(1);
+    std::weak_ptr<int> w = p;
+    atom a = list(p);
+    p.reset();
+    for(int i = 0; i < 1000; ++i){ a = cons(i, a); }
+
+    std::atomic<size_t> pending(0);
+    std::thread t([&]{
+        set_reclaim_mode(reclaim_mode::sliced, 10);
+        atom b = std::move(a);
+        b = nil();
+        pending = pending_reclaim();
+    });
+    t.join();
+
+    EXPECT_GT(pending.load(), 0u);
+    EXPECT_TRUE(w.expired()); // freed when the thread exited
+}
+
+
+//-----------------------------------------------------------------------------
+// intern tests
+TEST(intern,intern)
+{
+    atom a = intern(5);
+    atom b = intern(5);
+    EXPECT_TRUE(equalp(a, b));
+    EXPECT_EQ(5, value<int>(a));
+    EXPECT_FALSE(equalp(a, intern(6)));
+    EXPECT_FALSE(equalp(intern(5), intern(5L))); // one table per type
+
+    std::string s("interned");
+    EXPECT_TRUE(equalp(intern(s), intern(std::string("interned"))));
+    EXPECT_EQ("interned", s);
+}
+TEST(intern,intern_c_string)
+{
+    atom a = intern("hello");
+    EXPECT_TRUE(is<std::string>(a));
+    EXPECT_TRUE(equalp(a, intern(std::string("hello"))));
+}
+TEST(intern,intern_atom)
+{
+    atom l = list(1, std::string("two"));
+    atom a = intern(l);
+    EXPECT_TRUE(is_interned(a));
+    EXPECT_FALSE(equalp(a, l)); // the interned atom is a copy
+    EXPECT_TRUE(equalv(a, l));
+    EXPECT_TRUE(equalp(a, intern(list(1, std::string("two")))));
+    EXPECT_TRUE(equalp(a, intern(a)));
+
+    // values with a per-type table share it with intern(T)
+    EXPECT_TRUE(equalp(intern(atom(5)), intern(5)));
+    EXPECT_TRUE(equalp(intern(atom(std::string("x"))), intern("x")));
+    EXPECT_TRUE(equalp(intern(atom(symbol("x"))), make_symbol("x")));
+    EXPECT_FALSE(equalp(intern(atom(5)), intern(atom(5L))));
+
+    // values without one are interned by value in the atom table
+    struct point { int x; };
+    atom p = intern(atom(point{1}));
+    EXPECT_TRUE(is_interned(p));
+    EXPECT_TRUE(equalp(p, intern(p)));
+
+    // later modification of the original does not affect the interned atom
+    atom e = car(l);
+    e.set(3);
+    EXPECT_EQ(1, value<int>(car(a)));
+}
+TEST(intern,is_interned)
+{
+    EXPECT_TRUE(is_interned(intern(1)));
+    EXPECT_FALSE(is_interned(atom(1)));
+    EXPECT_FALSE(is_interned(nil()));
+
+    // the flag belongs to the interned context, copies are not interned
+    EXPECT_FALSE(is_interned(intern(1).copy()));
+}
+TEST(intern,equalv_interned)
+{
+    EXPECT_TRUE(equalv(intern(1), intern(1)));
+    EXPECT_FALSE(equalv(intern(1), intern(2)));
+
+    // interned and non-interned values still compare by value
+    EXPECT_TRUE(equalv(intern(1), atom(1)));
+    EXPECT_TRUE(equalv(atom(1), intern(1)));
+}
+TEST(intern,symbol)
+{
+    symbol a("name");
+    symbol b(std::string("name"));
+    symbol c("other");
+    EXPECT_TRUE(a == b);
+    EXPECT_TRUE(a != c);
+    EXPECT_EQ(&a.name(), &b.name()); // one table entry per name
+    EXPECT_EQ("name", a.name());
+    EXPECT_EQ("", symbol().name());
+    EXPECT_EQ(std::hash<symbol>()(a), std::hash<symbol>()(b));
+
+    b = c;
+    EXPECT_TRUE(b == c);
+}
+TEST(intern,make_symbol)
+{
+    atom a = make_symbol("x");
+    EXPECT_TRUE(equalp(a, make_symbol("x")));
+    EXPECT_FALSE(equalv(a, make_symbol("y")));
+    EXPECT_TRUE(value<symbol>(a) == symbol("x"));
+    EXPECT_EQ("x", detail::print_value(value<symbol>(a), std::false_type()));
+}
+TEST(intern,is_symbol)
+{
+    EXPECT_TRUE(is_symbol(make_symbol("x")));
+    EXPECT_TRUE(is_symbol(atom(symbol("x"))));
+    EXPECT_FALSE(is_symbol(atom(std::string("x"))));
+    EXPECT_FALSE(is_symbol(nil()));
+}
 
 
 //-----------------------------------------------------------------------------
 // mutable tests
-TEST(mutate,setv){}
-TEST(mutate,mutable_value){}
+TEST(mutate,setv)
+{
+    atom a(1);
+    atom b = a;
+    b.set(2);
+    EXPECT_EQ(2, value<int>(a)); // every copy of the atom sees the change
+    set(a, std::string("x"));
+    EXPECT_EQ("x", value<std::string>(b));
+}
+TEST(mutate,mutable_value)
+{
+    atom a(1);
+    a.atom_cast<int&>() = 3;
+    EXPECT_EQ(3, value<int>(a));
+    std::string s = atom(std::string("moved")).extract<std::string>();
+    EXPECT_EQ("moved", s);
+}
 
 
 //-----------------------------------------------------------------------------
 // cons tests
-TEST(cons,cons_cell_default_constructor){}
-TEST(cons,cons_cell_lvalue_lhs_constructor){}
-TEST(cons,cons_cell_lvalue_lhs_lvalue_rhs_constructor){}
-TEST(cons,cons_cell_rvalue_lhs_constructor){}
-TEST(cons,cons_cell_rvalue_lhs_rvalue_rhs_constructor){}
-TEST(cons,cons_cell_lvalue_lhs_rvalue_rhs_constructor){}
-TEST(cons,cons_cell_rvalue_lhs_lvalue_rhs_constructor){}
-TEST(cons,cons_cell_operator_bool){}
-TEST(cons,cons_cell_operator_copy_lvalue){}
-TEST(cons,cons_cell_operator_copy_rvalue){}
-TEST(cons,cons_cell_operator_equality_lvalue){}
-TEST(cons,cons_cell_operator_equality_rvalue){}
-TEST(cons,cons_cell_is_cons){}
-TEST(cons,cons_cell_cons){}
-TEST(cons,cons_cell_car){}
-TEST(cons,cons_cell_cdr){}
-TEST(cons,cons_cell_copy){}
+TEST(cons,cons_cell_default_constructor)
+{
+    detail::cons_cell c;
+    EXPECT_TRUE(is_nil(c.car()));
+    EXPECT_TRUE(is_nil(c.cdr()));
+}
+TEST(cons,cons_cell_lvalue_lhs_constructor)
+{
+    atom a(1);
+    detail::cons_cell c(a);
+    EXPECT_TRUE(equalp(a, c.car()));
+    EXPECT_TRUE(is_nil(c.cdr()));
+}
+TEST(cons,cons_cell_lvalue_lhs_lvalue_rhs_constructor)
+{
+    atom a(1);
+    atom b(2);
+    detail::cons_cell c(a, b);
+    EXPECT_TRUE(equalp(a, c.car()));
+    EXPECT_TRUE(equalp(b, c.cdr()));
+}
+TEST(cons,cons_cell_rvalue_lhs_constructor)
+{
+    detail::cons_cell c(atom(1));
+    EXPECT_EQ(1, value<int>(c.car()));
+}
+TEST(cons,cons_cell_rvalue_lhs_rvalue_rhs_constructor)
+{
+    detail::cons_cell c(atom(1), atom(2));
+    EXPECT_EQ(1, value<int>(c.car()));
+    EXPECT_EQ(2, value<int>(c.cdr()));
+}
+TEST(cons,cons_cell_lvalue_lhs_rvalue_rhs_constructor)
+{
+    atom a(1);
+    detail::cons_cell c(a, atom(2));
+    EXPECT_TRUE(equalp(a, c.car()));
+    EXPECT_EQ(2, value<int>(c.cdr()));
+}
+TEST(cons,cons_cell_rvalue_lhs_lvalue_rhs_constructor)
+{
+    atom b(2);
+    detail::cons_cell c(atom(1), b);
+    EXPECT_EQ(1, value<int>(c.car()));
+    EXPECT_TRUE(equalp(b, c.cdr()));
+}
+TEST(cons,cons_cell_operator_bool)
+{
+    EXPECT_FALSE(bool(detail::cons_cell()));
+    EXPECT_TRUE(bool(detail::cons_cell(atom(1))));
+}
+TEST(cons,cons_cell_operator_copy_lvalue)
+{
+    detail::cons_cell c(atom(1), atom(2));
+    detail::cons_cell d(c);
+    EXPECT_TRUE(equalp(c.car(), d.car()));
+    EXPECT_TRUE(equalp(c.cdr(), d.cdr()));
+}
+TEST(cons,cons_cell_operator_copy_rvalue)
+{
+    detail::cons_cell d(detail::cons_cell(atom(1), atom(2)));
+    EXPECT_EQ(1, value<int>(d.car()));
+    EXPECT_EQ(2, value<int>(d.cdr()));
+}
+TEST(cons,cons_cell_operator_equality_lvalue)
+{
+    detail::cons_cell c(atom(1), atom(2));
+    detail::cons_cell d(atom(1), atom(2));
+    detail::cons_cell e(atom(1), atom(3));
+    EXPECT_TRUE(c == d);
+    EXPECT_FALSE(c == e);
+}
+TEST(cons,cons_cell_operator_equality_rvalue)
+{
+    detail::cons_cell c(atom(1), atom(2));
+    EXPECT_TRUE(c == detail::cons_cell(atom(1), atom(2)));
+}
+TEST(cons,cons_cell_is_cons)
+{
+    EXPECT_TRUE(is_cons(cons(1, 2)));
+    EXPECT_FALSE(is_cons(atom(1)));
+    EXPECT_FALSE(is_cons(nil()));
+}
+TEST(cons,cons_cell_cons)
+{
+    atom c = cons(1, nil());
+    EXPECT_EQ(1, value<int>(car(c)));
+    EXPECT_TRUE(is_nil(cdr(c)));
+}
+TEST(cons,cons_cell_car)
+{
+    EXPECT_EQ(1, value<int>(car(cons(1, 2))));
+}
+TEST(cons,cons_cell_cdr)
+{
+    EXPECT_EQ(2, value<int>(cdr(cons(1, 2))));
+}
+TEST(cons,cons_cell_copy)
+{
+    atom a = cons(1, 2);
+    atom b = copy(a);
+    EXPECT_FALSE(equalp(a, b));
+    EXPECT_TRUE(equalv(a, b));
+}
+TEST(cons,cons_cell_inline_storage)
+{
+    EXPECT_TRUE((detail::is_small_value<detail::cons_cell,detail::cell_value_capacity>::value));
+    EXPECT_EQ(detail::cell_value_capacity, detail::value_capacity<detail::cons_cell>());
+    EXPECT_EQ(detail::cell_value_capacity, detail::value_capacity<int>());
+    EXPECT_EQ(detail::small_value_capacity, detail::value_capacity<std::string>());
+
+    // a value too large for the cell class of an existing context is boxed
+    atom a(1);
+    atom b = a;
+    a.set(std::string("a string in a cell sized context"));
+    EXPECT_EQ("a string in a cell sized context", value<std::string>(b));
+}
+TEST(cons,cons_cell_pool_reuse)
+{
+    // a freed block is the next one handed out by the thread's pool
+    atom a(1);
+    const void* p = &value<int>(a);
+    a = nil();
+    atom b(2);
+    EXPECT_EQ(p, (const void*)&value<int>(b));
+}
+TEST(cons,cons_cell_free_on_other_thread)
+{
+    atom a(1);
+    const void* p = &value<int>(a);
+    bool reused = false;
+
+    // the block joins the free list of the thread releasing it
+    std::thread t([&]{
+        a = nil();
+        atom b(2);
+        reused = p == (const void*)&value<int>(b);
+    });
+    t.join();
+    EXPECT_TRUE(reused);
+}
+TEST(cons,cons_cell_pool_bounded)
+{
+    // one thread allocates, another frees: the freeing thread hands its 
+    // surplus back through the global list instead of hoarding every block
+    const size_t n = 20000;
+    std::vector<atom> batch;
+    channel todo = make_channel();
+    channel done = make_channel();
+    size_t consumer_free = 0;
+
+    std::thread consumer([&]{
+        atom token;
+        while(todo.recv(token))
+        {
+            batch.clear();
+            consumer_free = std::max(consumer_free, detail::context_pool::local(0).size());
+            done.send(token);
+        }
+    });
+
+    auto round = [&]{
+        for(size_t i = 0; i < n; ++i){ batch.push_back(atom(int(i))); }
+        todo.send(1);
+        atom token;
+        done.recv(token);
+    };
+
+    round(); 
+    size_t slabs = detail::context_pool::slabs();
+    for(int i = 0; i < 10; ++i){ round(); }
+
+    todo.close();
+    consumer.join();
+    EXPECT_LE(consumer_free, detail::context_pool::max_free);
+    EXPECT_LT(detail::context_pool::slabs() - slabs, 10u); // not 10 per round
+}
 
 
 //-----------------------------------------------------------------------------
 // list tests
-TEST(list,inspect_list){}
-TEST(list,is_list){}
-TEST(list,length){}
-TEST(list,head){}
-TEST(list,tail){}
-TEST(list,nth){}
-TEST(list,reverse){}
-TEST(list,copy_list){}
-TEST(list,append){}
+TEST(list,inspect_list)
+{
+    list_info li = inspect_list(list(1, 2, 3));
+    EXPECT_TRUE(li.is_list);
+    EXPECT_EQ(3u, li.length);
+    li = inspect_list(cons(1, 2));
+    EXPECT_FALSE(li.is_list);
+}
+TEST(list,is_list)
+{
+    EXPECT_TRUE(is_list(list(1)));
+    EXPECT_TRUE(is_list(nil()));
+    EXPECT_FALSE(is_list(atom(1)));
+}
+TEST(list,length)
+{
+    EXPECT_EQ(3u, length(list(1, 2, 3)));
+    EXPECT_EQ(0u, length(nil()));
+}
+TEST(list,head)
+{
+    EXPECT_EQ(1, value<int>(head(list(1, 2, 3))));
+}
+TEST(list,tail)
+{
+    EXPECT_EQ(3, value<int>(tail(list(1, 2, 3))));
+}
+TEST(list,nth)
+{
+    atom l = list(1, 2, 3);
+    EXPECT_EQ(1, value<int>(nth(l, 0)));
+    EXPECT_EQ(3, value<int>(nth(l, 2)));
+}
+TEST(list,reverse)
+{
+    EXPECT_TRUE(equalv(list(3, 2, 1), reverse(list(1, 2, 3))));
+    EXPECT_TRUE(is_nil(reverse(nil())));
+}
+TEST(list,copy_list)
+{
+    atom a = list(1, list(2, 3));
+    atom b = copy_tree(a);
+    EXPECT_TRUE(equalv(a, b));
+    EXPECT_FALSE(equalp(car(a), car(b)));
+    atom e = car(b);
+    e.set(4);
+    EXPECT_EQ(1, value<int>(car(a)));
+}
+TEST(list,copy_list_contiguous)
+{
+    atom a = cons(1, cons(list(2, 3), cons(4, nil()))); // not a list_run
+    atom b = copy_list(a);
+    EXPECT_TRUE(equalv(a, b));
+    EXPECT_FALSE(equalp(a, b));
+    EXPECT_FALSE(equalp(nth(a, 1), nth(b, 1))); // elements are copied
+    EXPECT_EQ(3u, length(b));
+
+    // the copied cells are laid out consecutively in one run
+    const char* c0 = reinterpret_cast<const char*>(&value<detail::cons_cell>(b));
+    const char* c1 = reinterpret_cast<const char*>(&value<detail::cons_cell>(cdr(b)));
+    const char* c2 = reinterpret_cast<const char*>(&value<detail::cons_cell>(cdr(cdr(b))));
+    EXPECT_EQ(c1 - c0, c2 - c1);
+    EXPECT_TRUE(is_nil(copy_list(nil())));
+    EXPECT_EQ(5, value<int>(copy_list(atom(5))));
+}
+TEST(list,copy_tree)
+{
+    atom a = list(1, list(2, 3), std::string("four"));
+    atom b = copy_tree(a);
+    EXPECT_TRUE(equalv(a, b));
+    EXPECT_FALSE(equalp(a, b));
+    EXPECT_FALSE(equalp(nth(a, 1), nth(b, 1)));
+    EXPECT_FALSE(equalp(car(nth(a, 1)), car(nth(b, 1))));
+    atom e = car(nth(b, 1));
+    e.set(5);
+    EXPECT_EQ(2, value<int>(car(nth(a, 1))));
+
+    atom dotted = copy_tree(cons(1, 2));
+    EXPECT_EQ(2, value<int>(cdr(dotted)));
+    EXPECT_TRUE(is_nil(copy_tree(nil())));
+}
+TEST(list,copy_tree_long_list)
+{
+    // deep enough to overflow the stack if copying recursed per cell
+    const int n = 1000000;
+    atom a;
+    for(int i = 0; i < n; ++i){ a = cons(i, a); }
+    atom b = copy_tree(a);
+    EXPECT_EQ(size_t(n), length(b));
+    EXPECT_EQ(n - 1, value<int>(car(b)));
+    EXPECT_EQ(0, value<int>(tail(b)));
+    while(a){ a = cdr(a); }
+    while(b){ b = cdr(b); }
+}
+TEST(list,copy_tree_preserves_sharing)
+{
+    atom s = list(1, 2);
+    atom a = list(s, s, atom(s));
+    atom b = copy_tree(a);
+    EXPECT_TRUE(equalv(a, b));
+    EXPECT_FALSE(equalp(car(b), s));
+    EXPECT_TRUE(equalp(car(b), nth(b, 1)));
+    EXPECT_TRUE(equalp(car(b), nth(b, 2)));
+
+    // shared leaves are also copied once
+    atom v(std::string("v"));
+    atom c = copy_tree(list(v, v));
+    EXPECT_FALSE(equalp(car(c), v));
+    EXPECT_TRUE(equalp(car(c), nth(c, 1)));
+}
+TEST(list,copy_tree_cycle)
+{
+    atom a = list(1, 2);
+    atom last = cdr(a);
+    last.atom_cast<detail::cons_cell&>() = detail::cons_cell(atom(2), a);
+    EXPECT_THROW(copy_tree(a), cycle_error);
+    EXPECT_THROW(copy_list(a), cycle_error);
+
+    // a cycle through a car
+    atom b = list(1);
+    b.atom_cast<detail::cons_cell&>() = detail::cons_cell(b, atom());
+    EXPECT_THROW(copy_tree(b), cycle_error);
+
+    // break the cycles so the cells are released
+    last.atom_cast<detail::cons_cell&>() = detail::cons_cell(atom(2), atom());
+    b.atom_cast<detail::cons_cell&>() = detail::cons_cell(atom(1), atom());
+    EXPECT_TRUE(equalv(list(1, 2), copy_tree(a)));
+}
+TEST(list,append)
+{
+    atom a = list(1, 2);
+    atom b = list(3);
+    EXPECT_TRUE(equalv(list(1, 2, 3), append(a, b)));
+    EXPECT_TRUE(equalv(list(1, 2, 3, 1, 2), append(a, b, a)));
+    EXPECT_TRUE(equalv(list(1, 2), a));
+}
+TEST(list,append_shares_last)
+{
+    atom a = list(1, 2);
+    atom b = list(3, 4);
+    atom c = append(a, b);
+    EXPECT_TRUE(equalv(list(1, 2, 3, 4), c));
+    EXPECT_TRUE(equalp(b, nth_cons(c, 2))); // the last list is the tail
+    EXPECT_FALSE(equalp(a, c)); // the other lists are copied
+    EXPECT_FALSE(equalp(cdr(a), cdr(c)));
+    EXPECT_EQ(4u, length(c));
+
+    atom d = append(a, nil(), b);
+    EXPECT_TRUE(equalv(c, d));
+    EXPECT_TRUE(equalp(b, nth_cons(d, 2)));
+    EXPECT_TRUE(equalp(b, append(nil(), b)));
+}
+TEST(list,list_builder)
+{
+    list_builder b;
+    EXPECT_EQ(0u, b.size());
+    for(int i = 0; i < 5; ++i){ b.push_back(i*i); }
+    EXPECT_EQ(5u, b.size());
+    atom l = b.finish();
+    EXPECT_TRUE(equalv(list(0, 1, 4, 9, 16), l));
+    EXPECT_EQ(5u, length(l));
+
+    // more elements than the hint spill into further runs
+    list_builder h(2);
+    for(int i = 0; i < 100; ++i){ h.push_back(i); }
+    atom hl = h.finish();
+    EXPECT_EQ(100u, length(hl));
+    EXPECT_EQ(0, value<int>(car(hl)));
+    EXPECT_EQ(99, value<int>(tail(hl)));
+    EXPECT_EQ(57, value<int>(nth(hl, 57)));
+
+    EXPECT_TRUE(is_nil(list_builder().finish()));
+}
+TEST(list,list_builder_finish_tail)
+{
+    atom t = list(3, 4);
+    list_builder b;
+    b.push_back(1).push_back(2);
+    atom l = b.finish(t);
+    EXPECT_TRUE(equalv(list(1, 2, 3, 4), l));
+    EXPECT_TRUE(equalp(t, cdr(cdr(l)))); // the tail is shared, not copied
+    EXPECT_EQ(4u, length(l));
+
+    // a dotted tail
+    list_builder d;
+    d.push_back(1);
+    atom dl = d.finish(atom(2));
+    EXPECT_EQ(2, value<int>(cdr(dl)));
+    EXPECT_FALSE(is_list(dl));
+
+    // an empty builder returns the tail itself
+    EXPECT_TRUE(equalp(t, list_builder().finish(t)));
+}
+TEST(list,list_builder_reuse)
+{
+    list_builder b;
+    b.push_back(1).push_back(2);
+    atom first = b.finish();
+    EXPECT_EQ(0u, b.size());
+    b.push_back(3);
+    atom second = b.finish();
+    EXPECT_TRUE(equalv(list(1, 2), first));
+    EXPECT_TRUE(equalv(list(3), second));
+    EXPECT_EQ(2u, length(first));
+    EXPECT_EQ(1u, length(second));
+}
+TEST(list,reverse_contiguous)
+{
+    atom a = cons(1, cons(2, cons(3, nil()))); // not a list_run
+    atom r = reverse(a);
+    EXPECT_TRUE(equalv(list(3, 2, 1), r));
+    EXPECT_TRUE(equalp(car(a), nth(r, 2))); // elements are shared
+    EXPECT_EQ(3u, length(r));
+
+    // the reversed cells are laid out consecutively in one run
+    const char* c0 = reinterpret_cast<const char*>(&value<detail::cons_cell>(r));
+    const char* c1 = reinterpret_cast<const char*>(&value<detail::cons_cell>(cdr(r)));
+    const char* c2 = reinterpret_cast<const char*>(&value<detail::cons_cell>(cdr(cdr(r))));
+    EXPECT_EQ(c1 - c0, c2 - c1);
+}
+TEST(list,map_in_order)
+{
+    std::vector<int> calls;
+    atom r = map([&calls](int i){ calls.push_back(i); return i*10; }, list(1, 2, 3));
+    EXPECT_TRUE(equalv(list(10, 20, 30), r));
+    EXPECT_EQ((std::vector<int>{1, 2, 3}), calls); // f is called front to back
+
+    atom s = map([](int a, int b){ return a + b; }, list(1, 2, 3), list(10, 20, 30));
+    EXPECT_TRUE(equalv(list(11, 22, 33), s));
+    EXPECT_TRUE(is_nil(map([](int i){ return i; }, nil())));
+}
+TEST(list,mapl_in_order)
+{
+    std::vector<int> calls;
+    atom r = mapl([&calls](int i){ calls.push_back(i); return i + 1; }, 2, list(1, 2, 3));
+    EXPECT_TRUE(equalv(list(2, 3), r));
+    EXPECT_EQ((std::vector<int>{1, 2}), calls);
+    EXPECT_EQ(2u, length(r));
+}
+TEST(list,list_run_length)
+{
+    atom a = list(1,2,3,4,5);
+    EXPECT_EQ(5u, length(a));
+    EXPECT_EQ(6u, length(cons(0, a)));
+    EXPECT_EQ(3u, length(cdr(cdr(a))));
+}
+TEST(list,list_run_nth)
+{
+    std::vector<int> v(1000);
+    for(size_t i = 0; i < v.size(); ++i){ v[i] = int(i); }
+    atom a = atomize_container(v);
+    for(size_t i = 0; i < v.size(); i += 97){ EXPECT_EQ(int(i), value<int>(nth(a, i))); }
+    EXPECT_EQ(999, value<int>(nth(a, 999)));
+}
+TEST(list,list_run_tail)
+{
+    atom a = list(1,2,3,4,5);
+    EXPECT_EQ(5, value<int>(tail(a)));
+    EXPECT_EQ(5, value<int>(tail(cons(0, a))));
+}
+TEST(list,list_run_length_through_runs)
+{
+    atom t = list(4,5,6);
+    atom a = append(list(1,2,3), t);
+    EXPECT_EQ(6u, length(a));
+    EXPECT_EQ(6u, length(a));
+
+    // modifying an unrelated run does not change the length
+    atom u = list(7,8);
+    u.atom_cast<detail::cons_cell&>() = detail::cons_cell(atom(9), atom());
+    EXPECT_EQ(6u, length(a));
+    EXPECT_EQ(1u, length(u));
+
+    // cutting the run a flows into does
+    atom c = nth_cons(t, 1);
+    c.atom_cast<detail::cons_cell&>() = detail::cons_cell(atom(5), atom());
+    EXPECT_EQ(5u, length(a));
+    EXPECT_EQ(2u, length(t));
+    EXPECT_TRUE(equalv(a, list(1,2,3,4,5)));
+}
+TEST(list,list_run_modified_cell)
+{
+    atom a = list(1,2,3,4,5);
+    EXPECT_EQ(5u, length(a)); 
+
+    // cut the list short in the middle of its run
+    atom c = nth_cons(a, 2);
+    c.atom_cast<detail::cons_cell&>() = detail::cons_cell(atom(9), atom());
+    EXPECT_EQ(3u, length(a));
+    EXPECT_EQ(9, value<int>(nth(a, 2)));
+    EXPECT_EQ(9, value<int>(tail(a)));
+    EXPECT_TRUE(equalv(a, list(1,2,9)));
+
+    // a detached copy-on-write copy leaves the run intact
+    atom b = list(1,2,3);
+    atom d = cow_copy_tree(b);
+    d.atom_cast<detail::cons_cell&>() = detail::cons_cell(atom(7), atom());
+    EXPECT_EQ(3u, length(b));
+    EXPECT_EQ(1u, length(d));
+}
+
+
+//-----------------------------------------------------------------------------
+// stream tests
+// the infinite stream n, n+1, n+2...
+atom integers_from(int n){ return make_stream(n, integers_from, n + 1); }
+
+// an int counting its live instances
+struct tracked_int
+{
+    static std::atomic<long> live;
+    int v;
+
+    tracked_int(int i) : v(i) { ++live; }
+    tracked_int(const tracked_int& rhs) : v(rhs.v) { ++live; }
+    ~tracked_int(){ --live; }
+    bool operator==(const tracked_int& rhs) const { return v == rhs.v; }
+};
+
+std::atomic<long> tracked_int::live(0);
+
+TEST(stream,make_stream)
+{
+    atom s = make_stream(1, integers_from, 2);
+    EXPECT_TRUE(is_stream(s));
+    EXPECT_EQ(1, value<int>(stream_car(s)));
+    EXPECT_FALSE(value<stream>(s).forced());
+    EXPECT_EQ(2, value<int>(stream_car(stream_cdr(s))));
+    EXPECT_TRUE(value<stream>(s).forced());
+}
+TEST(stream,is_stream)
+{
+    EXPECT_TRUE(is_stream(integers_from(0)));
+    EXPECT_FALSE(is_stream(list(1, 2)));
+    EXPECT_FALSE(is_stream(nil()));
+}
+TEST(stream,stream_car)
+{
+    atom s = integers_from(5);
+    EXPECT_EQ(5, value<int>(stream_car(s)));
+    EXPECT_EQ(5, value<int>(stream_car(s))); // not consumed
+    EXPECT_FALSE(value<stream>(s).forced());
+}
+TEST(stream,stream_cdr_memoized)
+{
+    int calls = 0;
+    atom s = make_stream(1, [&calls](int n) -> atom { ++calls; return integers_from(n); }, 2);
+    atom r1 = stream_cdr(s);
+    atom r2 = stream_cdr(s);
+    atom r3 = stream_cdr(atom(s)); // copies share the memoized rest
+    EXPECT_EQ(1, calls);
+    EXPECT_TRUE(equalp(r1, r2));
+    EXPECT_TRUE(equalp(r1, r3));
+    EXPECT_EQ(2, value<int>(stream_car(r1)));
+}
+TEST(stream,stream_cdr_concurrent)
+{
+    std::atomic<int> calls(0);
+    atom s = make_stream(1, [&calls](int n) -> atom 
+    { 
+        ++calls; 
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        return integers_from(n); 
+    }, 2);
+
+    const size_t thread_count = 8;
+    std::array<atom, thread_count> results;
+    std::vector<std::thread> threads;
+    for(size_t i = 0; i < thread_count; ++i)
+    {
+        threads.emplace_back([&, i]{ results[i] = stream_cdr(s); });
+    }
+    for(auto& t : threads){ t.join(); }
+
+    EXPECT_EQ(1, calls.load());
+    for(const atom& r : results){ EXPECT_TRUE(equalp(results[0], r)); }
+    EXPECT_EQ(2, value<int>(stream_car(results[0])));
+}
+TEST(stream,stream_map)
+{
+    atom s = stream_map([](int i){ return i*i; }, integers_from(1));
+    EXPECT_EQ(1, value<int>(stream_car(s)));
+    EXPECT_EQ(4, value<int>(stream_car(stream_cdr(s))));
+    EXPECT_EQ(9, value<int>(stream_car(stream_cdr(stream_cdr(s)))));
+    EXPECT_TRUE(is_nil(stream_map([](int i){ return i; }, nil())));
+}
+TEST(stream,stream_filter)
+{
+    atom s = stream_filter([](int i){ return i % 3 == 0; }, integers_from(1));
+    EXPECT_TRUE(equalv(list(3, 6, 9), stream_to_list(stream_take(3, s))));
+    EXPECT_TRUE(is_nil(stream_filter([](int i){ return i > 5; }, list_to_stream(list(1, 2)))));
+}
+TEST(stream,stream_take)
+{
+    atom s = list_to_stream(list(1, 2, 3, 4));
+    EXPECT_TRUE(equalv(list(1, 2), stream_to_list(stream_take(2, s))));
+    EXPECT_TRUE(equalv(list(1, 2, 3, 4), stream_to_list(stream_take(10, s))));
+    EXPECT_TRUE(is_nil(stream_take(0, s)));
+}
+TEST(stream,stream_take_infinite)
+{
+    int forced = 0;
+    atom s = make_stream(0, [&forced](int n) -> atom { ++forced; return integers_from(n); }, 1);
+    atom l = stream_to_list(stream_take(1000, stream_map([](int i){ return i*2; }, s)));
+    EXPECT_EQ(1000u, length(l));
+    EXPECT_EQ(1998, value<int>(tail(l)));
+
+    // taking one element does not force the rest
+    atom t = stream_take(1, make_stream(0, [&forced](int n) -> atom { ++forced; return integers_from(n); }, 1));
+    EXPECT_TRUE(equalv(list(0), stream_to_list(t)));
+    EXPECT_EQ(1, forced);
+}
+TEST(stream,stream_foldl)
+{
+    atom sum = stream_foldl([](int a, int b){ return a + b; }, atom(0), stream_take(100, integers_from(1)));
+    EXPECT_EQ(5050, value<int>(sum));
+    EXPECT_EQ(7, value<int>(stream_foldl([](int a, int b){ return a + b; }, atom(7), nil())));
+}
+TEST(stream,stream_to_list)
+{
+    EXPECT_TRUE(equalv(list(1, 2, 3), stream_to_list(stream_take(3, integers_from(1)))));
+    EXPECT_TRUE(is_nil(stream_to_list(nil())));
+}
+TEST(stream,list_to_stream)
+{
+    atom l = list(1, list(2), std::string("three"));
+    atom s = list_to_stream(l);
+    EXPECT_TRUE(equalp(car(l), stream_car(s)));
+    EXPECT_TRUE(equalv(l, stream_to_list(s)));
+    EXPECT_TRUE(is_nil(list_to_stream(nil())));
+}
+TEST(stream,constant_memory)
+{
+    // counts tracked_int values alive while a long pipeline runs, a pipeline
+    // retaining its consumed cells would keep all of them alive
+    tracked_int::live = 0;
+    size_t peak = 0;
+    size_t count = 0;
+
+    atom s = stream_take(50000, stream_map([](int i){ return tracked_int{i}; }, integers_from(0)));
+    while(!is_nil(s))
+    {
+        peak = std::max(peak, size_t(tracked_int::live.load()));
+        ++count;
+        s = stream_cdr(s);
+    }
+
+    EXPECT_EQ(50000u, count);
+    EXPECT_LT(peak, 16u);
+    EXPECT_EQ(0, tracked_int::live.load());
+}
+
+
+//-----------------------------------------------------------------------------
+// pvector tests
+TEST(pvector,make_pvector)
+{
+    atom v = make_pvector(1,2,3);
+    const pvector& pv = value<pvector>(v);
+    ASSERT_EQ(3u, pv.size());
+    EXPECT_EQ(1, value<int>(pv[0]));
+    EXPECT_EQ(3, value<int>(pv[2]));
+    EXPECT_TRUE(value<pvector>(make_pvector()).empty());
+}
+TEST(pvector,is_pvector)
+{
+    EXPECT_TRUE(is_pvector(make_pvector()));
+    EXPECT_FALSE(is_pvector(list(1,2)));
+    EXPECT_FALSE(is_pvector(nil()));
+}
+TEST(pvector,nth)
+{
+    pvector v = value<pvector>(make_pvector(1,2));
+    EXPECT_EQ(2, value<int>(v.nth(1)));
+    EXPECT_THROW(v.nth(2), std::out_of_range);
+}
+TEST(pvector,push_back)
+{
+    pvector v0;
+    pvector v1 = v0.push_back(atom(1));
+    pvector v2 = v1.push_back(atom(2));
+    EXPECT_EQ(0u, v0.size());
+    EXPECT_EQ(1u, v1.size());
+    ASSERT_EQ(2u, v2.size());
+    EXPECT_EQ(1, value<int>(v2[0]));
+    EXPECT_EQ(2, value<int>(v2[1]));
+}
+TEST(pvector,push_back_past_tail)
+{
+    // enough elements to grow the trie by several levels
+    std::vector<pvector> versions;
+    pvector v;
+    for(int i = 0; i < 5000; ++i)
+    { 
+        if(i % 1000 == 0){ versions.push_back(v); }
+        v = v.push_back(atom(i)); 
+    }
+    ASSERT_EQ(5000u, v.size());
+    for(int i = 0; i < 5000; i += 7){ EXPECT_EQ(i, value<int>(v[i])); }
+
+    // earlier versions are unchanged
+    for(size_t k = 0; k < versions.size(); ++k)
+    {
+        ASSERT_EQ(k*1000, versions[k].size());
+        if(k){ EXPECT_EQ(int(k*1000 - 1), value<int>(versions[k][k*1000 - 1])); }
+    }
+}
+TEST(pvector,assoc)
+{
+    pvector v = value<pvector>(make_pvector(1,2,3));
+    pvector w = v.assoc(1, atom(20));
+    EXPECT_EQ(2, value<int>(v[1]));
+    EXPECT_EQ(20, value<int>(w[1]));
+    EXPECT_EQ(4u, v.assoc(3, atom(4)).size()); // appends
+    EXPECT_THROW(v.assoc(4, atom(5)), std::out_of_range);
+}
+TEST(pvector,pop_back)
+{
+    pvector v;
+    for(int i = 0; i < 100; ++i){ v = v.push_back(atom(i)); }
+    pvector w = v;
+    while(w.size() > 10){ w = w.pop_back(); }
+    ASSERT_EQ(10u, w.size());
+    EXPECT_EQ(9, value<int>(w[9]));
+    EXPECT_EQ(100u, v.size());
+    EXPECT_EQ(99, value<int>(v[99]));
+    EXPECT_THROW(pvector().pop_back(), std::out_of_range);
+}
+TEST(pvector,structural_sharing)
+{
+    pvector v;
+    for(int i = 0; i < 1000; ++i){ v = v.push_back(atom(i)); }
+    pvector w = v.assoc(500, atom(-1));
+    EXPECT_EQ(500, value<int>(v[500]));
+    EXPECT_EQ(-1, value<int>(w[500]));
+    EXPECT_TRUE(equalp(v[0], w[0])); // untouched elements are shared
+    EXPECT_TRUE(equalp(v[999], w[999]));
+}
+TEST(pvector,equalv)
+{
+    EXPECT_TRUE(equalv(make_pvector(1,2,3), make_pvector(1,2,3)));
+    EXPECT_FALSE(equalv(make_pvector(1,2,3), make_pvector(1,2)));
+    EXPECT_FALSE(equalv(make_pvector(1,2,3), make_pvector(1,2,4)));
+}
+TEST(pvector,to_string)
+{
+    EXPECT_EQ("[int:1 int:2]", to_string(make_pvector(1,2)));
+}
+TEST(pvector,iterator)
+{
+    atom v = make_pvector(1,2,3,4);
+    int sum = 0;
+    for(fl::iterator it(v); it != fl::iterator(); ++it){ sum += value<int>(*it); }
+    EXPECT_EQ(10, sum);
+
+    std::vector<int> out;
+    std::transform(fl::iterator(v), fl::iterator(), std::back_inserter(out), [](atom e){ return value<int>(e); });
+    EXPECT_EQ((std::vector<int>{1,2,3,4}), out);
+
+    EXPECT_TRUE(fl::iterator(make_pvector()) == fl::iterator());
+}
+TEST(pvector,atomize_container)
+{
+    atom v = make_pvector(1,2,3);
+    const pvector& pv = value<pvector>(v);
+    EXPECT_TRUE(equalv(list(1,2,3), atomize_container(pv)));
+    EXPECT_TRUE(equalv(list(2,3), atomize_container(pv, 1)));
+    EXPECT_TRUE(equalv(list(2), atomize_container(pv, 1, 1)));
+}
+TEST(pvector,reconstitute_container)
+{
+    std::vector<int> v = reconstitute_container<std::vector<int>>(make_pvector(1,2,3));
+    EXPECT_EQ((std::vector<int>{1,2,3}), v);
+    EXPECT_TRUE(reconstitute_container<std::vector<int>>(make_pvector()).empty());
+}
+
+
+//-----------------------------------------------------------------------------
+// pmap tests
+// a key type whose values all hash alike
+struct colliding_key
+{
+    int v;
+    bool operator==(const colliding_key& rhs) const { return v == rhs.v; }
+};
+
+namespace std {
+template <>
+struct hash<colliding_key>
+{
+    size_t operator()(const colliding_key&) const { return 42; }
+};
+}
+
+TEST(pmap,make_pmap)
+{
+    atom m = make_pmap(1, 2, 3, 4);
+    const pmap& pm = value<pmap>(m);
+    EXPECT_EQ(2u, pm.size());
+    EXPECT_EQ(2, value<int>(pm.get(1)));
+    EXPECT_EQ(4, value<int>(pm.get(3)));
+    EXPECT_TRUE(value<pmap>(make_pmap()).empty());
+}
+TEST(pmap,is_pmap)
+{
+    EXPECT_TRUE(is_pmap(make_pmap()));
+    EXPECT_FALSE(is_pmap(make_pvector()));
+    EXPECT_FALSE(is_pmap(nil()));
+}
+TEST(pmap,get)
+{
+    pmap m = pmap().assoc(std::string("one"), 1);
+    EXPECT_EQ(1, value<int>(m.get(std::string("one"))));
+    EXPECT_TRUE(is_nil(m.get(std::string("two"))));
+    EXPECT_TRUE(m.contains(std::string("one")));
+}
+TEST(pmap,get_equalv_key)
+{
+    pmap m = pmap().assoc(list(1,2), atom(3));
+    EXPECT_EQ(3, value<int>(m.get(list(1,2))));
+    EXPECT_TRUE(is_nil(m.get(list(1,3))));
+}
+TEST(pmap,assoc)
+{
+    pmap m0;
+    pmap m1 = m0.assoc(1, 10);
+    pmap m2 = m1.assoc(2, 20);
+    EXPECT_EQ(0u, m0.size());
+    EXPECT_EQ(1u, m1.size());
+    EXPECT_EQ(2u, m2.size());
+    EXPECT_TRUE(is_nil(m1.get(2)));
+    EXPECT_EQ(20, value<int>(m2.get(2)));
+}
+TEST(pmap,assoc_replace)
+{
+    pmap m1 = pmap().assoc(1, 10);
+    pmap m2 = m1.assoc(1, 11);
+    EXPECT_EQ(1u, m2.size());
+    EXPECT_EQ(10, value<int>(m1.get(1)));
+    EXPECT_EQ(11, value<int>(m2.get(1)));
+}
+TEST(pmap,dissoc)
+{
+    pmap m1 = value<pmap>(make_pmap(1, 10, 2, 20));
+    pmap m2 = m1.dissoc(1);
+    EXPECT_EQ(2u, m1.size());
+    EXPECT_EQ(1u, m2.size());
+    EXPECT_TRUE(is_nil(m2.get(1)));
+    EXPECT_EQ(10, value<int>(m1.get(1)));
+    EXPECT_EQ(1u, m2.dissoc(3).size()); // missing keys are ignored
+}
+TEST(pmap,hash_collision)
+{
+    // every key hashes to the same value, so all entries share one 
+    // collision node
+    pmap m;
+    for(int i = 0; i < 40; ++i){ m = m.assoc(colliding_key{i}, i); }
+    EXPECT_EQ(40u, m.size());
+    EXPECT_EQ(hash(atom(colliding_key{1})), hash(atom(colliding_key{2})));
+    for(int i = 0; i < 40; ++i){ EXPECT_EQ(i, value<int>(m.get(colliding_key{i}))); }
+    EXPECT_TRUE(is_nil(m.get(colliding_key{40})));
+
+    pmap r = m.assoc(colliding_key{7}, 70);
+    EXPECT_EQ(40u, r.size());
+    EXPECT_EQ(70, value<int>(r.get(colliding_key{7})));
+    EXPECT_EQ(7, value<int>(m.get(colliding_key{7})));
+
+    pmap d = m;
+    for(int i = 0; i < 40; i += 2){ d = d.dissoc(colliding_key{i}); }
+    EXPECT_EQ(20u, d.size());
+    for(int i = 0; i < 40; ++i){ EXPECT_EQ(i % 2 == 0, is_nil(d.get(colliding_key{i}))); }
+    EXPECT_EQ(40u, m.size());
+}
+TEST(pmap,structural_sharing)
+{
+    pmap m;
+    for(int i = 0; i < 2000; ++i){ m = m.assoc(i, i*2); }
+    pmap n = m;
+    for(int i = 0; i < 2000; i += 2){ n = n.dissoc(i); }
+    EXPECT_EQ(2000u, m.size());
+    EXPECT_EQ(1000u, n.size());
+    for(int i = 0; i < 2000; ++i)
+    {
+        EXPECT_EQ(i*2, value<int>(m.get(i)));
+        EXPECT_EQ(i % 2 == 0, is_nil(n.get(i)));
+    }
+}
+TEST(pmap,iteration)
+{
+    pmap m = value<pmap>(make_pmap(1, 10, 2, 20, 3, 30));
+    int keys = 0;
+    int values = 0;
+    for(const pmap::entry& e : m)
+    {
+        keys += value<int>(e.key);
+        values += value<int>(e.value);
+    }
+    EXPECT_EQ(6, keys);
+    EXPECT_EQ(60, values);
+}
+TEST(pmap,equalv)
+{
+    EXPECT_TRUE(equalv(make_pmap(1, 10, 2, 20), make_pmap(2, 20, 1, 10)));
+    EXPECT_FALSE(equalv(make_pmap(1, 10, 2, 20), make_pmap(1, 10)));
+    EXPECT_FALSE(equalv(make_pmap(1, 10), make_pmap(1, 11)));
+}
+TEST(pmap,to_string)
+{
+    EXPECT_EQ("{int:1 int:2}", to_string(make_pmap(1, 2)));
+}
+TEST(pmap,frozen_keys)
+{
+    atom key = list(1,2);
+    pmap m = pmap().assoc(key, atom(3));
+    EXPECT_FALSE(is_frozen(key)); // the map holds a frozen copy
+    const pmap::entry& e = *m.begin();
+    EXPECT_TRUE(is_frozen(e.key));
+    atom k = car(key);
+    k.set(5);
+    EXPECT_EQ(3, value<int>(m.get(list(1,2))));
+}
+TEST(pmap,channel_send)
+{
+    channel ch = make_channel();
+    atom m = make_pmap(1, 10, 2, 20);
+    ch.send(m);
+    atom r;
+    ASSERT_TRUE(ch.recv(r));
+    EXPECT_TRUE(equalv(m, r));
+    // the copy shares the map's nodes
+    EXPECT_EQ(&*value<pmap>(m).begin(), &*value<pmap>(r).begin());
+}
+TEST(pmap,continuation_send)
+{
+    continuation cn = make_continuation();
+    channel done = make_channel();
+    atom m = make_pmap(1, 10, 2, 20);
+    cn.send(m);
+    cn.recv([done](atom args) mutable { done.send(car(args)); });
+    atom r;
+    ASSERT_TRUE(done.recv(r));
+    EXPECT_TRUE(equalv(m, r));
+    EXPECT_EQ(&*value<pmap>(m).begin(), &*value<pmap>(r).begin());
+}
+
+
+//-----------------------------------------------------------------------------
+// partial evaluation tests
+TEST(specialize,pure)
+{
+    atom f = pure([](int a){ return a; });
+    EXPECT_TRUE(is_pure(f));
+    EXPECT_FALSE(is_pure(atom([](int a){ return a; })));
+}
+TEST(specialize,pure_not_a_function)
+{
+    EXPECT_THROW(pure(atom(1)), std::invalid_argument);
+}
+TEST(specialize,pure_kept_by_copy)
+{
+    atom f = pure([](int a){ return a; });
+    EXPECT_TRUE(is_pure(copy(f)));
+}
+TEST(specialize,pure_dropped_by_set)
+{
+    atom f = pure([](int a){ return a; });
+    f.set([](int a){ return a + 1; });
+    EXPECT_FALSE(is_pure(f));
+}
+TEST(specialize,fold_constant_call)
+{
+    atom add = pure([](int a, int b){ return a + b; });
+    atom r = specialize(list(add, 1, 2));
+    ASSERT_TRUE(is<int>(r));
+    EXPECT_EQ(3, value<int>(r));
+}
+TEST(specialize,fold_nested_calls)
+{
+    atom add = pure([](int a, int b){ return a + b; });
+    atom mul = pure([](int a, int b){ return a * b; });
+    atom x = make_symbol("x");
+    atom y = make_symbol("y");
+
+    atom expr = list(add, list(mul, x, 3), y);
+    atom residual = specialize(expr, make_pmap(x, 2)); // (add 6 y)
+    ASSERT_EQ(3u, length(residual));
+    EXPECT_TRUE(equalp(add, car(residual)));
+    EXPECT_EQ(6, value<int>(nth(residual, 1)));
+    EXPECT_TRUE(equalv(y, nth(residual, 2)));
+
+    atom r = specialize(residual, make_pmap(y, 4));
+    EXPECT_EQ(10, value<int>(r));
+}
+TEST(specialize,impure_call_kept)
+{
+    int calls = 0;
+    atom f([&calls](int a){ ++calls; return a; });
+    atom expr = list(f, 1);
+    atom residual = specialize(expr);
+    EXPECT_EQ(0, calls);
+    ASSERT_TRUE(is_cons(residual));
+    EXPECT_TRUE(equalp(f, car(residual)));
+    EXPECT_EQ(1, value<int>(eval_tree(residual)));
+    EXPECT_EQ(1, calls);
+}
+TEST(specialize,unbound_symbol_kept)
+{
+    atom add = pure([](int a, int b){ return a + b; });
+    atom x = make_symbol("x");
+    atom residual = specialize(list(add, x, 1), make_pmap(make_symbol("y"), 2));
+    ASSERT_EQ(3u, length(residual));
+    EXPECT_TRUE(equalv(x, nth(residual, 1)));
+}
+TEST(specialize,bound_symbol_replaced)
+{
+    atom x = make_symbol("x");
+    EXPECT_EQ(2, value<int>(specialize(x, make_pmap(x, 2))));
+}
+TEST(specialize,bound_value_not_looked_up)
+{
+    atom add = pure([](int a, int b){ return a + b; });
+    atom first = pure([](const arg_span& args){ return args[0]; });
+    atom x = make_symbol("x");
+    atom y = make_symbol("y");
+
+    // a bound value is specialized as an expression
+    EXPECT_EQ(3, value<int>(specialize(x, make_pmap(x, list(add, 1, 2)))));
+
+    // but the symbols inside it are data
+    atom r = specialize(x, make_pmap(x, list(first, y), y, 2));
+    EXPECT_TRUE(equalv(y, r));
+}
+TEST(specialize,quoted_not_visited)
+{
+    atom add = pure([](int a, int b){ return a + b; });
+    atom f([](atom a){ return a; });
+    atom q = quote(list(add, 1, 2));
+    atom residual = specialize(list(f, q));
+    ASSERT_EQ(2u, length(residual));
+    EXPECT_TRUE(equalp(q, nth(residual, 1)));
+}
+TEST(specialize,call_result_not_folded)
+{
+    atom inc([](int a){ return a + 1; });
+    atom make_call = pure([inc](int a){ return list(inc, a); });
+    atom residual = specialize(list(make_call, 1));
+    ASSERT_TRUE(is_cons(residual));
+    EXPECT_TRUE(equalp(make_call, car(residual)));
+    EXPECT_EQ(1, value<int>(nth(residual, 1)));
+}
+TEST(specialize,nil_bindings)
+{
+    atom add = pure([](int a, int b){ return a + b; });
+    EXPECT_EQ(3, value<int>(specialize(list(add, 1, 2), atom())));
+    EXPECT_EQ(3, value<int>(specialize(list(add, 1, 2), pmap())));
+}
+TEST(specialize,same_result_as_eval)
+{
+    atom add = pure([](int a, int b){ return a + b; });
+    atom neg([](int a){ return -a; }); // not pure
+    atom expr = list(add, list(neg, list(add, 1, 2)), list(add, 3, 4));
+    EXPECT_EQ(value<int>(eval_tree(expr)), value<int>(eval_tree(specialize(expr))));
+    EXPECT_EQ(4, value<int>(eval_tree(specialize(expr))));
+}
+TEST(specialize,deeply_nested)
+{
+    atom inc = pure([](int a){ return a + 1; });
+    atom expr = 0;
+    for(int i = 0; i < 100000; ++i){ expr = list(inc, expr); }
+    EXPECT_EQ(100000, value<int>(specialize(expr)));
+}
 
 
 //-----------------------------------------------------------------------------
 // quote tests
-TEST(quote,quote){}
-TEST(quote,is_quoted){}
-TEST(quote,unquote){}
+TEST(quote,quote)
+{
+    atom q = quote(list(1, 2));
+    EXPECT_TRUE(is_quote(car(q)));
+}
+TEST(quote,is_quoted)
+{
+    EXPECT_TRUE(is_quote(car(quote(atom(1)))));
+    EXPECT_FALSE(is_quote(atom(1)));
+}
+TEST(quote,unquote)
+{
+    atom l = list(1, 2);
+    EXPECT_TRUE(equalp(l, unquote(quote(quote(l)))));
+    EXPECT_TRUE(equalp(l, unquote(l)));
+}
 
 
 //-----------------------------------------------------------------------------
 // to_string tests
-TEST(to_string,to_string){}
+TEST(to_string,to_string)
+{
+    EXPECT_EQ("int:1", to_string(atom(1)));
+    EXPECT_EQ("(int:1 std::string:\"two\")", to_string(list(1, std::string("two"))));
+}
+TEST(to_string,atom_name)
+{
+    EXPECT_EQ("int", atom_name(atom(1)));
+    EXPECT_EQ("double", atom_name(atom(1.5)));
+    EXPECT_EQ("std::string", atom_name(atom(std::string("s"))));
+    EXPECT_EQ("fl::function", atom_name(atom([](int a){ return a; })));
+}
+namespace {
+struct unnamed_type {};
+struct named_type {};
+}
+TEST(to_string,atom_name_unregistered)
+{
+    // a type which was never registered by name is registered by its first 
+    // atom, under its demangled name where the compiler provides one
+    atom a = unnamed_type();
+    EXPECT_EQ(detail::default_type_name<unnamed_type>::get(), atom_name(a));
+    EXPECT_NE(std::string::npos, atom_name(a).find("unnamed_type"));
+    EXPECT_FALSE(atom_value(a).empty()); // printed by address
+}
+TEST(to_string,atom_name_first_registration_kept)
+{
+    detail::register_type<named_type> r1("named_type");
+    detail::register_type<named_type> r2("renamed_type");
+    EXPECT_EQ("named_type", atom_name(atom(named_type())));
+}
+TEST(to_string,atom_type_info)
+{
+    auto ti = atom_type_info(atom(7));
+    EXPECT_EQ("int", ti.first);
+    EXPECT_EQ("7", ti.second);
+
+    ti = atom_type_info(atom(std::string("s")));
+    EXPECT_EQ("std::string", ti.first);
+    EXPECT_EQ("\"s\"", ti.second);
+}
+TEST(to_string,concurrent)
+{
+    // printing takes no lock, every thread sees the same names
+    const atom l = list(1, 2.5, std::string("s"));
+    const std::string expected = to_string(l);
+
+    std::atomic<int> wrong(0);
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&]
+        {
+            for(int i = 0; i < 1000; ++i)
+            {
+                if(to_string(l) != expected){ ++wrong; }
+            }
+        });
+    }
+    for(std::thread& t : threads){ t.join(); }
+    EXPECT_EQ(0, wrong.load());
+}
+TEST(to_string,nested_list)
+{
+    EXPECT_EQ("(int:1 (int:2 (int:3)) int:4)", to_string(list(1, list(2, list(3)), 4)));
+}
+TEST(to_string,quoted_list)
+{
+    EXPECT_EQ("'(int:1 int:2)", to_string(quote(list(1, 2))));
+    EXPECT_EQ("(int:1 '(int:2))", to_string(list(1, quote(list(2)))));
+}
+TEST(to_string,dotted_pair)
+{
+    EXPECT_EQ("(int:1 . int:2)", to_string(cons(1, 2)));
+}
+TEST(to_string,numbers_to_chars)
+{
+    EXPECT_EQ("int:-42", to_string(atom(-42)));
+    EXPECT_EQ("unsigned long:18446744073709551615", to_string(atom(18446744073709551615ul)));
+    EXPECT_EQ("char:97", to_string(atom('a'))); // chars are numbers
+    EXPECT_EQ("bool:1", to_string(atom(true)));
+    EXPECT_EQ("double:2.5", to_string(atom(2.5))); // the shortest exact form
+    EXPECT_EQ("double:0.1", to_string(atom(0.1)));
+}
+TEST(to_string,string_quoted)
+{
+    EXPECT_EQ("std::string:\"a b\"", to_string(atom(std::string("a b"))));
+    EXPECT_EQ("std::string:\"\"", to_string(atom(std::string())));
+    EXPECT_EQ("(std::string:\"x\")", to_string(list(std::string("x"))));
+}
+TEST(to_string,pvector)
+{
+    EXPECT_EQ("[int:1 [int:2]]", to_string(make_pvector(1, make_pvector(2))));
+}
+TEST(to_string,pmap)
+{
+    EXPECT_EQ("{int:1 [int:2]}", to_string(make_pmap(1, make_pvector(2))));
+}
+TEST(to_string,write_ostream)
+{
+    std::ostringstream os;
+    write(os, list(1, 2)) << "!";
+    EXPECT_EQ("(int:1 int:2)!", os.str());
+}
+TEST(to_string,write_same_as_to_string)
+{
+    atom a = list(1, list(2.5, std::string("x")), make_pvector(3), cons(4, 5));
+    std::ostringstream os;
+    write(os, a);
+    EXPECT_EQ(to_string(a), os.str());
+}
+TEST(to_string,write_depth_limit)
+{
+    atom lst = list(1, list(2, list(3)), 4, 5);
+    std::ostringstream os;
+    write(os, lst, write_limits(1));
+    EXPECT_EQ("(int:1 ... int:4 int:5)", os.str());
+
+    std::ostringstream os2;
+    write(os2, lst, write_limits(2));
+    EXPECT_EQ("(int:1 (int:2 ...) int:4 int:5)", os2.str());
+}
+TEST(to_string,write_length_limit)
+{
+    atom lst = list(1, list(2, list(3)), 4, 5);
+    std::ostringstream os;
+    write(os, lst, write_limits(1, 3));
+    EXPECT_EQ("(int:1 ... int:4 ...)", os.str());
+
+    std::ostringstream os2;
+    write(os2, make_pvector(1, 2, 3), write_limits(0, 2));
+    EXPECT_EQ("[int:1 int:2 ...]", os2.str());
+}
+TEST(to_string,write_long_list)
+{
+    std::vector<int> v(1000000, 7);
+    std::ostringstream os;
+    write(os, atomize_container(v), write_limits(0, 2));
+    EXPECT_EQ("(int:7 int:7 ...)", os.str());
+    EXPECT_EQ(v.size() * 6 + 1, to_string(atomize_container(v)).size());
+}
+TEST(to_string,write_deep_tree)
+{
+    atom a = 1;
+    for(int i = 0; i < 100000; ++i){ a = list(a); }
+    std::string s = to_string(a);
+    EXPECT_EQ(100000u * 2 + 5, s.size());
+    EXPECT_EQ("((((int:1))))", to_string(list(list(list(list(1))))));
+}
+TEST(to_string,format_to)
+{
+    char buf[64];
+    size_t n = format_to(buf, sizeof(buf), list(1, 2));
+    EXPECT_EQ(std::string("(int:1 int:2)"), std::string(buf));
+    EXPECT_EQ(13u, n);
+
+    n = format_to(buf, sizeof(buf), list(1, 2, 3), write_limits(0, 1));
+    EXPECT_EQ(std::string("(int:1 ...)"), std::string(buf, n));
+}
+TEST(to_string,format_to_truncated)
+{
+    char buf[10];
+    size_t n = format_to(buf, sizeof(buf), list(1, 2, 3));
+    EXPECT_EQ(9u, n);
+    EXPECT_EQ(std::string("(int:1..."), std::string(buf));
+}
+TEST(to_string,format_to_size_one)
+{
+    char buf[1] = { 'x' };
+    EXPECT_EQ(0u, format_to(buf, 1, list(1)));
+    EXPECT_EQ('\0', buf[0]);
+}
+TEST(to_string,format_to_size_zero)
+{
+    char buf[1] = { 'x' };
+    EXPECT_EQ(0u, format_to(buf, 0, list(1)));
+    EXPECT_EQ('x', buf[0]);
+}
 
 
 //-----------------------------------------------------------------------------
 // evaluation tests
-TEST(evaluation,curry_std_function){}
-TEST(evaluation,curry_function_pointer){}
-TEST(evaluation,atomize_function_default_lvalue){}
-TEST(evaluation,atomize_function_default_rvalue){}
-TEST(evaluation,atomize_function_F){}
-TEST(evaluation,eval){}
+TEST(evaluation,curry_std_function)
+{
+    std::function<int(int,int)> add = [](int a, int b){ return a + b; };
+    function f = curry(add);
+    atom g = f(arg_span(list(1))); // binds the first argument
+    EXPECT_TRUE(is<function>(g));
+    EXPECT_EQ(3, value<int>(eval(g, 2)));
+    EXPECT_EQ(5, value<int>(eval(f, 2, 3)));
+}
+TEST(evaluation,curry_function_pointer)
+{
+    int (*sub)(int,int) = [](int a, int b){ return a - b; };
+    atom g = eval(curry(sub), 5);
+    EXPECT_EQ(3, value<int>(eval(g, 2)));
+    EXPECT_EQ(1, value<int>(eval(curry([](int a, int b, int c){ return a - b - c; }), 6, 2, 3)));
+    atom h = eval(eval(curry([](int a, int b, int c){ return a - b - c; }), 6), 2);
+    EXPECT_EQ(1, value<int>(eval(h, 3)));
+}
+TEST(evaluation,atomize_function_default_lvalue)
+{
+    function f = [](atom args){ return length(args); };
+    function g = to_fl_function(f);
+    EXPECT_EQ(2u, value<size_t>(g(list(1, 2))));
+}
+TEST(evaluation,atomize_function_default_rvalue)
+{
+    function g = to_fl_function(function([](atom args){ return length(args); }));
+    EXPECT_EQ(2u, value<size_t>(g(list(1, 2))));
+}
+TEST(evaluation,atomize_function_F)
+{
+    function f = to_fl_function([](int a, std::string b){ return b + std::to_string(a); });
+    EXPECT_EQ("x1", value<std::string>(f(list(1, std::string("x")))));
+
+    int n = 0;
+    function g = to_fl_function([&n](int a){ n = a; });
+    EXPECT_TRUE(is_nil(g(list(4))));
+    EXPECT_EQ(4, n);
+}
+TEST(evaluation,to_fl_function_typed_parameters)
+{
+    function f = to_fl_function([](int a, std::string b){ return b + std::to_string(a); });
+    EXPECT_EQ("x1", value<std::string>(eval(f, 1, std::string("x"))));
+}
+TEST(evaluation,to_fl_function_reference_parameter)
+{
+    // mutable references modify the argument's value in place
+    function inc = to_fl_function([](int& a){ ++a; });
+    atom x(1);
+    inc(list(x));
+    EXPECT_EQ(2, value<int>(x));
+
+    // const references read the value without detaching copy-on-write copies
+    atom y = cow_copy(x);
+    function get = to_fl_function([](const int& a){ return a; });
+    EXPECT_EQ(2, value<int>(get(list(y))));
+    EXPECT_TRUE(equalp(x, y));
+
+    // a write through a copy-on-write argument detaches the argument first, 
+    // neither copy sees it
+    inc(list(y));
+    EXPECT_EQ(2, value<int>(x));
+    EXPECT_EQ(2, value<int>(y));
+
+    // a copy-on-write argument owned by the list alone is written in place
+    atom l = cow_copy_tree(list(1));
+    inc(l);
+    EXPECT_EQ(2, value<int>(car(l)));
+}
+TEST(evaluation,to_fl_function_void_return)
+{
+    int n = 0;
+    function f = to_fl_function([&n](int a){ n = a; });
+    EXPECT_TRUE(is_nil(eval(f, 4)));
+    EXPECT_EQ(4, n);
+}
+TEST(evaluation,to_fl_function_too_few_arguments)
+{
+    function f = to_fl_function([](int a, int b){ return a + b; });
+    EXPECT_THROW(f(list(1)), std::invalid_argument);
+    EXPECT_THROW(f(nil()), std::invalid_argument);
+    EXPECT_EQ(3, value<int>(f(list(1, 2, 3)))); // extra arguments are ignored
+}
+TEST(evaluation,to_fl_function_fl_function)
+{
+    // an fl::function, and any callable taking a single atom, receives the 
+    // whole argument list
+    function f = [](atom args){ return atom(length(args)); };
+    function g = to_fl_function(f);
+    EXPECT_EQ(3u, value<size_t>(g(list(1, 2, 3))));
+
+    function h = to_fl_function([](atom args){ return length(args); });
+    EXPECT_EQ(2u, value<size_t>(h(list(1, 2))));
+    EXPECT_EQ(2u, value<size_t>(eval(h, 1, 2)));
+
+    int n = 0;
+    function v = to_fl_function([&n](const atom& args){ n = int(length(args)); });
+    EXPECT_TRUE(is_nil(v(list(1, 2, 3, 4))));
+    EXPECT_EQ(4, n);
+}
+TEST(evaluation,eval)
+{
+    atom add([](int a, int b){ return a + b; });
+    EXPECT_TRUE(is<function>(add));
+    EXPECT_EQ(3, value<int>(eval(list(add, 1, 2))));
+    EXPECT_EQ(3, value<int>(eval(add, 1, 2)));
+
+    // data evaluates to itself
+    atom a = list(1, 2);
+    EXPECT_TRUE(equalp(a, eval(a)));
+}
+TEST(evaluation,eval_arguments_array)
+{
+    // eval(f, ts...) passes its arguments in an array, not a list
+    bool is_array = false;
+    size_t count = 0;
+    function f([&](const arg_span& args)
+    { 
+        is_array = args.data() != nullptr;
+        count = args.size();
+        return args[1];
+    });
+    EXPECT_EQ(2, value<int>(eval(f, 1, 2, 3)));
+    EXPECT_TRUE(is_array);
+    EXPECT_EQ(3u, count);
+
+    // eval() of a list passes the rest of the list
+    atom fa(std::move(f));
+    EXPECT_EQ(5, value<int>(eval(list(fa, 4, 5))));
+    EXPECT_FALSE(is_array);
+    EXPECT_EQ(2u, count);
+
+    // typed callables read the array in place
+    EXPECT_EQ(7, value<int>(eval(fa.value<function>(), 6, 7)));
+    EXPECT_EQ(9, value<int>(eval([](int a, int b){ return a + b; }, 4, 5)));
+}
+TEST(evaluation,eval_callable)
+{
+    // plain callables are invoked without being stored in an atom
+    int calls = 0;
+    auto f = [&calls](int a, const std::string& b){ ++calls; return b + std::to_string(a); };
+    EXPECT_EQ("x1", value<std::string>(eval(f, 1, std::string("x"))));
+    EXPECT_EQ(1, calls);
+
+    int (*neg)(int) = [](int a){ return -a; };
+    EXPECT_EQ(-3, value<int>(eval(neg, 3)));
+
+    // an atom which is not a function evaluates to itself and its arguments
+    EXPECT_TRUE(equalv(list(1, 2, 3), eval(atom(1), 2, 3)));
+    EXPECT_THROW(eval([](int a, int b){ return a + b; }, 1), std::invalid_argument);
+}
+TEST(evaluation,eval_not_a_function)
+{
+    // data evaluates to itself
+    atom a = list(1, 2);
+    EXPECT_TRUE(equalp(a, eval(a)));
+    EXPECT_EQ(1, value<int>(eval(atom(1))));
+}
+TEST(evaluation,arg_span_list)
+{
+    atom l = list(1, 2, 3);
+    arg_span s(l);
+    EXPECT_EQ(nullptr, s.data());
+    EXPECT_EQ(3u, s.size());
+    EXPECT_EQ(1, value<int>(s[0]));
+    EXPECT_EQ(3, value<int>(s[2]));
+    EXPECT_TRUE(equalp(l, s.to_list())); // the list itself
+
+    arg_span e(nil());
+    EXPECT_EQ(0u, e.size());
+    EXPECT_TRUE(is_nil(e.to_list()));
+}
+TEST(evaluation,arg_span_to_list)
+{
+    atom argv[] = { atom(1), atom(std::string("two")), atom(3) };
+    arg_span s(argv, 3);
+    EXPECT_EQ(argv, s.data());
+    EXPECT_EQ(3u, s.size());
+    EXPECT_TRUE(equalp(argv[1], s[1]));
+
+    atom l = s.to_list();
+    EXPECT_TRUE(equalv(list(1, std::string("two"), 3), l));
+    EXPECT_TRUE(equalp(argv[1], nth(l, 1))); // the elements are shared
+    EXPECT_TRUE(equalv(l, atom(s))); // converting to an atom does the same
+    EXPECT_TRUE(is_nil(arg_span(argv, 0).to_list()));
+}
+TEST(evaluation,fl_function_taking_atom)
+{
+    // a callable taking a single atom receives the whole argument list, the 
+    // same as an fl::function
+    function f = to_fl_function([](atom args){ return length(args); });
+    function g([](arg_span args){ return atom(length(args)); });
+    EXPECT_EQ(3u, value<size_t>(eval(f, 1, 2, 3)));
+    EXPECT_EQ(3u, value<size_t>(eval(g, 1, 2, 3)));
+    EXPECT_EQ(2u, value<size_t>(eval([](const atom& args){ return length(args); }, 1, 2)));
+}
+TEST(evaluation,unique_function_inline)
+{
+    int x = 3;
+    unique_function<int(int)> f([x](int a){ return a + x; });
+    EXPECT_TRUE(static_cast<bool>(f));
+    EXPECT_EQ(5, f(2));
+
+    unique_function<int(int)> g(std::move(f));
+    EXPECT_FALSE(static_cast<bool>(f));
+    EXPECT_EQ(6, g(3));
+    EXPECT_THROW(f(1), std::bad_function_call);
+}
+TEST(evaluation,unique_function_boxed)
+{
+    // a callable larger than the inline buffer is stored on the heap
+    std::array<int,64> big{};
+    big[63] = 7;
+    unique_function<int(int),sizeof(void*)> f([big](int a){ return a + big[63]; });
+    EXPECT_EQ(8, f(1));
+
+    unique_function<int(int),sizeof(void*)> g;
+    g = std::move(f);
+    EXPECT_FALSE(static_cast<bool>(f));
+    EXPECT_EQ(9, g(2));
+}
+TEST(evaluation,unique_function_move_only_callable)
+{
+    auto p = std::make_unique<int>(4);
+    unique_function<int()> f([p = std::move(p)]{ return *p; });
+    EXPECT_EQ(4, f());
+
+    unique_function<int()> g = std::move(f);
+    EXPECT_EQ(4, g());
+}
+TEST(evaluation,unique_function_clone)
+{
+    auto count = std::make_shared<int>(0);
+    unique_function<int()> f([count]{ return ++*count; });
+    unique_function<int()> g = f.clone();
+    EXPECT_EQ(1, f());
+    EXPECT_EQ(2, g()); // the clone copies the captured shared_ptr
+    EXPECT_EQ(3, count.use_count());
+    EXPECT_FALSE(static_cast<bool>(unique_function<int()>().clone()));
+}
+TEST(evaluation,unique_function_clone_move_only_throws)
+{
+    auto p = std::make_unique<int>(4);
+    unique_function<int()> f([p = std::move(p)]{ return *p; });
+    EXPECT_THROW(f.clone(), std::logic_error);
+    EXPECT_EQ(4, f()); // f is left intact
+}
+TEST(evaluation,atom_stores_callable_as_function)
+{
+    atom a([](int x, int y){ return x + y; });
+    EXPECT_TRUE(a.is<function>());
+    EXPECT_EQ(5, value<int>(eval(a, 2, 3)));
+
+    atom b(+[](int x){ return x * 2; }); // function pointer
+    EXPECT_TRUE(b.is<function>());
+    EXPECT_EQ(8, value<int>(eval(b, 4)));
+}
+TEST(evaluation,copy_function_atom)
+{
+    atom a([](int x){ return x + 1; });
+    atom b = copy(a);
+    EXPECT_FALSE(equalp(a, b));
+    EXPECT_EQ(2, value<int>(eval(b, 1)));
+    EXPECT_EQ(2, value<int>(eval(car(copy_tree(list(a))), 1)));
+
+    // a move only callable cannot be cloned, so neither can its atom
+    auto p = std::make_unique<int>(4);
+    atom m([p = std::move(p)](int x){ return x + *p; });
+    EXPECT_EQ(5, value<int>(eval(m, 1)));
+    EXPECT_THROW(copy(m), std::logic_error);
+    EXPECT_THROW(copy_tree(list(m)), std::logic_error);
+}
+TEST(evaluation,eval_nested)
+{
+    atom add([](int a, int b){ return a + b; });
+    atom mul([](int a, int b){ return a * b; });
+    EXPECT_EQ(10, value<int>(eval_tree(list(add, list(mul, 2, 3), 4))));
+}
+TEST(evaluation,eval_quoted_argument)
+{
+    atom add([](int a, int b){ return a + b; });
+    atom first([](const arg_span& args){ return args[0]; });
+    atom call = list(add, 1, 2);
+
+    // a quote()d call is data, eval_tree() passes it as it is
+    atom r = eval_tree(list(first, quote(call)));
+    EXPECT_TRUE(is_quote(car(r)));
+    EXPECT_TRUE(equalp(call, cdr(r)));
+
+    // eval() passes every argument as it is, calls included
+    EXPECT_TRUE(equalp(call, eval(list(first, call))));
+    EXPECT_EQ(3, value<int>(eval_tree(list(first, call))));
+}
+TEST(evaluation,compile)
+{
+    atom add([](int a, int b){ return a + b; });
+    atom mul([](int a, int b){ return a * b; });
+    atom four(4);
+    atom expr = list(add, list(mul, 2, 3), four);
+    program p = compile(expr);
+    EXPECT_EQ(3u, p.size());
+
+    // the program owns its functions and constants
+    four.set(5);
+    expr = atom();
+    EXPECT_EQ(10, value<int>(run(p)));
+
+    // writes through reference parameters do not change the program
+    atom inc([](int& a){ return ++a; });
+    program q = compile(list(add, list(inc, 1), 1));
+    EXPECT_EQ(3, value<int>(run(q)));
+    EXPECT_EQ(3, value<int>(run(q)));
+
+    // frozen constants are shared, so they cannot be written
+    EXPECT_THROW(run(compile(list(inc, freeze(atom(1))))), frozen_error);
+
+    // a move only function cannot be copied into the program
+    auto u = std::make_unique<int>(1);
+    atom m([u = std::move(u)](int a){ return a + *u; });
+    EXPECT_THROW(compile(list(m, 1)), std::logic_error);
+}
+TEST(evaluation,run_same_as_eval)
+{
+    atom add([](int a, int b){ return a + b; });
+    atom mul([](int a, int b){ return a * b; });
+    atom expr = list(add, list(mul, 2, 3), list(add, 4, 5));
+    program p = compile(expr);
+    EXPECT_EQ(value<int>(eval_tree(expr)), value<int>(run(p)));
+    EXPECT_EQ(15, value<int>(run(p)));
+}
+TEST(evaluation,run_constant)
+{
+    EXPECT_EQ(1, value<int>(run(compile(atom(1)))));
+    EXPECT_TRUE(is_nil(run(compile(nil()))));
+}
+TEST(evaluation,compile_in_arena)
+{
+    atom cat([](const std::string& a, const std::string& b){ return a + b; });
+    const std::string big(100, 'a');
+    program p;
+    program c;
+    {
+        arena ar;
+        p = compile(list(cat, big, std::string("b")));
+        c = compile(atom(big));
+    }
+    EXPECT_EQ(big + "b", value<std::string>(run(p)));
+
+    // the constants were copied out of the arena and share()d
+    atom k = run(c);
+    EXPECT_EQ(big, value<std::string>(k));
+    EXPECT_FALSE(is_arena_allocated(k));
+    EXPECT_FALSE(is_local(k));
+
+    program l;
+    {
+        local_scope ls;
+        l = compile(atom(big));
+    }
+    EXPECT_FALSE(is_local(run(l)));
+}
+TEST(evaluation,run_deeply_nested)
+{
+    atom inc([](int a){ return a + 1; });
+    atom expr = 0;
+    for(int i = 0; i < 100000; ++i){ expr = list(inc, expr); }
+    EXPECT_EQ(100000, value<int>(run(compile(expr))));
+}
+TEST(evaluation,run_concurrent)
+{
+    atom add([](int a, int b){ return a + b; });
+    atom inc([](int& a){ return ++a; });
+    atom expr = list(add, list(inc, 1), list(add, list(inc, 2), 3));
+    const program p = compile(expr);
+
+    std::atomic<int> wrong(0);
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&]
+        {
+            for(int i = 0; i < 1000; ++i)
+            {
+                if(value<int>(run(p)) != 8){ ++wrong; }
+            }
+        });
+    }
+    for(std::thread& t : threads){ t.join(); }
+    EXPECT_EQ(0, wrong.load());
+    EXPECT_EQ(8, value<int>(eval_tree(expr)));
+}
+TEST(evaluation,tail_call)
+{
+    atom twice([](int a){ return a * 2; });
+    atom f([twice](int a){ return tail_call(twice, a + 1); });
+    EXPECT_EQ(6, value<int>(eval(f, 2)));
+    EXPECT_EQ(6, value<int>(eval(list(f, 2))));
+
+    // a worker makes the tail call its function returns
+    channel done = make_channel();
+    atom report([done](int i) mutable { done.send(i); });
+    worker w([report](int i){ return tail_call(report, i * 2); });
+    w.schedule(2);
+    int r = 0;
+    ASSERT_TRUE(done.recv(r));
+    EXPECT_EQ(4, r);
+    w.halt();
+
+    // so does a workerpool for the functions scheduled on it
+    workerpool wp;
+    wp.start(1);
+    wp.schedule(atom(function([report](const arg_span&){ return tail_call(report, 5); })));
+    ASSERT_TRUE(done.recv(r));
+    EXPECT_EQ(5, r);
+}
+TEST(evaluation,tail_call_constant_stack)
+{
+    atom count;
+    count = [&count](int n) -> atom
+    {
+        if(n == 0){ return atom(0); }
+        return tail_call(count, n - 1);
+    };
+    EXPECT_EQ(0, value<int>(eval(count, 1000000)));
+}
+TEST(evaluation,tail_call_mutual_recursion)
+{
+    atom is_even;
+    atom is_odd;
+    is_even = [&is_odd](int n) -> atom
+    { 
+        if(n == 0){ return atom(true); }
+        return tail_call(is_odd, n - 1); 
+    };
+    is_odd = [&is_even](int n) -> atom
+    { 
+        if(n == 0){ return atom(false); }
+        return tail_call(is_even, n - 1); 
+    };
+    EXPECT_TRUE(value<bool>(eval(is_even, 100000)));
+    EXPECT_FALSE(value<bool>(eval(is_odd, 100000)));
+}
+TEST(evaluation,tail_call_not_a_function)
+{
+    EXPECT_THROW(tail_call(atom(1), 2), std::invalid_argument);
+    EXPECT_THROW(tail_call(atom()), std::invalid_argument);
+}
+TEST(evaluation,resolve_direct_call)
+{
+    atom inc([](int a){ return a + 1; });
+    atom f([inc](int a){ return tail_call(inc, a); });
+
+    // calling the function directly returns the tail call unresolved
+    atom r = value<function>(f)(list(1));
+    EXPECT_TRUE(is_tail_call(r));
+    EXPECT_EQ(2, value<int>(resolve(r)));
+
+    // anything else is returned as it is
+    atom a(3);
+    EXPECT_TRUE(equalp(a, resolve(a)));
+    EXPECT_TRUE(is_nil(resolve(nil())));
+}
+TEST(evaluation,run_tail_call)
+{
+    atom add([](int a, int b){ return a + b; });
+    atom count;
+    count = [&count](int n) -> atom
+    {
+        if(n == 0){ return atom(0); }
+        return tail_call(count, n - 1);
+    };
+    program p = compile(list(add, list(count, 100000), 1));
+    EXPECT_EQ(1, value<int>(run(p)));
+    EXPECT_EQ(1, value<int>(eval_tree(list(add, list(count, 100000), 1))));
+}
+
+
+//-----------------------------------------------------------------------------
+// memoization tests
+TEST(memoization,memoize_function)
+{
+    int calls = 0;
+    memoized f = memoize([&calls](int a){ ++calls; return a * 2; });
+    EXPECT_EQ(4, value<int>(eval(f, 2)));
+    EXPECT_EQ(4, value<int>(eval(f, 2)));
+    EXPECT_EQ(1, calls);
+}
+TEST(memoization,memoize_callable)
+{
+    struct square
+    {
+        int* calls;
+        int operator()(int a) const { ++*calls; return a * a; }
+    };
+
+    int calls = 0;
+    memoized f = memoize(square{ &calls });
+    EXPECT_EQ(9, value<int>(eval(f, 3)));
+    EXPECT_EQ(9, value<int>(eval(f, 3)));
+    EXPECT_EQ(1, calls);
+
+    std::function<int(int)> neg = [](int a){ return -a; };
+    memoized g = memoize(neg);
+    EXPECT_EQ(-2, value<int>(eval(g, 2)));
+    EXPECT_EQ(-2, value<int>(eval(g, 2)));
+    EXPECT_EQ(1u, g.hits());
+}
+TEST(memoization,memoize_atom)
+{
+    int calls = 0;
+    atom f([&calls](int a){ ++calls; return a * 2; });
+    memoized m = memoize(f);
+    EXPECT_EQ(6, value<int>(eval(m, 3)));
+    EXPECT_EQ(6, value<int>(eval(m, 3)));
+    EXPECT_EQ(1, calls);
+}
+TEST(memoization,hit_structurally_equal_arguments)
+{
+    int calls = 0;
+    memoized f = memoize([&calls](atom args){ ++calls; return length(car(args)); });
+    EXPECT_EQ(3u, value<size_t>(eval(f, list(1,2,3))));
+    EXPECT_EQ(3u, value<size_t>(eval(f, list(1,2,3)))); // a different but equal list
+    EXPECT_EQ(1, calls);
+    EXPECT_EQ(1u, f.hits());
+}
+TEST(memoization,hit_list_and_array_arguments)
+{
+    memoized f = memoize([](int a, int b){ return a + b; });
+    eval(f, 1, 2);
+    EXPECT_EQ(3, value<int>(eval(list(atom(f), 1, 2))));
+    EXPECT_EQ(1u, f.hits());
+    EXPECT_EQ(1u, f.misses());
+}
+TEST(memoization,hits_and_misses)
+{
+    memoized f = memoize([](int a){ return a; });
+    for(int i = 0; i < 10; ++i){ eval(f, i % 3); }
+    EXPECT_EQ(3u, f.misses());
+    EXPECT_EQ(7u, f.hits());
+    EXPECT_EQ(3u, f.size());
+}
+TEST(memoization,lru_eviction)
+{
+    memoized f = memoize([](int a){ return a; }, memo_policy(1, eviction::lru));
+    eval(f, 1);
+    eval(f, 2); // evicts 1
+    eval(f, 1);
+    EXPECT_EQ(3u, f.misses());
+    EXPECT_EQ(0u, f.hits());
+    eval(f, 1);
+    EXPECT_EQ(1u, f.hits());
+    EXPECT_EQ(1u, f.size());
+}
+TEST(memoization,clock_eviction)
+{
+    memoized f = memoize([](int a){ return a; }, memo_policy(1, eviction::clock));
+    eval(f, 1);
+    eval(f, 2);
+    eval(f, 2);
+    EXPECT_EQ(2u, f.misses());
+    EXPECT_EQ(1u, f.hits());
+    EXPECT_EQ(1u, f.size());
+}
+TEST(memoization,capacity_bound)
+{
+    memoized f = memoize([](int a){ return a; }, memo_policy(8));
+    for(int i = 0; i < 1000; ++i){ eval(f, i); }
+    EXPECT_LE(f.size(), 8u);
+    EXPECT_EQ(1000u, f.misses());
+}
+TEST(memoization,zero_capacity)
+{
+    int calls = 0;
+    memoized f = memoize([&calls](int a){ ++calls; return a; }, memo_policy(0));
+    eval(f, 1);
+    eval(f, 1);
+    EXPECT_EQ(2, calls);
+    EXPECT_EQ(0u, f.size());
+}
+TEST(memoization,clear)
+{
+    memoized f = memoize([](int a){ return a; });
+    eval(f, 1);
+    f.clear();
+    EXPECT_EQ(0u, f.size());
+    eval(f, 1);
+    EXPECT_EQ(2u, f.misses());
+}
+TEST(memoization,results_frozen)
+{
+    memoized f = memoize([](int a){ return list(a, a); });
+    atom r = eval(f, 1);
+    EXPECT_FALSE(is_frozen(r)); // the computing caller's result is untouched
+    atom r2 = eval(f, 1);
+    EXPECT_TRUE(is_frozen(r2));
+    EXPECT_TRUE(equalv(r, r2));
+    EXPECT_FALSE(equalp(r, r2));
+}
+TEST(memoization,arguments_not_frozen)
+{
+    memoized f = memoize([](atom args){ return length(args); });
+    atom a = list(1,2);
+    eval(f, a);
+    EXPECT_FALSE(is_frozen(a));
+    atom e = car(a);
+    e.set(3);
+    EXPECT_EQ(1u, f.size());
+}
+TEST(memoization,arena_arguments_escaped)
+{
+    memoized f = memoize([](atom args){ return car(args); });
+    {
+        arena ar;
+        atom l = list(1, 2, 3);
+        atom r = eval(f, l);
+        EXPECT_TRUE(is_arena_allocated(r)); // the caller's result is unchanged
+        r = atom();
+        l = atom();
+        EXPECT_EQ(0u, ar.live()); // the cache holds copies outside the arena
+    }
+
+    atom r = eval(f, list(1, 2, 3));
+    EXPECT_EQ(1u, f.hits());
+    EXPECT_FALSE(is_arena_allocated(r));
+    EXPECT_TRUE(equalv(list(1, 2, 3), r));
+}
+TEST(memoization,recursive)
+{
+    memoized fib = memoize([&fib](int n) -> int
+    {
+        if(n < 2){ return n; }
+        return value<int>(eval(fib, n - 1)) + value<int>(eval(fib, n - 2));
+    });
+    EXPECT_EQ(832040, value<int>(eval(fib, 30)));
+    EXPECT_EQ(31u, fib.misses());
+}
+TEST(memoization,tail_call_resolved)
+{
+    int calls = 0;
+    atom inc([&calls](int a){ ++calls; return a + 1; });
+    memoized f = memoize([inc](int a){ return tail_call(inc, a); });
+
+    // the resolved result is cached, not the tail call
+    EXPECT_EQ(2, value<int>(eval(f, 1)));
+    atom r = eval(f, 1);
+    EXPECT_FALSE(is_tail_call(r));
+    EXPECT_EQ(2, value<int>(r));
+    EXPECT_EQ(1, calls);
+}
+TEST(memoization,workerpool_concurrent)
+{
+    std::atomic<int> calls(0);
+    memoized f = memoize([&calls](int a){ ++calls; return a * 2; });
+
+    workerpool wp;
+    wp.start(4);
+    channel done = make_channel();
+    for(int i = 0; i < 100; ++i)
+    {
+        wp.schedule([f, done](int a) mutable { done.send(value<int>(eval(f, a % 10))); }, i);
+    }
+
+    int sum = 0;
+    for(int i = 0; i < 100; ++i)
+    {
+        int r = 0;
+        ASSERT_TRUE(done.recv(r));
+        sum += r;
+    }
+    EXPECT_EQ(900, sum);
+    EXPECT_EQ(100u, f.hits() + f.misses());
+    EXPECT_EQ(10u, f.size());
+    EXPECT_GE(calls.load(), 10);
+}
+TEST(memoization,store_in_atom)
+{
+    int calls = 0;
+    atom f(memoize([&calls](int a){ ++calls; return a; }));
+    eval(f, 1);
+    eval(f, 1);
+    EXPECT_EQ(1, calls);
+}
 
 
 //-----------------------------------------------------------------------------
 // iteration tests
-TEST(iteration,map){}
-TEST(iteration,mapl){}
-TEST(iteration,foldl){}
-TEST(iteration,foldll){}
-TEST(iteration,foldr){}
-TEST(iteration,foldrl){}
-TEST(iteration,){}
+TEST(iteration,map)
+{
+    atom r = map([](int a){ return a * 2; }, list(1,2,3));
+    EXPECT_TRUE(equalv(r, list(2,4,6)));
+    EXPECT_TRUE(equalv(map([](int a, int b){ return a + b; }, list(1,2), list(3,4)), list(4,6)));
+}
+TEST(iteration,mapl)
+{
+    EXPECT_TRUE(equalv(mapl([](int a){ return a; }, 2, list(1,2,3)), list(1,2)));
+}
+TEST(iteration,foldl)
+{
+    // f receives the accumulated value and a list of the current elements
+    atom r = foldl([](int acc, atom e){ return acc*10 + value<int>(car(e)); }, 0, list(1,2,3));
+    EXPECT_EQ(123, value<int>(r));
+    r = foldl([](int acc, atom e){ return acc + value<int>(car(e))*value<int>(nth(e,1)); }, 
+              0, list(1,2), list(3,4));
+    EXPECT_EQ(11, value<int>(r));
+
+    // foldlv() passes the current elements as separate arguments
+    r = foldlv([](int acc, int a, int b){ return acc + a*b; }, 0, list(1,2), list(3,4));
+    EXPECT_EQ(11, value<int>(r));
+}
+TEST(iteration,foldll)
+{
+    atom r = foldll([](int acc, atom e){ return acc + value<int>(car(e)); }, 2, 0, list(1,2,3));
+    EXPECT_EQ(3, value<int>(r));
+    EXPECT_EQ(3, value<int>(foldllv([](int acc, int a){ return acc + a; }, 2, 0, list(1,2,3))));
+}
+TEST(iteration,foldr)
+{
+    atom r = foldr([](int acc, atom e){ return acc*10 + value<int>(car(e)); }, 0, list(1,2,3));
+    EXPECT_EQ(321, value<int>(r));
+    EXPECT_EQ(321, value<int>(foldrv([](int acc, int a){ return acc*10 + a; }, 0, list(1,2,3))));
+}
+TEST(iteration,foldrl)
+{
+    atom r = foldrl([](int acc, atom e){ return acc*10 + value<int>(car(e)); }, 2, 0, list(1,2,3));
+    EXPECT_EQ(32, value<int>(r));
+    EXPECT_EQ(32, value<int>(foldrlv([](int acc, int a){ return acc*10 + a; }, 2, 0, list(1,2,3))));
+}
 
 
 //-----------------------------------------------------------------------------
 // std:: container conversion tests
-TEST(std_conversion,atomize_container){}
-TEST(std_conversion,reconstitute_container){}
+TEST(std_conversion,atomize_container)
+{
+    std::vector<int> v{1, 2, 3};
+    atom l = atomize_container(v);
+    EXPECT_EQ(3u, length(l));
+    EXPECT_TRUE(equalv(list(1, 2, 3), l));
+    EXPECT_TRUE(is_nil(atomize_container(std::vector<int>())));
+}
+TEST(std_conversion,atomize_container_order)
+{
+    std::list<std::string> c{"a", "b", "c"};
+    atom l = atomize_container(c);
+    EXPECT_EQ("a", value<std::string>(nth(l, 0)));
+    EXPECT_EQ("c", value<std::string>(nth(l, 2)));
+    EXPECT_EQ(3u, c.size()); // lvalue elements are copied
+    EXPECT_EQ(c, reconstitute_container<std::list<std::string>>(l));
+
+    std::forward_list<int> f{4, 5, 6};
+    EXPECT_TRUE(equalv(list(4, 5, 6), atomize_container(f)));
+}
+TEST(std_conversion,atomize_container_range)
+{
+    std::vector<int> v{1, 2, 3, 4, 5};
+    EXPECT_TRUE(equalv(list(2), atomize_container(v, 1, 1)));
+    EXPECT_TRUE(equalv(list(3, 4, 5), atomize_container(v, 2)));
+    EXPECT_TRUE(equalv(list(4, 5), atomize_container(v, 3, 10)));
+    EXPECT_TRUE(is_nil(atomize_container(v, 5)));
+    EXPECT_EQ(2u, length(atomize_container(v, 3, 10)));
+}
+TEST(std_conversion,reconstitute_container)
+{
+    std::vector<int> v = reconstitute_container<std::vector<int>>(list(1, 2, 3));
+    EXPECT_EQ((std::vector<int>{1, 2, 3}), v);
+    std::list<std::string> l = reconstitute_container<std::list<std::string>>(list("a", "b"));
+    EXPECT_EQ((std::list<std::string>{"a", "b"}), l);
+}
 
 
 //-----------------------------------------------------------------------------
 // std:: iteration of lists
-TEST(std_iteration,iterator){}
-TEST(std_iteration,const_iterator){}
-TEST(std_iteration,begin){}
-TEST(std_iteration,end){}
-TEST(std_iteration,cbegin){}
-TEST(std_iteration,cend){}
+TEST(std_iteration,iterator)
+{
+    atom l = list(1, 2, 3);
+    int sum = 0;
+    for(fl::iterator it(l); it != fl::iterator(); ++it){ sum += value<int>(*it); }
+    EXPECT_EQ(6, sum);
+}
+TEST(std_iteration,const_iterator)
+{
+    atom l = list(1, 2, 3);
+    int sum = 0;
+    for(fl::const_iterator it(l); it != fl::const_iterator(); it++){ sum += value<int>(*it); }
+    EXPECT_EQ(6, sum);
+}
+TEST(std_iteration,begin)
+{
+    EXPECT_EQ(1, value<int>(*std::begin(list(1, 2))));
+}
+TEST(std_iteration,end)
+{
+    atom l = list(1, 2);
+    EXPECT_EQ(2, std::distance(std::begin(l), std::end(l)));
+    EXPECT_TRUE(std::begin(nil()) == std::end(nil()));
+}
+TEST(std_iteration,cbegin)
+{
+    EXPECT_EQ(1, value<int>(*std::cbegin(list(1, 2))));
+}
+TEST(std_iteration,cend)
+{
+    atom l = list(1, 2, 3);
+    auto it = std::find_if(std::cbegin(l), std::cend(l), [](const atom& a){ return value<int>(a) == 2; });
+    ASSERT_TRUE(it != std::cend(l));
+    EXPECT_EQ(2, value<int>(*it));
+}
+
+
+//-----------------------------------------------------------------------------
+// channel and worker tests
+TEST(concurrency,channel)
+{
+    channel ch = make_channel();
+    atom a = list(1, 2);
+    EXPECT_TRUE(ch.send(a));
+    EXPECT_EQ(1u, ch.size());
+    atom b;
+    ASSERT_TRUE(ch.recv(b));
+    EXPECT_TRUE(equalv(a, b));
+    EXPECT_FALSE(equalp(a, b)); // the receiver gets a copy
+
+    ch.send(3);
+    int i = 0;
+    ASSERT_TRUE(ch.recv(i));
+    EXPECT_EQ(3, i);
+
+    ch.close();
+    EXPECT_TRUE(ch.closed());
+    EXPECT_FALSE(ch.send(1));
+    EXPECT_FALSE(ch.recv(b));
+}
+TEST(concurrency,worker)
+{
+    channel done = make_channel();
+    worker w([done](int i) mutable { done.send(i * 2); });
+    w.schedule(2);
+    int r = 0;
+    ASSERT_TRUE(done.recv(r));
+    EXPECT_EQ(4, r);
+    w.halt();
+}
+TEST(concurrency,workerpool)
+{
+    workerpool wp;
+    wp.start(2);
+    EXPECT_EQ(2u, wp.worker_count());
+    channel done = make_channel();
+    for(int i = 0; i < 10; ++i)
+    {
+        wp.schedule([done](int i) mutable { done.send(i); }, i);
+    }
+    int sum = 0;
+    for(int i = 0; i < 10; ++i)
+    {
+        int r = 0;
+        ASSERT_TRUE(done.recv(r));
+        sum += r;
+    }
+    EXPECT_EQ(45, sum);
+
+
+    // move only functions are scheduled and sent without being cloned
+    auto p = std::make_unique<int>(7);
+    wp.schedule([done, p = std::move(p)]() mutable { done.send(*p); });
+    int r = 0;
+    ASSERT_TRUE(done.recv(r));
+    EXPECT_EQ(7, r);
+
+    channel fns = make_channel();
+    auto q = std::make_unique<int>(8);
+    EXPECT_TRUE(fns.send(atom([q = std::move(q)]{ return *q; })));
+    atom f;
+    ASSERT_TRUE(fns.recv(f));
+    EXPECT_EQ(8, value<int>(eval(list(f))));
+}
+TEST(concurrency,continuation)
+{
+    continuation cn = make_continuation();
+    channel done = make_channel();
+    atom recv_f([done](int i) mutable { done.send(i); });
+    cn.send(7);
+    cn.recv(recv_f);
+    int r = 0;
+    ASSERT_TRUE(done.recv(r));
+    EXPECT_EQ(7, r);
+}